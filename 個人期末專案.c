@@ -1,8 +1,42 @@
+#define _GNU_SOURCE   // Linux：pthread_setaffinity_np
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <linux/futex.h>
+#endif
+
+/* x86 上另外編一份 AVX2 的批次計分，執行時看 CPU 有沒有支援再決定用哪個 */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNEL 1
+#include <immintrin.h>
+#endif
 
 /* ====== 常數設定 ====== */
 #define NUM_CARDS 52
@@ -19,38 +53,97 @@
 
 /* 花色：0 = ♠, 1 = ♥, 2 = ♣, 3 = ♦ */
 typedef struct {
-    int suit; // 0~3
-    int rank; // 1~13 (1 = A, 11 = J, 12 = Q, 13 = K)
-} Card;
+    unsigned char suit : 2; // 0~3
+    unsigned char rank : 4; // 1~13 (1 = A, 11 = J, 12 = Q, 13 = K)
+} Card;                     // 一張牌只佔 1 byte
 
-/* 遊戲狀態：之後可以慢慢加東西進來 */
+/*
+ * 位元版的牌組：一張牌佔一個 bit（bit = suit * 13 + rank - 1）
+ * 每個花色是一條 13-bit 的 rank 通道：♠ bit 0~12、♥ 13~25、♣ 26~38、♦ 39~51
+ */
+typedef unsigned long long CardMask;
+
+#define RANK_LANE       0x1FFFULL                    // 一個花色通道的 13 個 bit
+#define FULL_DECK_MASK  ((1ULL << NUM_CARDS) - 1)    // 52 張全部都在
+
+/*
+ * 以計數器為基礎的亂數產生器：第 n 個亂數 = hash(key, n)
+ * 不用依序產生，直接把 counter 設到想要的位置就能重現
+ */
+typedef struct {
+    unsigned int key[2];
+    unsigned int counter;
+} Rng;
+
+/*
+ * 分數用定點數存：1 分 = SCORE_SCALE
+ * 0.5 分、x1.5、Combo 每層 +0.15 乘起來都還是整數，存起來不會有誤差
+ */
+#define SCORE_SCALE 10000
+
+/*
+ * 遊戲狀態：整個是一個值型別（不含指標），剛好 2 條 cache line
+ * 搜尋時要複製一份盤面，直接 struct 指派（memcpy）就好，不用另外配記憶體
+ */
 typedef struct {
-    Card *deck;      // 整副牌（動態配置）
-    int deckIndex;   // 下一張要抽的位置（0~51）
-    Card *hand;      // 玩家手牌（動態配置，固定 7 張）
-    int level;       // 目前關卡
-    double score;    // 目前分數
-    double target;   // 這一關需要達到的目標分數
+    CardMask deckMask;   // 還沒發出來的牌（deck[deckIndex..51]）
+    CardMask playedMask; // 本關已經打出或丟棄的牌
+    unsigned long long zobrist; // 牌面的 Zobrist hash（沒發的牌 + 手牌），抽牌 / 換牌時順手更新
+    Rng rng;             // 這一局的亂數（洗牌 / Magic / 商店），由種子 + 局號決定
+
+    int score;           // 目前分數（定點數，見 SCORE_SCALE）
+    int target;          // 這一關需要達到的目標分數（定點數）
+    int singleScore;     // 本關 Single 的分數（定點數）
+    int pairScore;       // 本關 Pair 的分數（定點數）
+    int pairBonus;       // 來自 Magic Card 的 Pair 額外加分（永久累積，定點數）
+    int gold;            // 目前金幣（Gold）
+
+    unsigned short multMask;   // bit r（1~13）：這個點數被 Card Multiplier 強化
+    unsigned short handsUsed;  // 本關已經出了幾手牌
+    unsigned char comboCount;  // 目前的連擊數（只計非 Single，一關最多 26 手）
+    unsigned char deckIndex;   // 下一張要抽的位置（0~52）
+    unsigned char level;       // 目前關卡
+    unsigned char phase;       // 現在輪到哪一種決定（GamePhase）
+
+    unsigned char hasSuitChange : 1;
+    unsigned char hasRedraw : 1;
+    unsigned char redrawUsedThisLevel : 1;
+    unsigned char hasDrawBoost : 1;   // 是否目前手上有一張 Draw Boost（尚未發動）
+    unsigned char drawBoostUsed : 1;  // 這一輪遊戲中是否已經發動過 Draw Boost（跨關不重置）
+
+    Card hand[HAND_SIZE];      // 玩家手牌（固定 7 張）
+    Card deck[NUM_CARDS];      // 整副牌（Draw Boost 翻出來的 3 張就是剛抽掉的最後 3 張）
+} GameState;
 
-    int gold;        // 目前金幣（Gold）
+_Static_assert(sizeof(GameState) <= 128, "GameState 應該塞得進 2 條 cache line");
 
-    double singleScore; // 本關 Single 的分數
-    double pairScore;   // 本關 Pair 的分數
-    double pairBonus;   // 來自 Magic Card 的 Pair 額外加分（永久累積）
+/* 定點分數 ↔ 一般的分數 */
+static inline double scoreValue(int fixed) {
+    return fixed / (double)SCORE_SCALE;
+}
 
-    int hasSuitChange;
+static inline int scoreFixed(double value) {
+    return (int)llround(value * SCORE_SCALE);
+}
 
-    int handsUsed;   // 本關已經出了幾手牌
+/*
+ * 計分全部用整數算（不經過 double），哪台機器、哪種編譯選項結果都一樣：
+ * 倍率用百分比表示，x1.5 = 150、Combo n 連擊 = 100 + 15 * (n - 1)
+ */
+#define BOOST_PERCENT 150
 
-    int hasRedraw; 
-    int redrawUsedThisLevel;
+static inline int comboPercent(int comboCount) {
+    return comboCount > 1 ? 100 + 15 * (comboCount - 1) : 100;
+}
 
-    int hasDrawBoost;   // 是否目前手上有一張 Draw Boost（尚未發動）
-    int drawBoostUsed;  // 這一輪遊戲中是否已經發動過 Draw Boost（跨關不重置）
+/* 定點分數 × 百分比（四捨五入；分數都是 0.5 的倍數時其實都整除） */
+static inline int applyPercent(int fixed, int percent) {
+    return (int)(((long long)fixed * percent + 50) / 100);
+}
 
-    int rankMultiplier[14]; // 1~13：這個點數是否被 Card Multiplier 強化（1 表示有）
-    int comboCount;         // 目前的連擊數（只計非 Single）
-} GameState;
+static inline int rankBoosted(const GameState *game, int rank) {
+    return (game->multMask >> rank) & 1;
+}
 
 /* 牌型相關 */
 typedef enum {
@@ -64,15 +157,138 @@ typedef enum {
     HAND_STRAIGHT_FLUSH,  // 同花順
 } HandType;
 
-/* 音效播放（避免疊音版） */
-void playSound(const char *path) {
-    system("killall afplay >/dev/null 2>&1");   // 先停掉上一個正在播的 afplay
+/* ====== 位元牌組小工具 ====== */
+
+/* Card → bit 編號（0~51） */
+static inline int cardIndex(const Card *c) {
+    return c->suit * 13 + c->rank - 1;
+}
+
+static inline CardMask cardBit(const Card *c) {
+    return 1ULL << cardIndex(c);
+}
+
+/* bit 編號 → Card */
+static inline Card cardFromIndex(int idx) {
+    Card c;
+    c.suit = idx / 13;
+    c.rank = idx % 13 + 1;
+    return c;
+}
+
+static inline int maskHas(CardMask m, const Card *c) {
+    return (m & cardBit(c)) != 0;
+}
+
+static inline int maskCount(CardMask m) {
+    return __builtin_popcountll(m);
+}
+
+/* 某個花色通道裡的 13-bit rank mask */
+static inline unsigned int suitLane(CardMask m, int suit) {
+    return (unsigned int)((m >> (suit * 13)) & RANK_LANE);
+}
+
+/* 某個點數在 4 個花色通道裡的 bit（rank 1 = bit 0、13、26、39） */
+#define RANK_COLUMN 0x0000008004002001ULL
+
+/* 牌組裡某個點數 / 花色有幾張（deckMask 抽牌時就更新好了，這裡只要一次 popcount） */
+static inline int rankCount(CardMask m, int rank) {
+    return maskCount(m & (RANK_COLUMN << (rank - 1)));
+}
+
+static inline int suitCount(CardMask m, int suit) {
+    return __builtin_popcount(suitLane(m, suit));
+}
+
+/* 把 4 個花色通道 OR 起來：出現過哪些點數 */
+static inline unsigned int rankUnion(CardMask m) {
+    return (unsigned int)((m | (m >> 13) | (m >> 26) | (m >> 39)) & RANK_LANE);
+}
+
+/* 有沒有某個花色 >= 5 張 */
+static inline int maskHasFlush(CardMask m) {
+    for (int s = 0; s < 4; s++) {
+        if (__builtin_popcount(suitLane(m, s)) >= 5) return 1;
+    }
+    return 0;
+}
+
+/* 13-bit rank mask 裡有沒有 5 個連續點數（A 只當 1，和 isStraight 一樣） */
+static inline int ranksHaveStraight(unsigned int ranks) {
+    return (ranks & (ranks >> 1) & (ranks >> 2) & (ranks >> 3) & (ranks >> 4)) != 0;
+}
+
+static inline int maskHasStraight(CardMask m) {
+    return ranksHaveStraight(rankUnion(m));
+}
+
+CardMask maskFromCards(const Card *cards, int n);
+int cardsFromMask(CardMask m, Card *out);
+
+/* 手牌的位元版（Suit Change 做出重複的牌時，重複的只算一個 bit） */
+static inline CardMask handMask(const GameState *game) {
+    return maskFromCards(game->hand, HAND_SIZE);
+}
+
+/*
+ * Zobrist hash：每張牌有兩把隨機 key，一把代表「還在牌堆」，一把代表「在手牌」
+ * 用加減而不是 XOR 合起來，Suit Change 做出兩張一樣的牌時才不會互相抵銷
+ * 牌面的 hash = 牌堆裡每張牌的 key + 手牌每張的 key，抽牌 / 換牌只要加減一兩把 key
+ */
+static unsigned long long zobristDeckKey[NUM_CARDS];
+static unsigned long long zobristHandKey[NUM_CARDS];
+static unsigned long long zobristFullDeck;   // 52 張都在牌堆、手上沒牌
+
+/* 從牌堆抽一張（同時更新 deckMask 和 hash） */
+static inline Card drawCard(GameState *game) {
+    Card c = game->deck[game->deckIndex];
+    game->deckIndex++;
+    game->deckMask &= ~cardBit(&c);
+    game->zobrist -= zobristDeckKey[cardIndex(&c)];
+    return c;
+}
 
-    char cmd[512];
-    snprintf(cmd, sizeof(cmd), "afplay \"%s\" >/dev/null 2>&1 &", path);
-    system(cmd);
+/* 把第 i 張手牌換成 c（同時更新 hash） */
+static inline void setHandCard(GameState *game, int i, Card c) {
+    game->zobrist += zobristHandKey[cardIndex(&c)] - zobristHandKey[cardIndex(&game->hand[i])];
+    game->hand[i] = c;
 }
 
+/* Draw Boost 翻出來、還沒決定的 3 張（只在 PHASE_BOOST_PICK 有意義） */
+static inline const Card *boostCards(const GameState *game) {
+    return &game->deck[game->deckIndex - 3];
+}
+
+/* ====== 音效引擎（獨立的音效執行緒，遊戲流程不會被卡住） ====== */
+
+typedef enum {
+    SOUND_PLAY_OK = 0,     // 出牌成功
+    SOUND_PLAY_FAIL,       // 出牌失敗
+    SOUND_LEVEL_CLEAR,     // 過關
+    SOUND_FINAL_CLEAR,     // 最後一關過關
+    SOUND_LEVEL_FAIL,      // 遊戲失敗
+    SOUND_COMBO,           // 連擊
+    NUM_SOUNDS,
+} SoundId;
+
+/*
+ * 開啟音效引擎：一開始就把 sounds/ 底下的檔案讀進記憶體
+ * spec：NULL = 預設（macOS 用 afplay，其他系統不出聲）
+ *       "afplay" / "null" / "wav:檔名"（把音效時間軸寫成 WAV，沒有喇叭的機器用）
+ * 回傳 0 表示 spec 不認得
+ */
+int audioInit(const char *spec);
+
+/* 關掉音效引擎（停止播放、等音效執行緒結束） */
+void audioShutdown(void);
+
+/* 音效播放（避免疊音版）：丟進佇列就回來，新的音效會切掉還在播的那個 */
+void playSound(SoundId id);
+
+/* 音效長度（秒，從 MP3 檔頭估算；沒有檔案時為 0） */
+double soundDuration(SoundId id);
+
 /* 初始化遊戲：配置記憶體、設定初始狀態（但不洗牌、不發牌） */
 void initGame(GameState *game);
 
@@ -82,7 +298,7 @@ void setupLevel(GameState *game, int level);
 void initDeck(Card *deck);
 
 /* 洗牌：Fisher-Yates 洗牌法 */
-void shuffleDeck(Card *deck);
+void shuffleDeck(Card *deck, Rng *rng);
 
 /* 發初始牌（7 張） */
 void dealInitialHand(GameState *game);
@@ -93,1099 +309,8472 @@ void printCard(const Card *c);
 /* 顯示整個手牌 */
 void printHand(const Card *hand);
 
-/* 玩家出牌 → 暫時只做「選幾張牌」 + 回傳那幾張（之後會加牌型判斷） */
-int playerPlayHand(GameState *game, Card *played, int *playedCount);
+/* 在手牌下方印出最佳出牌提示 */
+void printPlayHint(const GameState *game);
+
+/* 聽牌機率：留著目前的手牌、再看 draws 張，湊得出各種 5 張牌型的機率 */
+typedef struct {
+    double straight;
+    double flush;
+    double fullHouse;
+    double fourKind;
+} OutsOdds;
+
+void computeOuts(const GameState *game, int draws, OutsOdds *out);
+
+/* 在手牌下方印出聽牌機率（再看 1 / 2 / 5 張） */
+void printOuts(const GameState *game);
 
 void sortByRank(Card *cards, int n);
 int isFlush(Card *cards, int n);
 int isStraight(Card *cards, int n);
 HandType classifyHand(Card *played, int playedCount);
-double handTypeBaseScore(HandType type);
+HandType classifyHandReference(Card *played, int playedCount);
+void initHandTables(void);
+
+/* 產生 Zobrist key（程式開始時呼叫一次） */
+void initZobristKeys(void);
+
+/* 從頭算一次牌面的 hash（檢查增量更新有沒有漏掉用的） */
+unsigned long long zobristFromScratch(const GameState *game);
+HandType classifyFromCounts(int playedCount, unsigned long long counts,
+                            unsigned int rankBits, unsigned int suitBits);
+int handTypeBaseScore(HandType type);   // 5 張牌型的基本分（定點數）
 const char *handTypeName(HandType type);
 const char *suitSymbol(int s);
 
-/* 根據出的牌來計分（之後實作牌型判斷邏輯） */
-double evaluateHand(Card *played, int playedCount, const GameState *game, int *outHasBoost);
+/* 根據出的牌來計分（定點數，尚未套用 Combo） */
+int evaluateHand(Card *played, int playedCount, const GameState *game, int *outHasBoost);
+
+/* 已經知道牌型時直接計分（避免同一手牌判斷兩次牌型） */
+int scoreHandType(HandType type, const Card *played, int playedCount, const GameState *game, int *outHasBoost);
+
+/* 原本用 double 的計分（對照組）：在 game 的局面出這手，回傳實得分（定點數），outGold = 賺到的 Gold */
+int scorePlayReference(Card *played, int playedCount, const GameState *game, int *outGold);
+
+/*
+ * 一批出牌一起判斷牌型和計分（struct of arrays，每手可以來自不同局面，
+ * 例如一手牌的 21 種 5 張組合，或很多個環境各出一手）
+ * 第 i 手的第 k 張是 rank[k][i] / suit[k][i]，k >= count[i] 的欄位不看
+ * 結果和 classifyHand + scoreHandType 一模一樣
+ */
+#define PLAY_LANES 8   // 一次算幾手（AVX2 一個暫存器 8 個 32-bit）
+
+typedef struct {
+    int n, capacity;                   // capacity 是 PLAY_LANES 的倍數，多出來的位置 count = 0
+
+    /* 輸入 */
+    unsigned char *count;              // 張數（只有 1 / 2 / 5 可能合法）
+    unsigned char *rank[5];            // 1~13
+    unsigned char *suit[5];
+    unsigned short *multMask;          // 出牌當下的規則（同 GameState）
+    unsigned char *combo;              // 出牌前的 comboCount
+    int *singleScore, *pairScore;      // 定點數
+
+    /* 輸出 */
+    unsigned char *type;               // HandType
+    unsigned char *hasBoost;           // 是否觸發 Card Multiplier
+    int *baseGain;                     // 尚未套用 Combo（已含 x1.5），和 evaluateHand 相同（定點數）
+    int *gain;                         // 套用出完這手之後的 Combo 倍率（Single 不套）
 
-/* 移除手牌中剛剛打出的牌，並從牌堆補到 7 張 */
-void updateHandAfterPlay(GameState *game, Card *played, int playedCount);
+    void *block;
+} PlayBatch;
 
-/* 主遊戲迴圈：這一關從開始玩到結束（過關或失敗） */
-int playLevel(GameState *game);
+int playBatchInit(PlayBatch *batch, int capacity);
+void playBatchFree(PlayBatch *batch);
 
-void chooseMagicCard(GameState *game);
+/* 在 game 的局面下出 played 這幾張，加到批次最後面，回傳編號（滿了回傳 -1） */
+int playBatchAdd(PlayBatch *batch, const Card *played, int playedCount, const GameState *game);
 
-void applySuitChangeMagic(GameState *game);
+/* 算 batch 裡全部的出牌（CPU 有 AVX2 就用 AVX2，沒有就用一般版本，initHandTables 時決定） */
+void scorePlayBatch(PlayBatch *batch);
 
-void tryUseDrawBoost(GameState *game);
+/* 目前 scorePlayBatch 用的版本名稱 */
+const char *playBatchKernelName(void);
 
-void shopSystem(GameState *game);
+/* 移除手牌中剛剛打出的牌，並從牌堆補到 7 張（牌堆不夠補時回傳 0，手牌不變） */
+int updateHandAfterPlay(GameState *game, Card *played, int playedCount);
 
 void waitEnter(void);
 
+/* 讀一個整數（回傳值同 scanf，不是數字時這一行剩下的會丟掉）；互動模式讀數字都走這裡 */
+int readInt(int *out);
+
 /* 釋放動態記憶體 */
 void freeGame(GameState *game);
 
+/* ====== 規則函式（不印東西、不讀輸入，互動模式與模擬模式共用） ====== */
 
-/* ====== main 函式 ====== */
-int main() {
-    srand((unsigned int)time(NULL)); // rand() 初始化
+/* 一手牌結算後的結果（給結算面板或統計用） */
+typedef struct {
+    HandType type;
+    int baseGain;      // 尚未套用 Combo 的分數（已含 x1.5，定點數）
+    int comboPercent;  // 這手牌套用的 Combo 倍率（百分比，115 = x1.15）
+    int gain;          // 實得分（定點數）
+    int earnGold;      // 這手牌賺到的 Gold
+    int hasBoost;      // 是否觸發 Card Multiplier
+    int brokeCombo;    // 是否因為 Single 中斷連擊
+} PlayResult;
+
+/* 商店購買的結果 */
+typedef enum {
+    SHOP_OK = 0,         // 購買成功
+    SHOP_ALREADY_OWNED,  // 已經持有，不能再買
+    SHOP_NO_GOLD,        // Gold 不足
+    SHOP_SOLD_OUT,       // Card Multiplier：1~13 全部都強化過了
+    SHOP_INVALID,        // 不存在的選項
+} ShopResult;
 
-    GameState game;
-    initGame(&game);
+#define COST_DRAW    25
+#define COST_MULTI   30
+#define COST_REDRAW  20
 
-    while (1) {       // 一輪遊戲（1~5 關），結束後可選擇重玩
-        int clearedAll = 1;  // 假設一開始會通關，若中途失敗再改成 0
+/* 把 GameState 重設成「新的一輪」的狀態（不動 deck/hand 的記憶體） */
+void resetGameState(GameState *game);
 
-        // 從第 1 關一路玩到第 5 關
-        for (int lv = 1; lv <= 5; lv++) {
-            // 設定這一關的目標分數 + Single/Pair 規則 + handsUsed 歸零
-            setupLevel(&game, lv);
+/* 開始第 level 關：設定規則、分數歸零、重建牌堆洗牌、發起手牌 */
+void startLevel(GameState *game, int level);
 
-            // 每一關開始前，把分數歸零
-            game.score = 0.0;
+/* 根據打出的牌更新分數 / Combo / Gold（不補牌） */
+void scorePlayedHand(GameState *game, Card *played, int playedCount, PlayResult *out);
 
-            // 重新建立牌堆、洗牌、發新的起手牌
-            initDeck(game.deck);
-            shuffleDeck(game.deck);
-            game.deckIndex = 0;
-            dealInitialHand(&game);
+/* Redraw：重抽整手牌（牌堆不夠回傳 0） */
+int useRedraw(GameState *game);
 
-            if (game.hasSuitChange) {
-                applySuitChangeMagic(&game);
-            }
+/* Draw Boost：先從牌堆翻出 3 張（牌堆不夠回傳 0），再決定留哪張、換哪張 */
+int drawBoostReveal(GameState *game, Card candidates[3]);
+void drawBoostApply(GameState *game, const Card *picked, int replaceIndex);
 
-            // 開始這一關
-            int ok = playLevel(&game);
-            if (!ok) {
-                // 這一關失敗，結束本輪遊戲
-                printf("遊戲在第 %d 關結束。\n", lv);
-                clearedAll = 0;   // 沒有通過所有關卡
-                break;            // 跳出 for 迴圈，去問要不要再玩一次
-            }
+/* Suit Change：把第 idx 張手牌改成 newSuit */
+void applySuitChange(GameState *game, int idx, int newSuit);
 
-            // 如果 ok == 1，代表這一關過關
-            if (lv < 5) {
-                printf("\n=== 你已通過第 %d 關 ===\n", lv);
+/* Magic Card：choice 1 = Hand Score Upgrade(+bonus)，2 = Suit Change */
+int rollMagicBonus(GameState *game);
+void applyMagicChoice(GameState *game, int choice, int bonus);
 
-                // 1) 免費二選一
-                chooseMagicCard(&game);
+/* 商店：choice 1 = Draw Boost, 2 = Card Multiplier, 3 = Redraw */
+ShopResult shopBuy(GameState *game, int choice, int *outRank);
 
-                // 2) 商店（花 Gold 買）
-                shopSystem(&game);
+/* ====== 遊戲引擎（純規則的 step，不印東西、不讀輸入、不播音效） ====== */
 
-                printf("準備進入第 %d 關。\n\n", lv + 1);
-            }
-        }
+/*
+ * 整個遊戲是一個狀態機：game->phase 表示現在在等哪一種決定
+ * 互動模式、模擬、求解器、重播都是把「決定」包成 GameAction 丟給 gameStep
+ */
+typedef enum {
+    PHASE_SUIT_CHANGE = 0,  // 關卡開始：要不要用 Suit Change
+    PHASE_TURN,             // 出牌回合：出牌 / 放棄 / Redraw / Draw Boost
+    PHASE_BOOST_PICK,       // Draw Boost 翻出 3 張：留哪張、換哪張
+    PHASE_MAGIC,            // 過關後的免費二選一
+    PHASE_SHOP,             // 商店（買成功一次或離開 → 下一關）
+    PHASE_GAME_OVER,        // 這一輪結束（五關全過或失敗）
+} GamePhase;
 
-        if (clearedAll) {
-            printf("\n恭喜你通過所有關卡！\n");
-        }
+typedef enum {
+    ACT_PLAY = 0,     // arg = 手牌 index 的 bitmask
+    ACT_PASS,         // 這回合不出牌（連擊中斷）
+    ACT_REDRAW,       // 用 Redraw 重抽整手
+    ACT_DRAW_BOOST,   // 用 Draw Boost 翻 3 張 → PHASE_BOOST_PICK
+    ACT_BOOST_PICK,   // arg = pick << 3 | replaceIndex
+    ACT_SUIT_CHANGE,  // arg = idx << 2 | newSuit
+    ACT_MAGIC,        // arg = 1 / 2
+    ACT_SHOP,         // arg = 1 / 2 / 3
+    ACT_SKIP,         // 放棄 Suit Change / 取消 Draw Boost / 離開商店
+} ActionType;
 
-        // 問玩家要不要再玩一次
-        int replay;
-        printf("\n要再玩一次嗎？(1 = 再玩一次, 0 = 離開)：");
-        if (scanf("%d", &replay) != 1 || replay == 0) {
-            printf("謝謝遊玩！\n");
-            break;  // 跳出 while(1)，準備結束程式
-        }
+typedef struct {
+    unsigned char type;   // ActionType
+    unsigned char arg;
+} GameAction;
 
-        // ==== 重設 GameState，準備新的一輪 ====
-        game.level        = 1;
-        game.score        = 0.0;
-        game.target       = 0.0;
-        game.gold         = 0;      // 重新開始一輪時 Gold 歸零
-        game.hasSuitChange = 0;
-        game.handsUsed    = 0;
-        game.pairBonus    = 0.0;     // Magic 加成重置
-        game.deckIndex    = 0;
+/* 一步的結果 */
+typedef struct {
+    double reward;      // 這一步得到的分數
+    int done;           // 1 = 這一輪結束（PHASE_GAME_OVER）
+    int ok;             // 0 = 這個動作不成立（不合法的牌型會讓這回合作廢，其他情況狀態不變）
+    int levelEnd;       // 1 = 這一步過關，-1 = 這一步失敗
+    int refillFailed;   // ACT_PLAY：牌堆不夠補牌（手牌維持原樣）
+    PlayResult play;    // ACT_PLAY 的結算
+    ShopResult shop;    // ACT_SHOP 的結果
+    int shopRank;       // 買到 Card Multiplier 時強化的點數
+} StepResult;
 
-        // 重抽功能相關
-        game.hasRedraw = 0;
-        game.redrawUsedThisLevel = 0;
- 
-        // Draw Boost 系統
-        game.hasDrawBoost  = 0;
-        game.drawBoostUsed = 0;
+/* 開始新的一輪（第 gameNo 局，直接進第 1 關） */
+void newGame(GameState *game, unsigned long long seed, unsigned long long gameNo);
 
-        game.comboCount    = 0;      // 新的一輪，連擊也歸零
+/* 執行一個動作，回傳 out->ok */
+int gameStep(GameState *game, GameAction action, StepResult *out);
 
-        // deck / hand 不用重新 malloc，因為 initGame 已經配好記憶體
+/* 免費二選一的 Pair 加分（先看不抽，ACT_MAGIC 抽到的一定是這個數字） */
+int peekMagicBonus(const GameState *game);
 
-        // Card Multiplier：新的一輪遊戲要重置
-        for (int r = 1; r <= 13; r++) {
-            game.rankMultiplier[r] = 0;
-        }
-    }
+/*
+ * 一次推進很多個環境（訓練用）
+ * 規則狀態每個環境各一份；動作、獎勵和觀察值都是 struct of arrays
+ * 某個環境結束時會自動開下一局（done[i] = 1 表示這一步是上一局的最後一步）
+ */
+typedef struct {
+    int n;
+    unsigned long long seed;
+    GameState *games;                  // 64 bytes 對齊，每個環境剛好佔 2 條 cache line
+    unsigned long long *episode;       // 每個環境目前是第幾局
+
+    /* 每一步之後更新的輸出（全部放在同一塊記憶體，見 envBatchObsSize） */
+    float *reward;
+    unsigned char *done;
+    unsigned char *phase;
+    unsigned char (*hand)[HAND_SIZE];  // 手牌的 card index
+    float *score;
+    float *target;
+    int *gold;
+    unsigned char *combo;              // comboCount
+    unsigned char *deckLeft;           // 牌堆還剩幾張
+    unsigned short *multMask;          // 同 GameState.multMask：bit r = 點數 r 被強化
+    void *obsArea;
+    int ownsObs;                       // obsArea 是不是自己配置的
+} EnvBatch;
+
+/* n 個環境的輸出陣列總共要多大（每個陣列 64 bytes 對齊，依上面欄位順序排） */
+size_t envBatchObsSize(int n);
+
+/* obsArea = NULL → 自己配置；否則輸出直接寫進 obsArea（例如共享記憶體） */
+int envBatchInit(EnvBatch *batch, int n, unsigned long long seed, void *obsArea);
+void envBatchStep(EnvBatch *batch, const GameAction *actions);
+void envBatchFree(EnvBatch *batch);
+
+/* --step-bench N：用 n 個環境的 EnvBatch 跑 N 步並印出速度 */
+int runStepBench(long steps, int n, unsigned long long seed);
+
+/* ====== 共享記憶體環境（Linux：訓練程式直接讀寫，不經過 scanf/printf） ====== */
 
-    freeGame(&game);  // 只在最後一次離開時釋放記憶體
-    return 0;
-}
+/*
+ * POSIX 共享記憶體的排列（全部 64 bytes 對齊）：
+ *   [ShmEnvHeader][GameAction actions[n]][EnvBatch 的輸出陣列]
+ * 交握（兩個都是 futex word，只會一直往上加）：
+ *   訓練端：寫好 actions → actionSeq + 1 → 等 obsSeq 追上
+ *   遊戲端：等 actionSeq 變 → envBatchStep（直接寫進共享記憶體）→ obsSeq + 1
+ * 一開始遊戲端把第一個觀察值準備好時 obsSeq = 1
+ * 兩邊等待時每隔一小段時間看一下對方的 pid 還在不在：對方死掉就不再等
+ * （訓練端接上後要把自己的 pid 寫進 trainerPid；沒寫的話遊戲端只能一直等）
+ * 等的一邊先轉圈 / 讓出 CPU，真的要睡進 futex 前才把 xxxSleeping 設成 1；
+ * 加 seq 的一邊只有看到 1 才 FUTEX_WAKE（外部程式也要照這個規則）
+ */
+#define SHM_ENV_MAGIC   0x45534743u   // "CGSE"
+#define SHM_ENV_VERSION 3
 
-/* ====== 函式實作區 ====== */
-void initGame(GameState *game) {
-    // 配置記憶體給 deck 與 hand
-    game->deck = malloc(NUM_CARDS * sizeof(Card));
-    game->hand = malloc(HAND_SIZE * sizeof(Card));
+typedef struct {
+    _Atomic unsigned int magic;      // 最後才寫，訓練端看到就代表可以用了
+    unsigned int version;
+    unsigned int numEnvs;
+    unsigned int totalSize;
+    _Atomic int gamePid;             // 遊戲端（建立 segment 的 process）
+    _Atomic int trainerPid;          // 訓練端，0 = 沒登記
+    _Alignas(64) _Atomic unsigned int actionSeq;
+    _Atomic unsigned int actionSleeping;   // 1 = 遊戲端睡在 actionSeq 上
+    _Alignas(64) _Atomic unsigned int obsSeq;
+    _Atomic unsigned int obsSleeping;      // 1 = 訓練端睡在 obsSeq 上
+    _Atomic unsigned int quit;       // 訓練端設成 1 再加 actionSeq → 遊戲端結束
+    /* 各陣列相對於 segment 開頭的位置（給 numpy 之類的外部程式用） */
+    unsigned int actionsOffset;
+    unsigned int rewardOffset, doneOffset, phaseOffset, handOffset;
+    unsigned int scoreOffset, targetOffset, goldOffset;
+    unsigned int comboOffset, deckLeftOffset, multMaskOffset;
+} ShmEnvHeader;
+
+/* --shm-env NAME --envs N：建立共享記憶體並一直服務到訓練端要求結束 */
+int runShmEnv(const char *name, int n, unsigned long long seed);
+
+/* --shm-bench N：fork 出遊戲端，用共享記憶體跑 N 步（n 個環境），和同一個 process 的速度比較 */
+int runShmBench(long steps, int n, unsigned long long seed);
+
+/* ====== 畫面緩衝區（先畫在記憶體裡，和上一個畫面比對，一次 write 出去） ====== */
+
+#define FRAME_MAX_ROWS 24
+#define FRAME_MAX_COLS 128
+
+/* 文字屬性：低 4 bit 是顏色，ATTR_BOLD 是粗體 */
+enum { FG_DEFAULT = 0, FG_RED, FG_GREEN, FG_YELLOW, FG_MAG, FG_CYAN };
+#define ATTR_BOLD 0x10
+
+/* 開始畫新的一塊畫面（rows 行，全部先清成空白） */
+void frameBegin(int rows);
+
+/* 在 (row, col) 寫 UTF-8 字串，中文字佔 2 格；回傳寫完後的欄位 */
+int framePutText(int row, int col, int attr, const char *text);
+int framePrintf(int row, int col, int attr, const char *fmt, ...);
+
+/* 畫一張 5x7 的卡牌框 / 花色框（selected = 黃色粗體框線） */
+void frameDrawCard(int row, int col, const Card *c, int idx, int selected);
+void frameDrawSuitBox(int row, int col, int suit, int idx, int selected);
 
-    if (game->deck == NULL || game->hand == NULL) {
-        printf("記憶體配置失敗！\n");
-        exit(1);
-    }
+/*
+ * 把這一塊畫面送到終端機（只呼叫一次 write）
+ * inPlace = 0：接在目前游標下面印出整塊
+ * inPlace = 1：游標回到上一塊的位置，只更新有變的格子（上一塊要剛好在游標正上方）
+ */
+void frameFlush(int inPlace);
 
-    game->deckIndex = 0;
-    game->score = 0.0;
-    game->level = 1;
-    game->target = 0.0;
-    game->gold = 0;      // 開新遊戲金幣從 0 開始
-    game->hasSuitChange = 0;
-    game->handsUsed = 0;
-    game->pairBonus = 0.0;
-    game->hasRedraw = 0;
-    game->redrawUsedThisLevel = 0;
-    game->hasDrawBoost = 0;
-    game->drawBoostUsed = 0;
-    game->comboCount = 0;
+/* 輸出目標（預設 STDOUT_FILENO；benchmark 可以接 /dev/null） */
+void frameSetOutput(int fd);
 
-    // Card Multiplier：一開始全部都沒有被強化
-    for (int r = 1; r <= 13; r++) {
-        game->rankMultiplier[r] = 0;
-    }
-}
+/* 累計送出了多少 bytes（量輸出量用） */
+long frameBytesWritten(void);
 
-void setupLevel(GameState *game, int level) {
-    game->level = level;
+/*
+ * 讓呼叫的執行緒改用自己的一塊畫面（伺服器的 worker 同時畫不同的 session）
+ * 這塊畫面的輸出是 -1：frameFlush 不寫出去，畫好的 bytes 用 frameOutput 拿
+ */
+int frameUseThreadBuffer(void);
+void frameReleaseThreadBuffer(void);
+const char *frameOutput(size_t *len);
+
+/* ====== 終端機按鍵輸入（raw mode：一次讀一個按鍵，不用等 Enter） ====== */
+
+/* termReadKey 的回傳值：一般字元就是它的 ASCII，方向鍵等特殊鍵從 0x100 開始 */
+enum {
+    KEY_NONE = -1,       // 時間到，沒有按鍵
+    KEY_ENTER = '\n',
+    KEY_ESC = 27,
+    KEY_BACKSPACE = 127,
+    KEY_UP = 0x100,
+    KEY_DOWN,
+    KEY_RIGHT,
+    KEY_LEFT,
+    KEY_EOF,             // stdin 關掉了
+};
+
+/* stdin / stdout 都是終端機（而且沒有 --line-input）才用按鍵操作；管線或測試腳本照舊一行一行讀 */
+int termInteractive(void);
+void termForceLineInput(void);
 
-    double baseSingle, basePair;
+/*
+ * 進入 / 離開 raw mode（關掉行緩衝和回顯，Ctrl-C 照常有效）
+ * 離開時恢復原本的設定；raw mode 中被 Ctrl-C / kill 中斷也會先恢復再結束
+ */
+void termRawBegin(void);
+void termRawEnd(void);
 
-    if (level == 1) {
-        game->target = 55.0;
-        baseSingle   = 1.0;
-        basePair     = 2.0;
-    }
-    else if (level == 2) {
-        game->target = 60.0;
-        baseSingle   = 0.5;
-        basePair     = 4.0;
-    }
-    else if (level == 3) {
-        game->target = 65.0;
-        baseSingle   = 0.0;
-        basePair     = 4.0;
-    }
-    else if (level == 4) {
-        game->target = 70.0;
-        baseSingle   = 0.0;
-        basePair     = 4.5;
-    }
-    else if (level == 5) {
-        game->target = 75.0;
-        baseSingle   = 0.0;
-        basePair     = 5.0;
-    }
-    else {
-        game->target = 55.0;
-        baseSingle   = 1.0;
-        basePair     = 2.0;
-    }
+/* 讀一個按鍵（要在 raw mode 裡）；timeoutMs < 0 = 一直等，時間到回傳 KEY_NONE */
+int termReadKey(int timeoutMs);
 
-    // 套用 Magic Card 加成（必須放在後面）
-    game->singleScore = baseSingle;                   // Single 沒有魔法加成
-    game->pairScore   = basePair + game->pairBonus;   // Pair = Level 基礎分 + 魔法加成
-    game->handsUsed = 0;  // 重設本關的出牌次數
-    game->comboCount  = 0;  // 每一關開始時，連擊歸零
-    game->redrawUsedThisLevel = 0;
-    game->drawBoostUsed = 0;
-}
+/* ====== 計時器（單調時鐘的 timer wheel：停頓、音效提示都排成事件，在主迴圈上跑） ====== */
 
-void initDeck(Card *deck) {
-    int index = 0;
-    for (int suit = 0; suit < 4; suit++) {        // 4 種花色
-        for (int rank = 1; rank <= 13; rank++) {  // 1~13
-            deck[index].suit = suit;
-            deck[index].rank = rank;
-            index++;
-        }
-    }
-}
+/* 事件觸發時呼叫；ctx / value 是排程時給的 */
+typedef void (*TimerFn)(void *ctx, int value);
 
-void shuffleDeck(Card *deck) {
-    for (int i = NUM_CARDS - 1; i > 0; i--) {
-        int j = rand() % (i + 1); // 0~i
-        Card temp = deck[i];
-        deck[i] = deck[j];
-        deck[j] = temp;
-    }
-}
+/*
+ * 時間倍率：所有排程的延遲都會除以它
+ * 0 = 不等（測試、錄影用），1 = 正常，> 1 = 快轉
+ */
+void timeSetScale(double scale);
+double timeScale(void);
 
-void dealInitialHand(GameState *game) {
-    for (int i = 0; i < HAND_SIZE; i++) {
-        game->hand[i] = game->deck[game->deckIndex];
-        game->deckIndex++;
-    }
-}
+/*
+ * seconds 秒後（依時間倍率換算）呼叫 fn；換算後是 0 就直接在這裡呼叫
+ * 回傳事件 id（給 timerCancel 用），排滿了回傳 -1
+ */
+int timerAfter(double seconds, TimerFn fn, void *ctx, int value);
+void timerCancel(int id);
 
-void waitEnter(void){
-    int ch;
+/*
+ * 主迴圈：一直觸發到期的事件，直到 id 這個事件觸發為止（id < 0 = 直到沒有事件）
+ * skippable 而且是終端機時，按任意鍵會讓所有還沒到期的事件立刻依序觸發
+ */
+void timerRunUntil(int id, int skippable);
 
-    // 清掉前一次 scanf 留下的殘留（通常是 '\n'）
-    while ((ch = getchar()) != '\n' && ch != EOF) {}
+/* 停頓 seconds 秒（依時間倍率換算），期間照常觸發其他事件；終端機上按任意鍵跳過 */
+void waitFor(double seconds);
 
-    printf("\n%s按 Enter 繼續...%s", C_YELLOW, C_RESET);
-    fflush(stdout);
+/* delay 秒後播放音效（一樣受時間倍率和跳過影響） */
+void cueSound(SoundId id, double delay);
 
-    // 等玩家按 Enter（讀到 '\n' 才結束）
-    while ((ch = getchar()) != '\n' && ch != EOF) {}
+/* ====== 遊戲流程（可以暫停的狀態機：等輸入時就回到呼叫的人，整個狀態是一個小 struct） ====== */
 
-    printf("\n");
-}
+/*
+ * 互動模式從開局到「要再玩一次嗎」的每一步：Suit Change、Redraw / Draw Boost 詢問、出牌、
+ * 結算、免費二選一、商店。每個要等輸入或停頓的地方都是一個狀態，flowInput 餵一個輸入，
+ * 流程就往下跑到下一個要等的地方再回來；中間不會卡在 scanf 裡
+ */
+typedef enum {
+    FLOW_GAME_START,      // 開新的一局（newGame）
+    FLOW_LEVEL_START,     // 關卡開始，有 Suit Change 就先問
+    FLOW_SUIT_PICK,       // 輸入：要改花色的牌
+    FLOW_SUIT_NEW,        // 輸入：新花色
+    FLOW_LEVEL_INTRO,     // 印這一關的目標
+    FLOW_TURN_START,      // 回合開始：分數、Combo、提示
+    FLOW_REDRAW_ASK,      // 輸入：要不要用 Redraw
+    FLOW_BOOST_OFFER,     // 有 Draw Boost 就問
+    FLOW_BOOST_ASK,       // 輸入：要不要用 Draw Boost
+    FLOW_BOOST_PICK,      // 輸入：3 張留哪張
+    FLOW_BOOST_REPLACE,   // 輸入：換掉哪張手牌
+    FLOW_PLAY_START,      // 印手牌和提示，開始選牌
+    FLOW_PICK,            // 按鍵：按鍵選牌
+    FLOW_PLAY_COUNT,      // 輸入：出幾張
+    FLOW_PLAY_INDEX,      // 輸入：第 picked + 1 張的 index
+    FLOW_PLAY,            // 出牌（selected 這幾張，arg = 0 表示放棄）
+    FLOW_SETTLE_SHOW,     // 印結算面板
+    FLOW_SETTLE,          // Enter：看完結算
+    FLOW_LEVEL_END,       // 過關 / 失敗的訊息和音效
+    FLOW_LEVEL_DONE,      // 記錄這一關，決定下一步
+    FLOW_MAGIC,           // 輸入：免費二選一
+    FLOW_SHOP,            // 輸入：商店
+    FLOW_NEXT_LEVEL,      // 離開商店，進下一關
+    FLOW_REPLAY_ASK,      // 輸入：要不要再玩一次
+    FLOW_EXIT,            // 結束
+    FLOW_NUM_STATES
+} FlowState;
+
+/* 流程現在在等什麼（flowRun / flowInput 回來時一定不是 FLOW_WAIT_NONE） */
+typedef enum {
+    FLOW_WAIT_NONE,    // 還在跑
+    FLOW_WAIT_INT,     // 一個整數（readInt）
+    FLOW_WAIT_KEY,     // 一個按鍵（termReadKey）
+    FLOW_WAIT_ENTER,   // 按 Enter 繼續（waitEnter）
+    FLOW_WAIT_PAUSE,   // 停 pause / 10 秒（waitFor），讓音效播完
+    FLOW_WAIT_DONE     // 玩家離開了
+} FlowWait;
 
-void printCard(const Card *c) {
-    char *suitChar;
-    const char *color;
-    switch (c->suit) {
-        case 0: suitChar = "♠"; color = C_CYAN; break;
-        case 1: suitChar = "♥"; color = C_RED;  break;
-        case 2: suitChar = "♣"; color = C_CYAN; break;
-        case 3: suitChar = "♦"; color = C_RED;  break;
-        default: suitChar = "?"; color = "";    break;
-    }
+/*
+ * 一個玩家的整個流程狀態：沒有指標，直接整塊複製就是存檔
+ * （GameState 本身就是值型別；牌堆、手牌都在裡面）
+ */
+typedef struct {
+    GameState game;
+    unsigned long long seed;     // 這一輪的種子和局號（再玩一次時局號 + 1）
+    unsigned long long gameNo;
+    PlayResult play;             // 最近一手的結算（結算面板用）
+    unsigned char state;         // FlowState
+    unsigned char wait;          // FlowWait
+    unsigned char pause;         // 要停幾個 0.1 秒
+    unsigned char keys;          // 1 = 按鍵選牌，0 = 輸入張數和 index
+    unsigned char hints;         // 每回合提示的時間預算（10 ms 為單位），0 = 不印提示
+    unsigned char arg;           // 進行中的選擇：改哪張牌 / 留哪張 / 出幾張
+    unsigned char picked;        // 已經輸入了幾個 index
+    unsigned char selected;      // 選到的手牌（bitmask）
+    unsigned char cursor;        // 按鍵選牌的游標
+    unsigned char notice;        // 按鍵選牌畫面下方的提示
+    unsigned char refillFailed;  // 最近一手出完後牌堆不夠補
+} GameFlow;
+
+/* 開始一輪新遊戲，跑到第一個要等的地方 */
+void flowBegin(GameFlow *f, unsigned long long seed, unsigned long long gameNo, int keys, int hintMs);
 
-    const char *rankStr;
-    static char buf[3];
-    switch (c->rank) {
-        case 1:  rankStr = "A"; break;
-        case 11: rankStr = "J"; break;
-        case 12: rankStr = "Q"; break;
-        case 13: rankStr = "K"; break;
-        default:
-            snprintf(buf, sizeof(buf), "%d", c->rank);
-            rankStr = buf;
-    }
+/*
+ * 給目前等待的東西一個輸入，跑到下一個要等的地方
+ * status 是 readInt 的回傳值（按鍵、Enter、停頓填 1），value 是讀到的數字或按鍵
+ */
+void flowInput(GameFlow *f, int status, int value);
 
-    printf("%s%s%s%s", color, suitChar, rankStr, C_RESET);
-}
+/* 從存檔接著玩：印出目前的局面，再問一次存檔時在等的問題（選到一半的牌要重選，看過的結算面板不再等 Enter） */
+void flowResume(GameFlow *f);
 
-/* 取得花色顏色（紅/青） */
-const char *suitColor(int suit){
-    if (suit == 1 || suit == 3) return C_RED;   // ♥ ♦
-    return C_CYAN;                               // ♠ ♣
-}
+/* 存檔格式：檔頭（魔數、版本、struct 大小）+ GameFlow */
+#define FLOW_SAVE_SIZE (3 * sizeof(unsigned int) + sizeof(GameFlow))
 
-/* 取得點數字串（A,2..10,J,Q,K） */
-const char *rankText(int rank){
-    static char buf[3];
-    switch(rank){
-        case 1:  return "A";
-        case 11: return "J";
-        case 12: return "Q";
-        case 13: return "K";
-        default:
-            snprintf(buf, sizeof(buf), "%d", rank);
-            return buf;
-    }
-}
+/* 寫進 buf，回傳寫了幾個位元組（buf 不夠大回傳 0） */
+size_t flowSave(const GameFlow *f, unsigned char *buf, size_t size);
 
-/* 印 n 個空白 */
-static void printSpaces(int n){
-    for(int i=0;i<n;i++) putchar(' ');
-}
+/* 讀回來；檔頭不對或內容不合理回傳 0 */
+int flowLoad(GameFlow *f, const unsigned char *buf, size_t size);
+
+/* 存到檔案（先寫暫存檔再改名，中途被中斷也不會留下壞掉的存檔） */
+int flowSaveFile(const GameFlow *f, const char *path);
+int flowLoadFile(GameFlow *f, const char *path);
 
 /*
- * 印單張卡牌的某一行（line=0~4）
- * selected=1 → 框線與index用 黃+粗體
+ * --check-flow N：N 個 session 用固定腳本亂數輸入，先一個一個跑完，
+ * 再在同一條執行緒上輪流跑（每次輸入前從存檔載入、輸入後存回去），比對兩次的結果
  */
-void printCardBoxLineSelected(const Card *c, int idx, int line, int selected){
-    const char *s = suitSymbol(c->suit);
-    const char *r = rankText(c->rank);
+int checkFlow(long sessions, unsigned long long seed);
 
-    const char *faceCol = suitColor(c->suit);               // 牌面紅/青
-    const char *boxCol  = selected ? C_YELLOW : C_RESET;    // 框線顏色
-    const char *boxBold = selected ? C_BOLD   : "";         // 框線粗體
+/* ====== 效能追蹤（編譯時加 -DGAME_TRACE 才有；沒加的時候 TRACE_* 巨集什麼都不產生） ====== */
 
-    // 牌面可視長度：suit(1) + rank(1或2)
-    int rankLen = (c->rank == 10) ? 2 : 1;
-    int visLen = 1 + rankLen;
-    int innerW = 5; // 框內寬度
-    int leftPad  = (innerW - visLen) / 2;
-    int rightPad = innerW - visLen - leftPad;
-
-    if (line == 0) {
-        printf("%s%s┌─────┐%s", boxCol, boxBold, C_RESET);
-    } else if (line == 1) {
-        // index行：被選中就黃粗體
-        printf("%s%s│ [%d] │%s", boxCol, boxBold, idx, C_RESET);
-    } else if (line == 2) {
-        // 牌面：框線用box色，牌面用紅/青
-        printf("%s%s│%s", boxCol, boxBold, C_RESET);
-        printSpaces(leftPad);
-        printf("%s%s%s%s", faceCol, s, r, C_RESET);
-        printSpaces(rightPad);
-        printf("%s%s│%s", boxCol, boxBold, C_RESET);
-    } else if (line == 3) {
-        printf("%s%s│     │%s", boxCol, boxBold, C_RESET);
-    } else { // line == 4
-        printf("%s%s└─────┘%s", boxCol, boxBold, C_RESET);
-    }
-}
+/* 追蹤的階段 */
+typedef enum {
+    TRACE_INPUT = 0,   // 等玩家輸入（scanf / Enter）
+    TRACE_RENDER,      // 畫手牌框、結算面板（含 write）
+    TRACE_AUDIO,       // 音效執行緒處理一個音效（afplay 的 spawn 在這裡）
+    TRACE_SCORE,       // 判斷牌型 + 計分
+    TRACE_REFILL,      // 出牌後補牌
+    TRACE_SHOP,        // 商店
+    TRACE_MAGIC,       // Magic Card（免費二選一、Suit Change、Draw Boost）
+    TRACE_HINT,        // 聽牌 / 出牌提示、求解器、過關機率
+    TRACE_SLEEP,       // 遊戲流程裡固定的停頓
+    NUM_TRACE_PHASES
+} TracePhase;
+
+typedef enum {
+    TRACE_HANDS = 0,     // 結算過的出牌
+    TRACE_CARDS_DRAWN,   // 補進手牌的牌
+    TRACE_FRAME_BYTES,   // 畫面送出的 bytes
+    TRACE_SOUNDS,        // 播放的音效
+    NUM_TRACE_COUNTERS
+} TraceCounter;
+
+/*
+ * --trace FILE：開始記錄，程式結束時把 Chrome trace JSON 寫進 FILE
+ * （chrome://tracing 或 Perfetto 打開），並在 stderr 印出各階段統計
+ * 要在開任何執行緒之前呼叫；沒有 -DGAME_TRACE 的執行檔回傳 0
+ */
+int traceStart(const char *path);
+
+#ifdef GAME_TRACE
+
+typedef struct {
+    unsigned long long start;   // ns
+    int phase;
+    int on;                     // 開始時有沒有在記錄
+} TraceScope;
+
+static int traceEnabled = 0;    // traceStart 之後是 1（之後只讀，不用 atomic）
+
+unsigned long long traceEnter(void);          // 回傳現在時間，並把這條執行緒的巢狀深度 +1
+void traceLeave(const TraceScope *scope);
+void traceCount(TraceCounter counter, long n);
+void traceNameThread(const char *name);
+
+static inline TraceScope traceBegin(TracePhase phase) {
+    TraceScope scope = { 0, phase, traceEnabled };
+    if (scope.on) scope.start = traceEnter();
+    return scope;
+}
+
+static inline void traceEnd(TraceScope *scope) {
+    if (scope->on) traceLeave(scope);
+}
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b)  TRACE_CONCAT2(a, b)
+
+/* 從這一行到所在區塊結束算一段（cleanup attribute：return / break 出去也會記到） */
+#define TRACE_SCOPE(phase) \
+    TraceScope TRACE_CONCAT(traceScope, __LINE__) __attribute__((cleanup(traceEnd))) = traceBegin(phase)
+#define TRACE_COUNT(counter, n)  do { if (traceEnabled) traceCount(counter, n); } while (0)
+#define TRACE_THREAD_NAME(name)  do { if (traceEnabled) traceNameThread(name); } while (0)
+
+#else
+
+#define TRACE_SCOPE(phase)       ((void)0)
+#define TRACE_COUNT(counter, n)  ((void)0)
+#define TRACE_THREAD_NAME(name)  ((void)0)
+
+#endif
+
+/* 回合結算面板 */
+void printSettlementPanel(const GameState *game, const PlayResult *res);
+
+/* ====== 出牌列舉（提示 / 貪婪策略） ====== */
+
+/* 7 張手牌能出的組合：7 種 Single + 21 種 Pair + 21 種 5 張 */
+#define NUM_CANDIDATE_PLAYS 49
+
+/* 一個候選出牌 */
+typedef struct {
+    unsigned char slots;    // 用到哪幾個手牌 index（bit i = hand[i]）
+    unsigned char count;    // 張數（1 / 2 / 5）
+    unsigned char idx[5];   // 手牌 index（由小到大）
+    HandType type;
+    int hasBoost;           // 是否觸發 Card Multiplier
+    int baseGain;           // 尚未套用 Combo（已含 x1.5），和 evaluateHand 相同（定點數）
+    int gain;               // 套用「出完這手後」的 Combo 倍率（定點數）
+} PlayOption;
+
+/*
+ * 列舉目前手牌所有合法的出牌並計分，依 gain 由大到小排好放進 out[]
+ * （同分時張數少的排前面，比較省牌堆），回傳合法出牌的數量
+ */
+int enumeratePlays(const GameState *game, PlayOption out[NUM_CANDIDATE_PLAYS]);
+
+/*
+ * 記住上一次 enumeratePlays 的結果（電腦玩家、求解器、機率計算用）：
+ * 同一個局面常常連續問好幾次（要不要重抽 → 出哪手、能不能穩過 → 列出動作），
+ * 手牌和算分規則（Combo、Card Multiplier、本關 Single / Pair 分數）都沒變就直接沿用，
+ * 任何一個變了就整個重算
+ */
+typedef struct {
+    int valid;
+    Card hand[HAND_SIZE];         // 上次算的手牌
+    unsigned char comboCount;     // 上次算分時的規則
+    unsigned short multMask;
+    int singleScore, pairScore;
+    int count;
+    PlayOption opts[NUM_CANDIDATE_PLAYS];   // 上次的結果（已排序）
+} PlayCache;
+
+/* 更新 cache->opts 並回傳合法出牌數（cache 一開始清成 0 即可） */
+int evaluatePlays(PlayCache *cache, const GameState *game);
+
+/* ====== 模擬模式（無終端機輸出、無音效、無 sleep） ====== */
+
+/*
+ * 決策策略：模擬模式中所有原本要問玩家的地方都改問 Policy
+ * ctx 讓策略可以帶自己的狀態
+ */
+typedef struct {
+    const char *name;
+    void *ctx;
+    /* 出牌：把要出的 index 寫進 idx[]，回傳張數（回傳 0 = 這回合放棄） */
+    int (*choosePlay)(void *ctx, const GameState *game, int idx[5]);
+    /* 是否使用 Redraw / Draw Boost（1 = 使用） */
+    int (*wantRedraw)(void *ctx, const GameState *game);
+    int (*wantDrawBoost)(void *ctx, const GameState *game);
+    /* Draw Boost 翻出 3 張後：留哪張、換掉哪張（回傳 0 = 取消） */
+    int (*chooseDrawBoost)(void *ctx, const GameState *game, const Card candidates[3], int *pick, int *replaceIndex);
+    /* Suit Change：要改哪張、改成什麼花色（回傳 0 = 放棄） */
+    int (*chooseSuitChange)(void *ctx, const GameState *game, int *idx, int *newSuit);
+    /* 免費二選一：回傳 1 或 2 */
+    int (*chooseMagic)(void *ctx, const GameState *game, int bonus);
+    /* 商店：回傳 0 / 1 / 2 / 3（會重複詢問直到離開或買成功） */
+    int (*chooseShop)(void *ctx, const GameState *game);
+} Policy;
+
+#define NUM_LEVELS 5
+
+/* 模擬統計 */
+typedef struct {
+    long runs;                       // 總共玩了幾輪
+    long fullClears;                 // 五關全過的輪數
+    long levelAttempts[NUM_LEVELS + 1]; // 每一關被挑戰的次數（index 1~5）
+    long levelClears[NUM_LEVELS + 1];   // 每一關過關的次數
+    long hands;                      // 總共成功出了幾手牌
+    long stuckLevels;                // 超過回合上限被判失敗的關卡數
+} SimStats;
+
+/* 模擬一關，回傳 1 = 過關，0 = 失敗 */
+int simPlayLevel(GameState *game, const Policy *policy, SimStats *stats);
+
+/* 從 newGame 之後的狀態模擬一整輪（1~5 關），回傳通過的關卡數 */
+int simRunGame(GameState *game, const Policy *policy, SimStats *stats);
+
+/* 內建的基本策略 */
+extern const Policy basicPolicy;
+
+/* 貪婪策略：每回合都出 enumeratePlays 的第一名 */
+extern const Policy greedyPolicy;
+
+/* --simulate N：跑 N 輪並印出統計 */
+int runSimulation(long runs, const Policy *policy, unsigned long long masterSeed, int threads);
+
+/* --check-classify：查表版 classifyHand、PlayBatch 各版本和原本的版本逐一比對，並量速度 */
+int checkClassifier(void);
+
+/* --check-scoring N：模擬 N 局，每回合所有候選出牌都用定點數和原本的 double 各算一次，回報不一致的地方 */
+int checkScoring(long games, unsigned long long seed);
+
+/* --check-rng：確認批次洗牌和單副洗牌一致，並量洗牌速度 */
+int checkShuffle(unsigned long long seed);
+
+
+/* ====== 亂數產生器（計數器式，不用全域 rand()） ====== */
+
+/*
+ * 每一局的 counter 空間切成幾段，彼此互不影響：
+ *   第 L 關的洗牌：L << 16 開始
+ *   Magic / 商店等其他亂數：RNG_MISC_BASE 開始
+ * 所以任何一局、任何一關的牌堆都能直接算出來
+ */
+#define RNG_DECK_SHIFT 16
+#define RNG_MISC_BASE  (1u << 30)
+
+unsigned long long mix64(unsigned long long z);
+/* 計數器式亂數的核心：只用 32-bit 運算，方便一次算很多條 */
+static inline unsigned int counterHash32(unsigned int k0, unsigned int k1, unsigned int ctr) {
+    unsigned int x = ctr * 0x9E3779B9u + k0;
+    x ^= x >> 16; x *= 0x85EBCA6Bu; x ^= x >> 13; x *= 0xC2B2AE35u; x ^= x >> 16;
+    x ^= k1;
+    x ^= x >> 16; x *= 0x7FEB352Du; x ^= x >> 15; x *= 0x846CA68Bu; x ^= x >> 16;
+    return x;
+}
+
+void rngSeed(Rng *rng, unsigned long long seed);
+/* 第 game 局的亂數（從種子直接算，不用先跑前面的局） */
+void rngForGame(Rng *rng, unsigned long long seed, unsigned long long game);
+unsigned int rngNext32(Rng *rng);
+unsigned long long rngNext(Rng *rng);
+/* 0 ~ bound-1 的均勻亂數（沒有取餘數的偏差） */
+unsigned int rngBelow(Rng *rng, unsigned int bound);
+/* 用 rng 洗 cards[0..n-1] */
+void shuffleCards(Card *cards, int n, Rng *rng);
+
+/* 這一局第 level 關洗牌用的亂數流 */
+Rng deckStream(const Rng *gameRng, int level);
+
+/*
+ * 一次洗 n 副牌：decks[d] 是第 d 副牌的 card index（0~51，同 cardIndex），
+ * 用 streams[d] 洗出來的結果和 shuffleDeck 完全一樣
+ */
+void shuffleDeckBatch(unsigned char (*decks)[NUM_CARDS], const Rng *streams, int n);
+
+/* 遊戲規則用的亂數（Magic / 商店） */
+int gameRandBelow(GameState *game, int bound);
+
+/* ====== 多執行緒模擬（work stealing，每一局有自己的亂數流） ====== */
+
+/*
+ * 第 runIndex 局的亂數只由 masterSeed 和 runIndex 決定（rngForGame），
+ * 所以不管幾條執行緒、誰搶到哪一局，結果都一模一樣
+ */
+
+/* threads <= 0 → 用全部的 CPU 核心 */
+void runParallelSimulation(long runs, const Policy *policy, unsigned long long masterSeed,
+                           int threads, SimStats *out);
+
+/* 可用的 CPU 核心數 */
+int cpuCount(void);
+
+/* ====== 關卡求解器（Monte Carlo 搜尋：這一關的過關機率） ====== */
+
+typedef enum {
+    ACTION_PLAY = 0,      // 出 slots 這幾張
+    ACTION_REDRAW,        // 先用 Redraw 重抽整手
+    ACTION_DRAW_BOOST,    // 先用 Draw Boost，再出最佳的一手
+} ActionKind;
+
+#define MAX_SOLVER_ACTIONS (NUM_CANDIDATE_PLAYS + 2)
+
+typedef struct {
+    ActionKind kind;
+    unsigned char slots;  // ACTION_PLAY：手牌 index 的 bitmask
+    HandType type;        // ACTION_PLAY：牌型
+    long visits;          // 模擬了幾次
+    long wins;            // 其中幾次過關
+} SolverAction;
+
+/* 置換表滿了的時候要蓋掉哪一格 */
+typedef enum {
+    TABLE_REPLACE_RECENT = 0, // 蓋掉最久沒用到的（最近的局面最有可能再遇到）
+    TABLE_REPLACE_VISITS,     // 蓋掉模擬次數少的（算很久的結果留著；太舊的一樣會被蓋掉）
+} TableReplace;
+
+typedef struct {
+    double timeBudget;        // 時間預算（秒）
+    int threads;              // 幾條執行緒一起算
+    long maxIterations;       // 每條執行緒的模擬次數上限（0 = 只看時間）
+    unsigned long long seed;  // 0 = 用時間當種子
+    TableReplace replace;     // 置換表的替換策略
+} SolverConfig;
+
+typedef struct {
+    int numActions;
+    SolverAction actions[MAX_SOLVER_ACTIONS];
+    long iterations;   // 總模擬次數（含從表裡接續的）
+    double elapsed;    // 實際花的時間（秒）
+    int best;          // 過關機率最高的 action
+    int tableHit;      // 是否接續了置換表裡的舊結果
+} SolverResult;
+
+/* 置換表的統計（所有執行緒、所有 solveLevel 加起來） */
+typedef struct {
+    long probes;       // 查了幾次
+    long hits;         // 找到同一個局面
+    long stores;       // 放進空格
+    long evictions;    // 蓋掉別的局面
+    long races;        // 搶格子輸給別的執行緒
+} SolverTableStats;
+
+void solverTableStats(SolverTableStats *out);
+void solverTableClear(void);
+
+/* 預設：50 ms、單執行緒 */
+void solverDefaultConfig(SolverConfig *cfg);
+
+/*
+ * 估計目前局面每個動作的過關機率
+ * 沒看到的牌每次模擬都重新隨機排列，動作之後用貪婪策略玩到這關結束
+ */
+int solveLevel(const GameState *game, const SolverConfig *cfg, SolverResult *out);
+
+/* 動作的文字說明 */
+void describeAction(const GameState *game, const SolverAction *action, char *buf, size_t size);
+
+/* 在互動模式印出求解器的建議，最多花 budget 秒 */
+void printSolverHint(const GameState *game, double budget);
+
+/* --solve N：對 N 個隨機開局跑求解器並印出速度 */
+int runSolverBench(long positions, const SolverConfig *cfg);
+
+/* ====== 過關機率（對剩下的牌做記憶化的機率 DP） ====== */
+
+typedef struct {
+    double timeBudget;   // 時間預算（秒），時間到就回傳目前的上下界
+    int threads;         // 第一層的動作分給幾條執行緒算
+    int maxDepth;        // 最多往下看幾次抽牌（0 = 看到算完或時間到）
+} OddsConfig;
+
+typedef struct {
+    double lo, hi;       // 最佳打法的過關機率一定在 [lo, hi] 之間
+    int exact;           // lo == hi：算到底了
+    int depth;           // 最後一輪看到第幾次抽牌
+    long nodes;          // 這次實際展開的局面數
+    long cacheHits;      // 直接用表裡結果的次數（包括前幾次呼叫留下來的）
+    double elapsed;      // 花的時間（秒）
+} OddsResult;
+
+/* 預設：1 秒、單執行緒 */
+void oddsDefaultConfig(OddsConfig *cfg);
+
+/*
+ * 目前局面在最佳打法下的過關機率
+ * 沒發的牌每種抽法都一樣可能，每次抽牌把所有組合都展開；結果存在共用的表裡，
+ * 牌堆越抽越少的時候，之後的局面可以直接用之前算過的子問題
+ */
+int clearOdds(const GameState *game, const OddsConfig *cfg, OddsResult *out);
+
+/* 在互動模式印出過關機率，最多花 budget 秒 */
+void printOddsHint(const GameState *game, double budget);
+
+/* --odds N：對 N 個打到一半的局面算過關機率並印出速度 */
+int runOddsBench(long positions, const OddsConfig *cfg, unsigned long long seed);
+
+/* ====== 重播紀錄（二進位事件檔，只記種子和玩家的選擇） ====== */
+
+/*
+ * 檔案格式：
+ *   session 開頭："CGRL" + 版本(1 byte) + 種子(8 bytes, little endian)
+ *   之後是一連串事件，第一個 byte 是事件碼：
+ *     1xxxxxxx          出牌，低 7 bit = 出的手牌 index bitmask
+ *     EV_xxx [參數]      其他事件（見下面的 ReplayOp）
+ *   同一個檔案可以一直往後接新的 session（歸檔用）
+ */
+#define REPLAY_MAGIC   "CGRL"
+#define REPLAY_VERSION 2   // 2：checksum 改用定點分數（版本 1 的檔案照樣重播，只是不比對 checksum）
+
+typedef enum {
+    EV_PLAY_FAIL = 1,     // 這回合沒有成功出牌（連擊中斷）
+    EV_REDRAW,            // 用了 Redraw
+    EV_DRAW_BOOST,        // 參數：pick << 3 | replaceIndex
+    EV_DRAW_BOOST_CANCEL, // 翻了 3 張但取消（3 張一樣被丟掉）
+    EV_SUIT_CHANGE,       // 參數：idx << 2 | newSuit
+    EV_SUIT_CANCEL,       // Suit Change 作廢
+    EV_MAGIC,             // 參數：1 / 2
+    EV_SHOP,              // 參數：買成功的商品 1 / 2 / 3
+    EV_LEVEL_START,       // 參數：關卡
+    EV_LEVEL_END,         // 後面接 4 bytes 的狀態 checksum
+    EV_GAME_START,        // 後面接 8 bytes 的局號
+    EV_PLAY = 0x80,       // 參數放在事件碼的低 7 bit
+} ReplayOp;
+
+/* --record FILE：開始把這次的遊玩記下來（接在檔案最後面），回傳 0 = 開檔失敗 */
+int replayLogOpen(const char *path, unsigned long long seed);
+void replayLogClose(void);
+
+/* 記一個事件（arg 沒有用到就給 0） */
+void logEvent(ReplayOp op, int arg);
+void logGameStart(unsigned long long gameNo);
+/* 關卡結束：記下狀態 checksum，並把緩衝區寫進檔案 */
+void logLevelEnd(const GameState *game);
+
+/* 關卡結束時的狀態摘要（重播時拿來比對） */
+unsigned int stateChecksum(const GameState *game);
+
+/* --replay FILE：不畫畫面、直接用規則函式重跑整個檔案，回傳 0 = 每一關的 checksum 都對得上 */
+int runReplay(const char *path);
+
+/* ====== Benchmark（規則引擎的 micro / macro benchmark，固定種子，可輸出 JSON） ====== */
+
+typedef struct {
+    unsigned long long seed;  // 所有輸入都由這個種子產生（預設固定，--seed 可以改）
+    int warmup;               // 每一項先跑幾個樣本不計時（暖 cache / 分支預測）
+    int samples;              // 計時的樣本數（算百分位數用）
+    const char *filter;       // 只跑名稱包含這個字串的項目（NULL = 全部）
+    const char *jsonPath;     // 另外把結果寫成 JSON（NULL = 不寫，"-" = 寫到 stdout）
+} BenchConfig;
+
+/* 預設：種子 1、warm-up 3 個樣本、計時 25 個樣本、全部項目 */
+void benchDefaultConfig(BenchConfig *cfg);
+
+/*
+ * --bench：shuffleDeck、classifyHand、evaluateHand、updateHandAfterPlay、
+ * 整關 / 整輪模擬，以及 printHandBoxedSelected 畫到 /dev/null 的成本
+ * 每個樣本都重做一模一樣的工作，印出每次 op 的 ns（min / p50 / p90 / p99 / max）
+ * 和結果的 checksum（同樣的種子 checksum 不同 = 行為變了，不只是速度變了）
+ */
+int runBenchSuite(const BenchConfig *cfg);
+
+/* ====== 多人伺服器（Linux：一條連線一局，epoll 讓少數幾條執行緒同時服務很多個 session） ====== */
+
+/*
+ * 協定是一行一個指令，nc / telnet 就能玩：
+ *   p 0 2 5   出這幾張        pass   放棄這回合     redraw / boost   用 Magic Card
+ *   k 挑 換   Draw Boost 留翻出的第幾張、換掉哪張手牌
+ *   s 牌 花色 Suit Change     1 / 2  免費二選一      1 / 2 / 3  商店     skip  不用 / 離開
+ *   new       再玩一局        quit   離開
+ * 每個指令回一整個畫面（清畫面 + 和終端機一樣的卡牌框）
+ * 畫面最後一行是「[階段] 可用的指令」，接著是提示字元 "> "（壓力測試的客戶端靠這兩個認回應）
+ */
+typedef struct {
+    const char *listen;        // "unix:路徑" 或 "tcp:埠號"（只聽 127.0.0.1）
+    int threads;               // event loop 執行緒數（0 = CPU 數）
+    int maxSessions;           // 同時最多幾個 session（超過的連線直接關掉）
+    unsigned long long seed;   // 第 n 個連上來的 session 玩這個種子的第 n 局
+} ServerConfig;
+
+/* 預設：1 條執行緒、最多 100000 個 session、種子 1 */
+void serverDefaultConfig(ServerConfig *cfg);
+
+/* --serve ADDR：一直服務到收到 SIGINT / SIGTERM，結束時印統計 */
+int runServer(const ServerConfig *cfg);
+
+/* 壓力測試的客戶端：開很多條連線，其中一部分一直下指令，其他的只連著不動 */
+typedef struct {
+    const char *connect;       // 同 ServerConfig.listen
+    int sessions;              // 總連線數
+    int active;                // 其中幾條會一直下指令（收到上一個回應就送下一個）
+    double seconds;            // 全部連上之後量多久
+    unsigned long long seed;   // 選牌用的亂數
+} LoadGenConfig;
+
+/* 預設：1000 條連線、其中 100 條在玩、量 5 秒 */
+void loadGenDefaultConfig(LoadGenConfig *cfg);
+
+/* --loadgen ADDR：印出連線時間、每秒指令數、回應延遲的分佈 */
+int runLoadGen(const LoadGenConfig *cfg);
+
+/* ====== main 函式 ====== */
+int main(int argc, char *argv[]) {
+    unsigned long long seed = (unsigned long long)time(NULL);
+    unsigned long long gameNo = 0;   // 互動模式從第幾局開始（重現回報的那一局）
+    long simulateRuns = -1;   // -1 = 一般互動模式
+    int checkClassify = 0;
+    int checkRng = 0;
+    long checkScoringGames = -1;
+    long checkFlowSessions = -1;
+    int runBench = 0;
+    const char *audioSpec = NULL;   // NULL = 依平台預設
+    long solvePositions = -1;
+    long oddsPositions = -1;
+    long benchSteps = -1;
+    long shmBenchSteps = -1;
+    const char *shmName = NULL;
+    int numEnvs = 1024;      // --shm-env / --step-bench / --shm-bench 的環境數量
+    const char *recordPath = NULL;
+    const char *replayPath = NULL;
+    const char *snapshotPath = NULL;   // 每次等輸入都存檔
+    const char *resumePath = NULL;
+    const char *traceFile = NULL;
+    int threads = 1;
+    const Policy *policy = &greedyPolicy;
+    SolverConfig solverCfg;
+    solverDefaultConfig(&solverCfg);
+    OddsConfig oddsCfg;
+    oddsDefaultConfig(&oddsCfg);
+    int budgetGiven = 0;
+    int hintMs = 0;          // 互動模式每回合提示的時間預算（毫秒），0 = 不印提示
+    BenchConfig benchCfg;
+    benchDefaultConfig(&benchCfg);
+    ServerConfig serverCfg;
+    serverDefaultConfig(&serverCfg);
+    LoadGenConfig loadCfg;
+    loadGenDefaultConfig(&loadCfg);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--simulate") == 0 && i + 1 < argc) {
+            simulateRuns = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+            benchCfg.seed = seed;
+        } else if (strcmp(argv[i], "--game") == 0 && i + 1 < argc) {
+            gameNo = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--policy") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "basic") == 0)       policy = &basicPolicy;
+            else if (strcmp(argv[i], "greedy") == 0) policy = &greedyPolicy;
+            else {
+                fprintf(stderr, "未知的策略：%s（可用 basic / greedy）\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--check-classify") == 0) {
+            checkClassify = 1;
+        } else if (strcmp(argv[i], "--check-scoring") == 0 && i + 1 < argc) {
+            checkScoringGames = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--check-rng") == 0) {
+            checkRng = 1;
+        } else if (strcmp(argv[i], "--check-flow") == 0 && i + 1 < argc) {
+            checkFlowSessions = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--audio") == 0 && i + 1 < argc) {
+            audioSpec = argv[++i];
+        } else if (strcmp(argv[i], "--solve") == 0 && i + 1 < argc) {
+            solvePositions = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--odds") == 0 && i + 1 < argc) {
+            oddsPositions = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);   // 0 = 全部核心
+        } else if (strcmp(argv[i], "--table") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "recent") == 0)      solverCfg.replace = TABLE_REPLACE_RECENT;
+            else if (strcmp(argv[i], "visits") == 0) solverCfg.replace = TABLE_REPLACE_VISITS;
+            else {
+                fprintf(stderr, "未知的置換表策略：%s（可用 recent / visits）\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--budget") == 0 && i + 1 < argc) {
+            solverCfg.timeBudget = atof(argv[++i]) / 1000.0;   // 毫秒
+            budgetGiven = 1;
+        } else if (strcmp(argv[i], "--hints") == 0 && i + 1 < argc) {
+            hintMs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--step-bench") == 0 && i + 1 < argc) {
+            benchSteps = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--shm-env") == 0 && i + 1 < argc) {
+            shmName = argv[++i];
+        } else if (strcmp(argv[i], "--envs") == 0 && i + 1 < argc) {
+            numEnvs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--shm-bench") == 0 && i + 1 < argc) {
+            shmBenchSteps = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            runBench = 1;
+        } else if (strcmp(argv[i], "--bench-filter") == 0 && i + 1 < argc) {
+            benchCfg.filter = argv[++i];
+            runBench = 1;
+        } else if (strcmp(argv[i], "--bench-samples") == 0 && i + 1 < argc) {
+            benchCfg.samples = atoi(argv[++i]);
+            runBench = 1;
+        } else if (strcmp(argv[i], "--bench-json") == 0 && i + 1 < argc) {
+            benchCfg.jsonPath = argv[++i];
+            runBench = 1;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshotPath = argv[++i];
+        } else if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+            resumePath = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            traceFile = argv[++i];
+        } else if (strcmp(argv[i], "--line-input") == 0) {
+            termForceLineInput();
+        } else if (strcmp(argv[i], "--time-scale") == 0 && i + 1 < argc) {
+            timeSetScale(atof(argv[++i]));
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serverCfg.listen = argv[++i];
+        } else if (strcmp(argv[i], "--max-sessions") == 0 && i + 1 < argc) {
+            serverCfg.maxSessions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--loadgen") == 0 && i + 1 < argc) {
+            loadCfg.connect = argv[++i];
+        } else if (strcmp(argv[i], "--loadgen-sessions") == 0 && i + 1 < argc) {
+            loadCfg.sessions = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--loadgen-active") == 0 && i + 1 < argc) {
+            loadCfg.active = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--loadgen-seconds") == 0 && i + 1 < argc) {
+            loadCfg.seconds = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "用法：%s [--seed S] [--game N] [--audio afplay|null|wav:FILE] [--record FILE]\n"
+                            "        [--replay FILE] [--snapshot FILE] [--resume FILE] [--simulate N] [--policy basic|greedy]\n"
+                            "        [--solve N] [--odds N] [--threads T] [--budget MS] [--table recent|visits] [--step-bench N]\n"
+                            "        [--hints MS] [--shm-env NAME] [--envs N] [--shm-bench N]\n"
+                            "        [--bench] [--bench-filter NAME] [--bench-samples N] [--bench-json FILE|-]\n"
+                            "        [--trace FILE] [--line-input] [--time-scale X]\n"
+                            "        [--serve unix:PATH|tcp:PORT] [--max-sessions N]\n"
+                            "        [--loadgen unix:PATH|tcp:PORT] [--loadgen-sessions N] [--loadgen-active N] [--loadgen-seconds S]\n"
+                            "        [--check-classify] [--check-scoring N] [--check-rng] [--check-flow N]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    // 要在開任何執行緒（音效、模擬）之前開始
+    if (traceFile && !traceStart(traceFile)) {
+        fprintf(stderr, "這個執行檔沒有編進效能追蹤（編譯時加 -DGAME_TRACE）\n");
+        return 1;
+    }
+
+    initHandTables();
+    initZobristKeys();
+
+    if (checkClassify) {
+        return checkClassifier();
+    }
+
+    if (checkScoringGames >= 0) {
+        return checkScoring(checkScoringGames, seed);
+    }
+
+    if (checkRng) {
+        return checkShuffle(seed);
+    }
+
+    if (checkFlowSessions >= 0) {
+        return checkFlow(checkFlowSessions, seed);
+    }
+
+    if (solvePositions >= 0) {
+        solverCfg.seed = seed;
+        solverCfg.threads = threads > 0 ? threads : cpuCount();
+        return runSolverBench(solvePositions, &solverCfg);
+    }
+
+    if (oddsPositions >= 0) {
+        if (budgetGiven) oddsCfg.timeBudget = solverCfg.timeBudget;
+        oddsCfg.threads = threads > 0 ? threads : cpuCount();
+        return runOddsBench(oddsPositions, &oddsCfg, seed);
+    }
+
+    if (simulateRuns >= 0) {
+        return runSimulation(simulateRuns, policy, seed, threads);
+    }
+
+    if (benchSteps >= 0) {
+        return runStepBench(benchSteps, numEnvs, seed);
+    }
+
+    if (runBench) {
+        return runBenchSuite(&benchCfg);
+    }
+
+    if (shmBenchSteps >= 0) {
+        return runShmBench(shmBenchSteps, numEnvs, seed);
+    }
+
+    if (shmName) {
+        return runShmEnv(shmName, numEnvs, seed);
+    }
+
+    if (serverCfg.listen) {
+        serverCfg.seed = seed;
+        serverCfg.threads = threads;
+        return runServer(&serverCfg);
+    }
+
+    if (loadCfg.connect) {
+        loadCfg.seed = seed;
+        return runLoadGen(&loadCfg);
+    }
+
+    if (replayPath) {
+        return runReplay(replayPath);
+    }
+
+    // 流程每次要等輸入就回到這裡：讀輸入（或停頓）再餵回去
+    GameFlow flow;
+    if (resumePath) {
+        if (recordPath) {
+            fprintf(stderr, "--resume 不能和 --record 一起用（紀錄檔要從開局記起）\n");
+            return 1;
+        }
+        if (!flowLoadFile(&flow, resumePath)) {
+            fprintf(stderr, "無法讀取存檔：%s\n", resumePath);
+            return 1;
+        }
+    }
+
+    if (!audioInit(audioSpec)) {
+        fprintf(stderr, "不認得的音效設定：%s（可用 afplay / null / wav:檔名）\n", audioSpec);
+        return 1;
+    }
+
+    if (recordPath && !replayLogOpen(recordPath, seed)) {
+        fprintf(stderr, "無法開啟紀錄檔：%s\n", recordPath);
+        audioShutdown();
+        return 1;
+    }
+
+    if (resumePath) {
+        flowResume(&flow);
+    } else {
+        flowBegin(&flow, seed, gameNo, termInteractive(), hintMs);
+    }
+
+    while (flow.wait != FLOW_WAIT_DONE) {
+        if (snapshotPath && flow.wait != FLOW_WAIT_PAUSE && !flowSaveFile(&flow, snapshotPath)) {
+            fprintf(stderr, "無法寫入存檔：%s\n", snapshotPath);
+            snapshotPath = NULL;   // 只提醒一次，遊戲照常進行
+        }
+
+        int status = 1;
+        int value = 0;
+        switch (flow.wait) {
+        case FLOW_WAIT_INT:
+            status = readInt(&value);
+            break;
+        case FLOW_WAIT_KEY:
+            termRawBegin();
+            value = termReadKey(-1);
+            if (value == KEY_EOF) status = EOF;
+            break;
+        case FLOW_WAIT_ENTER:
+            waitEnter();
+            break;
+        case FLOW_WAIT_PAUSE:
+            waitFor(flow.pause / 10.0);
+            break;
+        default:
+            break;
+        }
+
+        // 輸入結束（管線讀完、Ctrl-D）：再問也讀不到東西，存檔停在等這個輸入的地方
+        if (status == EOF) {
+            termRawEnd();
+            if (snapshotPath && flowSaveFile(&flow, snapshotPath)) {
+                printf("\n輸入已經結束，遊戲中止；進度存在 %s（用 --resume 接著玩）\n", snapshotPath);
+            } else {
+                printf("\n輸入已經結束，遊戲中止。\n");
+            }
+            break;
+        }
+        flowInput(&flow, status, value);
+    }
+
+    freeGame(&flow.game);  // 只在最後一次離開時釋放記憶體
+    replayLogClose();
+    audioShutdown();
+    return 0;
+}
+
+/* ====== 函式實作區 ====== */
+void initGame(GameState *game) {
+    // deck / hand 都直接放在 GameState 裡，不用另外配置記憶體
+    memset(game, 0, sizeof(*game));
+    rngForGame(&game->rng, (unsigned long long)time(NULL), 0);
+    resetGameState(game);
+}
+
+void resetGameState(GameState *game) {
+    game->deckIndex = 0;
+    game->deckMask = FULL_DECK_MASK;
+    game->playedMask = 0;
+    game->zobrist = zobristFullDeck;   // 手牌還沒發
+    game->score = 0;
+    game->level = 1;
+    game->target = 0;
+    game->gold = 0;      // 開新遊戲金幣從 0 開始
+    game->hasSuitChange = 0;
+    game->handsUsed = 0;
+    game->pairBonus = 0;    // Magic 加成重置
+
+    // 重抽功能相關
+    game->hasRedraw = 0;
+    game->redrawUsedThisLevel = 0;
+
+    // Draw Boost 系統
+    game->hasDrawBoost = 0;
+    game->drawBoostUsed = 0;
+
+    game->comboCount = 0;
+    game->phase = PHASE_TURN;
+
+    // Card Multiplier：一開始全部都沒有被強化
+    game->multMask = 0;
+}
+
+void setupLevel(GameState *game, int level) {
+    game->level = level;
+
+    // 以 0.1 分為單位寫（整數，換成定點數不用經過 double）
+    int target, baseSingle, basePair;
+
+    if (level == 1) {
+        target     = 550;
+        baseSingle = 10;
+        basePair   = 20;
+    }
+    else if (level == 2) {
+        target     = 600;
+        baseSingle = 5;
+        basePair   = 40;
+    }
+    else if (level == 3) {
+        target     = 650;
+        baseSingle = 0;
+        basePair   = 40;
+    }
+    else if (level == 4) {
+        target     = 700;
+        baseSingle = 0;
+        basePair   = 45;
+    }
+    else if (level == 5) {
+        target     = 750;
+        baseSingle = 0;
+        basePair   = 50;
+    }
+    else {
+        target     = 550;
+        baseSingle = 10;
+        basePair   = 20;
+    }
+
+    // 套用 Magic Card 加成（必須放在後面）
+    game->target      = target * (SCORE_SCALE / 10);
+    game->singleScore = baseSingle * (SCORE_SCALE / 10);                 // Single 沒有魔法加成
+    game->pairScore   = basePair * (SCORE_SCALE / 10) + game->pairBonus; // Pair = Level 基礎分 + 魔法加成
+    game->handsUsed = 0;  // 重設本關的出牌次數
+    game->comboCount  = 0;  // 每一關開始時，連擊歸零
+    game->redrawUsedThisLevel = 0;
+    game->drawBoostUsed = 0;
+}
+
+void startLevel(GameState *game, int level) {
+    // 設定這一關的目標分數 + Single/Pair 規則 + handsUsed 歸零
+    setupLevel(game, level);
+
+    // 每一關開始前，把分數歸零
+    game->score = 0;
+
+    // 重新建立牌堆、洗牌、發新的起手牌
+    initDeck(game->deck);
+    Rng deckRng = deckStream(&game->rng, level);
+    shuffleDeck(game->deck, &deckRng);
+    game->deckIndex = 0;
+    game->deckMask = FULL_DECK_MASK;
+    game->playedMask = 0;
+    game->zobrist = zobristFullDeck;
+    dealInitialHand(game);
+
+    game->phase = game->hasSuitChange ? PHASE_SUIT_CHANGE : PHASE_TURN;
+}
+
+CardMask maskFromCards(const Card *cards, int n) {
+    CardMask m = 0;
+    for (int i = 0; i < n; i++) {
+        m |= cardBit(&cards[i]);
+    }
+    return m;
+}
+
+/* 依照 bit 編號由小到大把牌寫進 out[]，回傳張數 */
+int cardsFromMask(CardMask m, Card *out) {
+    int n = 0;
+    while (m) {
+        out[n++] = cardFromIndex(__builtin_ctzll(m));
+        m &= m - 1;
+    }
+    return n;
+}
+
+void initDeck(Card *deck) {
+    int index = 0;
+    for (int suit = 0; suit < 4; suit++) {        // 4 種花色
+        for (int rank = 1; rank <= 13; rank++) {  // 1~13
+            deck[index].suit = suit;
+            deck[index].rank = rank;
+            index++;
+        }
+    }
+}
+
+void shuffleDeck(Card *deck, Rng *rng) {
+    for (int i = NUM_CARDS - 1; i > 0; i--) {
+        int j = (int)rngBelow(rng, (unsigned int)(i + 1)); // 0~i
+        Card temp = deck[i];
+        deck[i] = deck[j];
+        deck[j] = temp;
+    }
+}
+
+void dealInitialHand(GameState *game) {
+    for (int i = 0; i < HAND_SIZE; i++) {
+        game->hand[i] = drawCard(game);
+        game->zobrist += zobristHandKey[cardIndex(&game->hand[i])];
+    }
+}
+
+int readInt(int *out) {
+    TRACE_SCOPE(TRACE_INPUT);
+    int status = scanf("%d", out);
+    if (status == 0) {
+        // 不是數字：把這一行丟掉，不然下次 scanf 還是卡在同一個字上，重問會變成無限迴圈
+        int ch;
+        while ((ch = getchar()) != '\n' && ch != EOF) {}
+    }
+    return status;
+}
+
+void waitEnter(void){
+    if (termInteractive()) {
+        printf("\n%s按 Enter 繼續...%s", C_YELLOW, C_RESET);
+        fflush(stdout);
+        termRawBegin();
+        tcflush(STDIN_FILENO, TCIFLUSH);   // 之前多按的鍵不算，免得一眼都沒看到就跳過
+        int key;
+        while ((key = termReadKey(-1)) != KEY_ENTER && key != KEY_EOF) {}
+        termRawEnd();
+        printf("\n");
+        return;
+    }
+
+    TRACE_SCOPE(TRACE_INPUT);
+    int ch;
+
+    // 清掉前一次 scanf 留下的殘留（通常是 '\n'）
+    while ((ch = getchar()) != '\n' && ch != EOF) {}
+
+    printf("\n%s按 Enter 繼續...%s", C_YELLOW, C_RESET);
+    fflush(stdout);
+
+    // 等玩家按 Enter（讀到 '\n' 才結束）
+    while ((ch = getchar()) != '\n' && ch != EOF) {}
+
+    printf("\n");
+}
+
+void printCard(const Card *c) {
+    char *suitChar;
+    const char *color;
+    switch (c->suit) {
+        case 0: suitChar = "♠"; color = C_CYAN; break;
+        case 1: suitChar = "♥"; color = C_RED;  break;
+        case 2: suitChar = "♣"; color = C_CYAN; break;
+        case 3: suitChar = "♦"; color = C_RED;  break;
+        default: suitChar = "?"; color = "";    break;
+    }
+
+    const char *rankStr;
+    static char buf[3];
+    switch (c->rank) {
+        case 1:  rankStr = "A"; break;
+        case 11: rankStr = "J"; break;
+        case 12: rankStr = "Q"; break;
+        case 13: rankStr = "K"; break;
+        default:
+            snprintf(buf, sizeof(buf), "%d", c->rank);
+            rankStr = buf;
+    }
+
+    printf("%s%s%s%s", color, suitChar, rankStr, C_RESET);
+}
+
+/* 取得花色顏色（紅/青） */
+const char *suitColor(int suit){
+    if (suit == 1 || suit == 3) return C_RED;   // ♥ ♦
+    return C_CYAN;                               // ♠ ♣
+}
+
+/* 取得點數字串（A,2..10,J,Q,K） */
+const char *rankText(int rank){
+    static char buf[3];
+    switch(rank){
+        case 1:  return "A";
+        case 11: return "J";
+        case 12: return "Q";
+        case 13: return "K";
+        default:
+            snprintf(buf, sizeof(buf), "%d", rank);
+            return buf;
+    }
+}
+
+/* 取得花色的畫面顏色（紅/青） */
+static int suitFg(int suit){
+    return (suit == 1 || suit == 3) ? FG_RED : FG_CYAN;
+}
+
+/*
+ * 畫單張卡牌（5 行 x 7 欄）
+ * selected=1 → 框線與index用 黃+粗體
+ */
+void frameDrawCard(int row, int col, const Card *c, int idx, int selected){
+    int boxAttr = selected ? (FG_YELLOW | ATTR_BOLD) : FG_DEFAULT;   // 框線顏色
+
+    // 牌面可視長度：suit(1) + rank(1或2)
+    int rankLen = (c->rank == 10) ? 2 : 1;
+    int visLen = 1 + rankLen;
+    int innerW = 5; // 框內寬度
+    int leftPad = (innerW - visLen) / 2;
+
+    framePutText(row, col, boxAttr, "┌─────┐");
+    // index行：被選中就黃粗體
+    framePrintf(row + 1, col, boxAttr, "│ [%d] │", idx);
+    // 牌面：框線用box色，牌面用紅/青
+    framePutText(row + 2, col, boxAttr, "│     │");
+    int x = framePutText(row + 2, col + 1 + leftPad, suitFg(c->suit), suitSymbol(c->suit));
+    framePutText(row + 2, x, suitFg(c->suit), rankText(c->rank));
+    framePutText(row + 3, col, boxAttr, "│     │");
+    framePutText(row + 4, col, boxAttr, "└─────┘");
+}
+
+/*
+ * 印整副手牌（橫向框框）
+ * selected[i]=1 → 第 i 張高亮（黃+粗體框線）
+ */
+void printHandBoxedSelected(const Card *hand, const int selected[HAND_SIZE]){
+    TRACE_SCOPE(TRACE_RENDER);
+    frameBegin(6);
+    framePutText(0, 0, FG_DEFAULT, "你的手牌：");
+    for (int i = 0; i < HAND_SIZE; i++){
+        int sel = selected ? selected[i] : 0;
+        frameDrawCard(1, i * 8, &hand[i], i, sel);
+    }
+    frameFlush(0);
+}
+
+/* 沒有選取狀態時的簡化版（全都不高亮） */
+void printHandBoxed(const Card *hand){
+    int dummy[HAND_SIZE] = {0};
+    printHandBoxedSelected(hand, dummy);
+}
+
+/* 印 3 張候選卡（橫向框框） */
+void print3CardsBoxed(const Card cards[3]) {
+    TRACE_SCOPE(TRACE_RENDER);
+    frameBegin(5);
+    for (int i = 0; i < 3; i++) {
+        // 這裡 selected 一律 0，代表不高亮
+        frameDrawCard(0, i * 8, &cards[i], i, 0);
+    }
+    frameFlush(0);
+}
+
+/* ===== Suit 選擇框框（4個） ===== */
+/* 畫單個 suit 選擇框框
+ * selected=1 → 黃框粗體
+ */
+void frameDrawSuitBox(int row, int col, int suit, int idx, int selected){
+    int boxAttr = selected ? (FG_YELLOW | ATTR_BOLD) : FG_DEFAULT;
+
+    framePutText(row, col, boxAttr, "┌─────┐");
+    framePrintf(row + 1, col, boxAttr, "│ [%d] │", idx);
+    // 中間放花色符號（左右各兩格）
+    framePutText(row + 2, col, boxAttr, "│     │");
+    framePutText(row + 2, col + 3, suitFg(suit), suitSymbol(suit));
+    framePutText(row + 3, col, boxAttr, "│     │");
+    framePutText(row + 4, col, boxAttr, "└─────┘");
+}
+
+/* 印 4 個 suit 選項（橫向框框）
+ * selectedSuit = -1 表示都不亮；0~3 表示那個亮黃框
+ */
+void printSuitOptionsBoxed(int selectedSuit){
+    TRACE_SCOPE(TRACE_RENDER);
+    frameBegin(5);
+    for(int s = 0; s < 4; s++){
+        frameDrawSuitBox(0, s * 8, s, s, s == selectedSuit);
+    }
+    frameFlush(0);
+}
+
+/* 回合結算面板 */
+void printSettlementPanel(const GameState *game, const PlayResult *res) {
+    TRACE_SCOPE(TRACE_RENDER);
+    int row = 0;
+    frameBegin(res->hasBoost ? 8 : 7);   // 沒有 Card Multiplier 那行時少一行
+
+    framePutText(row++, 0, ATTR_BOLD, "───────── 回合結算 ─────────");
+    framePrintf(row++, 0, FG_DEFAULT, "牌型：%s", handTypeName(res->type));
+    framePrintf(row++, 0, FG_DEFAULT, "本回合小計（未套 Combo)：%.1f", scoreValue(res->baseGain));
+
+    if (res->hasBoost) {
+        int x = framePutText(row, 0, FG_DEFAULT, "Card Multiplier：");
+        framePutText(row++, x, FG_YELLOW, "已觸發(x1.5)");
+    }
+
+    if (res->brokeCombo) {
+        framePutText(row++, 0, FG_DEFAULT, "Combo：中斷(Single)");
+    } else {
+        framePrintf(row++, 0, FG_DEFAULT, "Combo：%d 連擊，倍率 x%.2f", game->comboCount, res->comboPercent / 100.0);
+    }
+
+    int x = framePutText(row, 0, FG_DEFAULT, "本回合實得分：");
+    framePrintf(row++, x, FG_GREEN, "+%.1f", scoreValue(res->gain));
+
+    x = framePutText(row, 0, FG_DEFAULT, "Gold：");
+    x = framePrintf(row, x, FG_YELLOW, "+%d", res->earnGold);
+    x = framePutText(row, x, FG_DEFAULT, "（總額： ");
+    x = framePrintf(row, x, FG_YELLOW, "%d", game->gold);
+    framePutText(row++, x, FG_DEFAULT, "）");
+
+    framePutText(row++, 0, ATTR_BOLD, "────────────────────────────");
+
+    frameFlush(0);
+}
+
+void printHand(const Card *hand) {
+    printf("你的手牌：\n");
+    for (int i = 0; i < HAND_SIZE; i++) {
+        printf("[%d] ", i);  // 顯示 index，方便玩家選牌
+        printCard(&hand[i]);
+        printf("\n");
+    }
+}
+
+/* 按鍵選牌畫面：手牌 + 游標 + 目前選的牌能不能出、會得幾分 */
+static void drawHandPicker(const GameState *game, const int selected[HAND_SIZE], int cursor, const char *notice) {
+    frameBegin(9);
+    framePutText(0, 0, FG_DEFAULT, "你的手牌：");
+    for (int i = 0; i < HAND_SIZE; i++) {
+        frameDrawCard(1, i * 8, &game->hand[i], i, selected[i]);
+    }
+    framePutText(6, cursor * 8 + 3, FG_CYAN | ATTR_BOLD, "▲");
+
+    Card played[HAND_SIZE];
+    int count = 0;
+    for (int i = 0; i < HAND_SIZE; i++) {
+        if (selected[i]) played[count++] = game->hand[i];
+    }
+    if (count == 0) {
+        framePutText(7, 0, FG_DEFAULT, "還沒選牌");
+    } else {
+        HandType type = classifyHand(played, count);
+        if (type == HAND_INVALID) {
+            framePrintf(7, 0, FG_RED, "已選 %d 張：不是合法的牌型", count);
+        } else {
+            int hasBoost;
+            int gain = scoreHandType(type, played, count, game, &hasBoost);
+            if (type != HAND_SINGLE) gain = applyPercent(gain, comboPercent(game->comboCount + 1));
+            int x = framePrintf(7, 0, FG_GREEN | ATTR_BOLD, "已選 %d 張：%s  +%.1f 分", count,
+                                handTypeName(type), scoreValue(gain));
+            if (hasBoost) framePutText(7, x, FG_YELLOW, "（含 x1.5）");
+        }
+    }
+    framePutText(8, 0, notice ? FG_YELLOW : FG_DEFAULT,
+                 notice ? notice : "0~6 / 空白鍵：選牌  ←→：移動  Enter：出牌  h：照提示選  c：清除  q：放棄這回合");
+}
+
+/* 提示：印出目前分數最高的出牌 */
+void printPlayHint(const GameState *game) {
+    TRACE_SCOPE(TRACE_HINT);
+    PlayOption opts[NUM_CANDIDATE_PLAYS];
+    enumeratePlays(game, opts);
+
+    printf("%s提示：%s出 ", C_CYAN, C_RESET);
+    for (int i = 0; i < opts[0].count; i++) {
+        printf("[%d] ", opts[0].idx[i]);
+    }
+    printf("→ %s，預計 +%.1f 分%s\n", handTypeName(opts[0].type), scoreValue(opts[0].gain),
+           opts[0].hasBoost ? "（含 x1.5）" : "");
+}
+
+/* C(n, k)，k > n 時是 0 */
+static double binomial(int n, int k) {
+    double c = 1.0;
+    for (int i = 0; i < k; i++) c = c * (n - i) / (i + 1);
+    return c;
+}
+
+/*
+ * 把 draws 張分配到各個點數（每個點數最多拿牌堆裡剩的張數），
+ * 每一種分配的組合數 = 各點數 C(剩下張數, 拿幾張) 相乘，湊成牌型的就加進 acc
+ * acc[0] = 順子、acc[1] = 葫蘆、acc[2] = 四條
+ */
+static void outsByRank(const int have[14], const int left[14], int rank, int draws,
+                       int got[14], double ways, double acc[3]) {
+    if (rank > 13) {
+        if (draws > 0) return;
+        unsigned int present = 0;
+        int threes = 0, pairs = 0, four = 0;
+        for (int r = 1; r <= 13; r++) {
+            int c = have[r] + got[r];
+            if (c >= 1) present |= 1u << (r - 1);
+            if (c >= 2) pairs++;
+            if (c >= 3) threes++;
+            if (c >= 4) four = 1;
+        }
+        if (ranksHaveStraight(present)) acc[0] += ways;
+        if (threes >= 1 && pairs >= 2)  acc[1] += ways;   // 3 張的點數 + 另一個 2 張以上的點數
+        if (four)                       acc[2] += ways;
+        return;
+    }
+    for (int x = 0; x <= draws && x <= left[rank]; x++) {
+        got[rank] = x;
+        outsByRank(have, left, rank + 1, draws - x, got, ways * binomial(left[rank], x), acc);
+    }
+    got[rank] = 0;
+}
+
+/* 同上，分配到 4 個花色：有一個花色湊到 5 張就是同花 */
+static double outsBySuit(const int have[4], const int left[4], int suit, int draws, double ways) {
+    if (suit == 4) return 0.0;   // 走到這裡都沒有湊成同花
+    double sum = 0.0;
+    for (int x = 0; x <= draws && x <= left[suit]; x++) {
+        double w = ways * binomial(left[suit], x);
+        if (have[suit] + x >= 5) {
+            // 這個花色已經夠了，剩下的張數怎麼分都算
+            int rest = 0;
+            for (int t = suit + 1; t < 4; t++) rest += left[t];
+            sum += w * binomial(rest, draws - x);
+        } else {
+            sum += outsBySuit(have, left, suit + 1, draws - x, w);
+        }
+    }
+    return sum;
+}
+
+void computeOuts(const GameState *game, int draws, OutsOdds *out) {
+    int rankHave[14] = {0}, rankLeft[14] = {0}, got[14] = {0};
+    int suitHave[4] = {0}, suitLeft[4];
+    for (int i = 0; i < HAND_SIZE; i++) {
+        rankHave[game->hand[i].rank]++;
+        suitHave[game->hand[i].suit]++;
+    }
+    for (int r = 1; r <= 13; r++) rankLeft[r] = rankCount(game->deckMask, r);
+    for (int st = 0; st < 4; st++) suitLeft[st] = suitCount(game->deckMask, st);
+
+    int left = maskCount(game->deckMask);
+    if (draws > left) draws = left;
+    double total = binomial(left, draws);
+
+    double acc[3] = { 0.0, 0.0, 0.0 };
+    outsByRank(rankHave, rankLeft, 1, draws, got, 1.0, acc);
+    out->straight  = acc[0] / total;
+    out->fullHouse = acc[1] / total;
+    out->fourKind  = acc[2] / total;
+    out->flush     = outsBySuit(suitHave, suitLeft, 0, draws, 1.0) / total;
+}
+
+void printOuts(const GameState *game) {
+    TRACE_SCOPE(TRACE_HINT);
+    static const int draws[3] = { 1, 2, 5 };
+    OutsOdds odds[3];
+    for (int i = 0; i < 3; i++) computeOuts(game, draws[i], &odds[i]);
+
+    printf("聽牌（再看 1 / 2 / 5 張）：");
+    printf("順子 %.0f/%.0f/%.0f%%｜", 100 * odds[0].straight, 100 * odds[1].straight, 100 * odds[2].straight);
+    printf("同花 %.0f/%.0f/%.0f%%｜", 100 * odds[0].flush, 100 * odds[1].flush, 100 * odds[2].flush);
+    printf("葫蘆 %.0f/%.0f/%.0f%%｜", 100 * odds[0].fullHouse, 100 * odds[1].fullHouse, 100 * odds[2].fullHouse);
+    printf("四條 %.0f/%.0f/%.0f%%\n", 100 * odds[0].fourKind, 100 * odds[1].fourKind, 100 * odds[2].fourKind);
+}
+
+/* 用 rank 對牌做由小到大的排序（非常單純的 bubble sort） */
+void sortByRank(Card *cards, int n) {
+    for (int i = 0; i < n - 1; i++) {
+        for (int j = 0; j < n - 1 - i; j++) {
+            if (cards[j].rank > cards[j + 1].rank) {
+                Card temp = cards[j];
+                cards[j] = cards[j + 1];
+                cards[j + 1] = temp;
+            }
+        }
+    }
+}
+
+/* 檢查是不是同花（花色全部一樣） */
+int isFlush(Card *cards, int n) {
+    for (int i = 1; i < n; i++) {
+        if (cards[i].suit != cards[0].suit) {
+            return 0;   // 有一張花色不同 → 不是同花
+        }
+    }
+    return 1;
+}
+
+/* 檢查是不是順子（點數連續） */
+int isStraight(Card *cards, int n) {
+    for (int i = 1; i < n; i++) {
+        if (cards[i].rank == cards[i - 1].rank) {
+            return 0;   // 有重複點數就一定不是順子
+        }
+        if (cards[i].rank != cards[i - 1].rank + 1) {
+            return 0;   // 不是「上一張+1」就不是連號
+        }
+    }
+    return 1;
+}
+
+/*
+ * 原本的牌型判斷（排序 + 統計），保留下來當作查表版的對照組
+ * --check-classify 會拿它逐一比對 classifyHand 的結果
+ */
+HandType classifyHandReference(Card *played, int playedCount) {
+    if (playedCount <= 0) return HAND_INVALID;
+
+    if (playedCount == 1) return HAND_SINGLE;
+
+    // 只支援最多 5 張組成牌型
+    if (playedCount > 5) return HAND_INVALID;
+
+    // 建一份 copy 來操作（避免改到原本的 played[]）
+    Card tmp[5];
+    for (int i = 0; i < playedCount; i++) {
+        tmp[i] = played[i];
+    }
+
+    // 先依照 rank 排序，方便判斷順子與計算
+    sortByRank(tmp, playedCount);
+
+    // 統計每個點數出現幾次（rank 1~13）
+    int rankCount[14] = {0};  // 全部先設成 0
+
+    for (int i = 0; i < playedCount; i++) {
+        int r = tmp[i].rank;
+        if (r >= 1 && r <= 13) {
+            rankCount[r]++;
+        }
+    }
+
+    int pairs = 0;   // 有幾組「二張」
+    int three = 0;   // 有幾組「三張」
+    int four  = 0;   // 有幾組「四張」
+
+    for (int r = 1; r <= 13; r++) {
+        if (rankCount[r] == 2) pairs++;
+        else if (rankCount[r] == 3) three++;
+        else if (rankCount[r] == 4) four++;
+    }
+
+    int flush = isFlush(tmp, playedCount);
+    int straight = isStraight(tmp, playedCount);
+
+    /* 根據張數來判斷 */
+    if (playedCount == 2) {
+        if (pairs == 1) return HAND_PAIR;
+        return HAND_INVALID;
+    }
+
+    if (playedCount == 3) {
+        return HAND_INVALID;
+    }
+
+     if (playedCount == 4) {
+        return HAND_INVALID;
+    }
+
+    if (playedCount == 5) {
+        if (straight && flush) return HAND_STRAIGHT_FLUSH;
+        if (four == 1)         return HAND_FOUR_KIND;
+        if (three == 1 && pairs == 1) return HAND_FULL_HOUSE;
+        if (flush)             return HAND_FLUSH;
+        if (straight)          return HAND_STRAIGHT;
+        return HAND_INVALID;
+    }
+    return HAND_INVALID; // C語言規定一定要有回傳值
+}
+
+/*
+ * ===== 查表版牌型判斷 =====
+ * 每張牌在 64-bit 計數器裡佔一個 4-bit 欄位（rank 1~13 → 欄位 0~12），
+ * 把所有牌加起來就是「每個點數出現幾次」。
+ * 對每個欄位加上 (8 - k) 再看第 3 個 bit，就知道有幾個點數出現 >= k 次，
+ * 不用排序、也不用一個一個點數掃。
+ *
+ * 查表的 key：
+ *   bit 0~3：恰好 2 張的點數個數 + 3 * 恰好 3 張 + 6 * 恰好 4 張（牌型的形狀）
+ *   bit 4  ：同花
+ *   bit 5  ：順子（5 個不同且連續的點數）
+ *   bit 6~8：出牌張數（0~7）
+ */
+#define NIBBLE_ONES  0x0001111111111111ULL   // 13 個欄位各放 1
+#define NIBBLE_HIGH  0x0008888888888888ULL   // 13 個欄位的第 3 個 bit
+
+static unsigned char handClassTable[512];
+
+/*
+ * 一張牌（1 byte）對 counts 和 rankBits / suitBits 的貢獻，用牌本身的 byte 查
+ * 省掉每張牌兩三個可變位移；rankBits 在 bit 0~12，suitBits 在 bit 16~19
+ * 不合法的牌（點數 0、14、15）查到 0
+ */
+static unsigned long long cardCountKey[256];
+static unsigned int cardBitsKey[256];
+static unsigned char cardByteMask;   // suit / rank 佔的 bit，padding bit 的內容沒有定義
+
+static inline unsigned char cardByte(const Card *c) {
+    unsigned char b;
+    memcpy(&b, c, 1);
+    return b & cardByteMask;
+}
+
+static void initPlayBatchKernel(void);
+
+void initHandTables(void) {
+    for (int key = 0; key < 512; key++) {
+        int shape    = key & 15;
+        int flush    = (key >> 4) & 1;
+        int straight = (key >> 5) & 1;
+        int count    = key >> 6;
+
+        int four  = shape / 6;
+        int three = (shape % 6) / 3;
+        int pairs = shape % 3;
+
+        HandType type = HAND_INVALID;
+        if (count == 1) {
+            type = HAND_SINGLE;
+        } else if (count == 2) {
+            if (pairs == 1) type = HAND_PAIR;
+        } else if (count == 5) {
+            if (straight && flush)          type = HAND_STRAIGHT_FLUSH;
+            else if (four == 1)             type = HAND_FOUR_KIND;
+            else if (three == 1 && pairs == 1) type = HAND_FULL_HOUSE;
+            else if (flush)                 type = HAND_FLUSH;
+            else if (straight)              type = HAND_STRAIGHT;
+        }
+        handClassTable[key] = (unsigned char)type;
+    }
+
+    Card all;
+    memset(&all, 0, sizeof all);
+    all.suit = 3;
+    all.rank = 15;
+    memcpy(&cardByteMask, &all, 1);
+    for (int idx = 0; idx < NUM_CARDS; idx++) {
+        Card c = cardFromIndex(idx);
+        unsigned char b = cardByte(&c);
+        cardCountKey[b] = 1ULL << (4 * (c.rank - 1));
+        cardBitsKey[b] = (1u << (c.rank - 1)) | (1u << (16 + c.suit));
+    }
+    initPlayBatchKernel();
+}
+
+void initZobristKeys(void) {
+    // 固定的種子：同一個局面每次執行都得到同一個 hash
+    zobristFullDeck = 0;
+    for (int c = 0; c < NUM_CARDS; c++) {
+        zobristDeckKey[c] = mix64(0x5A0B0000ULL + (unsigned long long)c);
+        zobristHandKey[c] = mix64(0x5A0B1000ULL + (unsigned long long)c);
+        zobristFullDeck += zobristDeckKey[c];
+    }
+}
+
+unsigned long long zobristFromScratch(const GameState *game) {
+    unsigned long long h = 0;
+    for (CardMask m = game->deckMask; m; m &= m - 1) {
+        h += zobristDeckKey[__builtin_ctzll(m)];
+    }
+    for (int i = 0; i < HAND_SIZE; i++) {
+        h += zobristHandKey[cardIndex(&game->hand[i])];
+    }
+    return h;
+}
+
+HandType classifyHand(Card *played, int playedCount) {
+    if (playedCount <= 0 || playedCount > HAND_SIZE) return HAND_INVALID;
+
+    unsigned long long counts = 0;
+    unsigned int bits = 0;
+    for (int i = 0; i < playedCount; i++) {
+        unsigned char b = cardByte(&played[i]);
+        counts += cardCountKey[b];
+        bits   |= cardBitsKey[b];
+    }
+    return classifyFromCounts(playedCount, counts, bits & 0x1FFF, bits >> 16);
+}
+
+/*
+ * 13 個欄位裡最高位是 1 的有幾個：把最高位移到最低位再乘 NIBBLE_ONES，
+ * 全部會加進第 12 個欄位（最多 13，欄位之間不會進位）
+ * 沒有 -mpopcnt 時 __builtin_popcountll 會變成 libgcc 的函式呼叫，一次乘法快得多
+ */
+static inline int nibbleHighCount(unsigned long long x) {
+    return (int)(((((x & NIBBLE_HIGH) >> 3) * NIBBLE_ONES) >> 48) & 0xF);
+}
+
+/* 查表的核心：counts / rankBits / suitBits 已經算好（出牌列舉會直接累加） */
+HandType classifyFromCounts(int playedCount, unsigned long long counts,
+                            unsigned int rankBits, unsigned int suitBits) {
+    // 出現 >= k 次的點數個數
+    int atLeast2 = nibbleHighCount(counts + 6 * NIBBLE_ONES);
+    int atLeast3 = nibbleHighCount(counts + 5 * NIBBLE_ONES);
+    int atLeast4 = nibbleHighCount(counts + 4 * NIBBLE_ONES);
+    int atLeast5 = nibbleHighCount(counts + 3 * NIBBLE_ONES);
+
+    int shape    = (atLeast2 - atLeast3) + 3 * (atLeast3 - atLeast4) + 6 * (atLeast4 - atLeast5);
+    int flush    = (suitBits & (suitBits - 1)) == 0;
+    int straight = (rankBits >> __builtin_ctz(rankBits)) == 0x1F;
+
+    return (HandType)handClassTable[(playedCount << 6) | (straight << 5) | (flush << 4) | shape];
+}
+
+int handTypeBaseScore(HandType type) {
+    switch (type) {
+        case HAND_STRAIGHT:        return 5 * SCORE_SCALE;
+        case HAND_FLUSH:           return 6 * SCORE_SCALE;
+        case HAND_FULL_HOUSE:      return 8 * SCORE_SCALE;
+        case HAND_FOUR_KIND:       return 10 * SCORE_SCALE;
+        case HAND_STRAIGHT_FLUSH:  return 12 * SCORE_SCALE;
+        default:                   return 0;
+    }
+}
+
+const char *handTypeName(HandType type) {
+    switch (type) {
+        case HAND_SINGLE:          return "Single";
+        case HAND_PAIR:            return "Pair";
+        case HAND_STRAIGHT:        return "Straight";
+        case HAND_FLUSH:           return "Flush";
+        case HAND_FULL_HOUSE:      return "Full House";
+        case HAND_FOUR_KIND:       return "Four of a Kind";
+        case HAND_STRAIGHT_FLUSH:  return "Straight Flush";
+        case HAND_INVALID:
+        default:                   return "Invalid";
+    }
+}
+
+const char *suitSymbol(int s) {
+    switch (s) {
+        case 0: return "♠";
+        case 1: return "♥";
+        case 2: return "♣";
+        case 3: return "♦";
+        default: return "?";
+    }
+}
+
+int evaluateHand(Card *played, int playedCount, const GameState *game, int *outHasBoost) {
+    if (outHasBoost) *outHasBoost = 0;
+
+    if (playedCount <= 0) return 0;
+    if (playedCount > 5)  return 0;
+
+    return scoreHandType(classifyHand(played, playedCount), played, playedCount, game, outHasBoost);
+}
+
+int scoreHandType(HandType type, const Card *played, int playedCount, const GameState *game, int *outHasBoost) {
+    if (outHasBoost) *outHasBoost = 0;
+
+    if (type == HAND_INVALID) return 0;
+
+    int finalScore = 0;
+
+    if (type == HAND_SINGLE) {
+        finalScore = game->singleScore;
+    } else if (type == HAND_PAIR) {
+        finalScore = game->pairScore;
+    } else {
+        finalScore = handTypeBaseScore(type);
+    }
+
+    // Card Multiplier：檢查是否有被強化的 rank
+    int hasBoostRank = 0;
+    for (int i = 0; i < playedCount; i++) {
+        if (rankBoosted(game, played[i].rank)) {
+            hasBoostRank = 1;
+            break;
+        }
+    }
+
+    if (hasBoostRank) {
+        finalScore = applyPercent(finalScore, BOOST_PERCENT);
+        if (outHasBoost) *outHasBoost = 1;
+    }
+
+    return finalScore; // 回傳：尚未套用 Combo 的分數
+}
+
+/*
+ * 原本的計分：分數換成 double，x1.5 和 Combo 倍率用浮點數乘，最後再 llround 存回定點數，
+ * Gold 直接截斷 double。保留下來當作定點數版本的對照組（--check-scoring）
+ */
+int scorePlayReference(Card *played, int playedCount, const GameState *game, int *outGold) {
+    HandType type = classifyHandReference(played, playedCount);
+    double gain = 0.0;
+
+    if (type == HAND_SINGLE) {
+        gain = scoreValue(game->singleScore);
+    } else if (type == HAND_PAIR) {
+        gain = scoreValue(game->pairScore);
+    } else if (type != HAND_INVALID) {
+        gain = scoreValue(handTypeBaseScore(type));
+    }
+
+    for (int i = 0; i < playedCount && type != HAND_INVALID; i++) {
+        if (rankBoosted(game, played[i].rank)) {
+            gain *= 1.5;
+            break;
+        }
+    }
+
+    if (type != HAND_SINGLE) {
+        int combo = game->comboCount + 1;   // 出完這手之後的連擊數
+        gain *= 1.0 + 0.15 * (combo - 1);
+    }
+
+    int gold = (int)gain;
+    if (outGold) *outGold = gold < 0 ? 0 : gold;
+    return scoreFixed(gain);
+}
+
+/* 5 張牌裡「點數相同的兩兩組合」數量 → 牌型形狀（恰好 2 張的個數 + 3 * 恰好 3 張 + 6 * 恰好 4 張） */
+static const unsigned char equalPairsShape[11] = {
+    0,      // 0：5 個不同點數
+    1,      // 1：一對
+    2,      // 2：兩對
+    3,      // 3：三條
+    1 + 3,  // 4：葫蘆
+    0,      // 5：不會出現
+    6,      // 6：四條
+    0, 0, 0,
+    0,      // 10：5 張同點數（Suit Change 才做得出來）
+};
+
+/* 把候選出牌插進已排序的 out[0..n-1]：gain 大的在前，同分時張數少的在前 */
+static int insertPlayOption(PlayOption out[], int n, const PlayOption *opt) {
+    int k = n;
+    while (k > 0 && (out[k - 1].gain < opt->gain ||
+                     (out[k - 1].gain == opt->gain && out[k - 1].count > opt->count))) {
+        out[k] = out[k - 1];
+        k--;
+    }
+    out[k] = *opt;
+    return n + 1;
+}
+
+/*
+ * 5 張的組合 = 7 張拿掉 2 張，所以先算整手 7 張的總和，
+ * 每個組合只要扣掉沒出的那 2 張：
+ *   - 點數相同的兩兩組合數（決定四條 / 葫蘆）
+ *   - 4-bit 花色計數器（某個花色 = 5 → 同花）
+ *   - 4-bit 點數計數器（5 個連續欄位各 1 → 順子）
+ */
+int enumeratePlays(const GameState *game, PlayOption out[NUM_CANDIDATE_PLAYS]) {
+    unsigned long long rankNib[HAND_SIZE], rankTotal = 0;
+    unsigned int suitNib[HAND_SIZE], suitTotal = 0;
+    int boosted[HAND_SIZE], boostTotal = 0;
+    int sameRank[HAND_SIZE][HAND_SIZE];
+    int sameCount[HAND_SIZE] = {0}, equalPairsTotal = 0;
+
+    for (int i = 0; i < HAND_SIZE; i++) {
+        int r = game->hand[i].rank;
+        rankNib[i] = 1ULL << (4 * (r - 1));
+        suitNib[i] = 1u << (4 * game->hand[i].suit);
+        boosted[i] = rankBoosted(game, r);
+        rankTotal  += rankNib[i];
+        suitTotal  += suitNib[i];
+        boostTotal += boosted[i];
+    }
+    for (int i = 0; i < HAND_SIZE; i++) {
+        for (int j = i + 1; j < HAND_SIZE; j++) {
+            int same = game->hand[i].rank == game->hand[j].rank;
+            sameRank[i][j] = sameRank[j][i] = same;
+            sameCount[i] += same;
+            sameCount[j] += same;
+            equalPairsTotal += same;
+        }
+    }
+
+    // 出完這手非 Single 之後的 Combo 倍率
+    int nextCombo   = comboPercent(game->comboCount + 1);
+    int single      = game->singleScore;
+    int pair        = game->pairScore;
+    int boostSingle = applyPercent(single, BOOST_PERCENT);
+    int boostPair   = applyPercent(pair, BOOST_PERCENT);
+
+    int n = 0;
+    PlayOption opt;
+
+    /* Single：一定合法 */
+    opt.count = 1;
+    opt.type  = HAND_SINGLE;
+    for (int i = 0; i < HAND_SIZE; i++) {
+        opt.slots    = (unsigned char)(1u << i);
+        opt.idx[0]   = (unsigned char)i;
+        opt.hasBoost = boosted[i];
+        opt.baseGain = boosted[i] ? boostSingle : single;
+        opt.gain     = opt.baseGain;
+        n = insertPlayOption(out, n, &opt);
+    }
+
+    /* Pair：兩張點數相同才合法 */
+    opt.count = 2;
+    opt.type  = HAND_PAIR;
+    for (int i = 0; i < HAND_SIZE; i++) {
+        for (int j = i + 1; j < HAND_SIZE; j++) {
+            if (!sameRank[i][j]) continue;
+            opt.slots    = (unsigned char)((1u << i) | (1u << j));
+            opt.idx[0]   = (unsigned char)i;
+            opt.idx[1]   = (unsigned char)j;
+            opt.hasBoost = boosted[i];   // 同點數，兩張一定一起被強化
+            opt.baseGain = opt.hasBoost ? boostPair : pair;
+            opt.gain     = applyPercent(opt.baseGain, nextCombo);
+            n = insertPlayOption(out, n, &opt);
+        }
+    }
+
+    /* 5 張：拿掉 a、b 兩張 */
+    opt.count = 5;
+    for (int a = 0; a < HAND_SIZE; a++) {
+        for (int b = a + 1; b < HAND_SIZE; b++) {
+            int equalPairs = equalPairsTotal - sameCount[a] - sameCount[b] + sameRank[a][b];
+            unsigned int suits = suitTotal - suitNib[a] - suitNib[b];
+            unsigned long long ranks = rankTotal - rankNib[a] - rankNib[b];
+
+            int flush    = ((suits + 0x3333u) & 0x8888u) != 0;
+            int straight = equalPairs == 0 && (ranks >> __builtin_ctzll(ranks)) == 0x11111ULL;
+            int key = (5 << 6) | (straight << 5) | (flush << 4) | equalPairsShape[equalPairs];
+
+            HandType type = (HandType)handClassTable[key];
+            if (type == HAND_INVALID) continue;
+
+            int k = 0;
+            for (int i = 0; i < HAND_SIZE; i++) {
+                if (i != a && i != b) opt.idx[k++] = (unsigned char)i;
+            }
+            opt.slots    = (unsigned char)(0x7F & ~((1u << a) | (1u << b)));
+            opt.type     = type;
+            opt.hasBoost = boostTotal - boosted[a] - boosted[b] > 0;
+            opt.baseGain = opt.hasBoost ? applyPercent(handTypeBaseScore(type), BOOST_PERCENT)
+                                        : handTypeBaseScore(type);
+            opt.gain     = applyPercent(opt.baseGain, nextCombo);
+            n = insertPlayOption(out, n, &opt);
+        }
+    }
+    return n;
+}
+
+/* 手牌和算分用到的規則都和上次一樣，上次的結果就還是對的 */
+static int playCacheMatches(const PlayCache *cache, const GameState *game) {
+    if (!cache->valid ||
+        cache->comboCount != game->comboCount ||
+        cache->multMask != game->multMask ||
+        cache->singleScore != game->singleScore ||
+        cache->pairScore != game->pairScore) {
+        return 0;
+    }
+    for (int i = 0; i < HAND_SIZE; i++) {
+        if (cardIndex(&cache->hand[i]) != cardIndex(&game->hand[i])) return 0;
+    }
+    return 1;
+}
+
+int evaluatePlays(PlayCache *cache, const GameState *game) {
+    if (playCacheMatches(cache, game)) return cache->count;
+    memcpy(cache->hand, game->hand, sizeof(cache->hand));
+    cache->comboCount  = game->comboCount;
+    cache->multMask    = game->multMask;
+    cache->singleScore = game->singleScore;
+    cache->pairScore   = game->pairScore;
+    cache->valid = 1;
+    cache->count = enumeratePlays(game, cache->opts);
+    return cache->count;
+}
+
+/* 電腦玩家 / 求解器用的 cache：策略物件是共用的 const 全域變數，所以每個執行緒各一份 */
+static _Thread_local PlayCache threadPlays;
+
+/* 目前手牌的合法出牌（已排序），指到 cache 裡，下次呼叫前有效 */
+static const PlayOption *currentPlays(const GameState *game, int *count) {
+    int n = evaluatePlays(&threadPlays, game);
+    if (count) *count = n;
+    return threadPlays.opts;
+}
+
+/* ---- 批次判斷牌型 / 計分（PlayBatch） ---- */
+
+static int playBaseScore[8];   // handTypeBaseScore 依 HandType 排成表（Single / Pair 另外算）
+
+static unsigned char *placePlayArray(unsigned char *base, size_t *off, size_t bytes) {
+    *off = (*off + 63) & ~(size_t)63;
+    unsigned char *p = base ? base + *off : NULL;
+    *off += bytes;
+    return p;
+}
+
+/* 把所有陣列依序排在 base 之後（64 bytes 對齊），回傳總大小；base = NULL 只算大小 */
+static size_t layoutPlayBatch(PlayBatch *b, int capacity, unsigned char *base) {
+    size_t off = 0, n = (size_t)capacity;
+#define PLACE_PLAY(field) b->field = (void *)placePlayArray(base, &off, n * sizeof(*b->field));
+    PLACE_PLAY(count)
+    for (int k = 0; k < 5; k++) {
+        PLACE_PLAY(rank[k])
+        PLACE_PLAY(suit[k])
+    }
+    PLACE_PLAY(multMask)
+    PLACE_PLAY(combo)
+    PLACE_PLAY(singleScore)
+    PLACE_PLAY(pairScore)
+    PLACE_PLAY(type)
+    PLACE_PLAY(hasBoost)
+    PLACE_PLAY(baseGain)
+    PLACE_PLAY(gain)
+#undef PLACE_PLAY
+    return (off + 63) & ~(size_t)63;
+}
+
+int playBatchInit(PlayBatch *b, int capacity) {
+    memset(b, 0, sizeof(*b));
+    b->capacity = (capacity + PLAY_LANES - 1) / PLAY_LANES * PLAY_LANES;
+    size_t size = layoutPlayBatch(b, b->capacity, NULL);
+    b->block = aligned_alloc(64, size);
+    if (b->block == NULL) return 0;
+    memset(b->block, 0, size);   // 沒用到的位置 count = 0 → 不合法，算了也不影響
+    layoutPlayBatch(b, b->capacity, b->block);
+    return 1;
+}
+
+void playBatchFree(PlayBatch *b) {
+    free(b->block);
+    memset(b, 0, sizeof(*b));
+}
+
+int playBatchAdd(PlayBatch *b, const Card *played, int playedCount, const GameState *game) {
+    if (b->n >= b->capacity) return -1;
+    int i = b->n++;
+    // 超過 5 張（classifyHand 會判不合法）就當成 0 張
+    b->count[i] = (unsigned char)(playedCount >= 1 && playedCount <= 5 ? playedCount : 0);
+    for (int k = 0; k < 5; k++) {
+        b->rank[k][i] = k < b->count[i] ? played[k].rank : 0;
+        b->suit[k][i] = k < b->count[i] ? played[k].suit : 0;
+    }
+    b->multMask[i]    = game->multMask;
+    b->combo[i]       = game->comboCount;
+    b->singleScore[i] = game->singleScore;
+    b->pairScore[i]   = game->pairScore;
+    return i;
+}
+
+/*
+ * 和 classifyHand 同一張 handClassTable，只是換成不用分支的算法：
+ *   - 點數相同的兩兩組合數 → 牌型形狀（equalPairsShape）
+ *   - 其他張的花色都和第 1 張一樣 → 同花
+ *   - 5 個不同點數且最大 - 最小 = 4 → 順子
+ * 沒用到的欄位（k >= count）當成第 1 張，不影響最大最小值
+ */
+static void scorePlayLanesScalar(PlayBatch *b, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        int count = b->count[i];
+        int r0 = b->rank[0][i], lo = r0, hi = r0;
+        int equalPairs = 0, offSuit = 0;
+        int boost = (b->multMask[i] >> r0) & 1;
+
+        for (int k = 1; k < 5; k++) {
+            int active = k < count;
+            int r = active ? b->rank[k][i] : r0;
+            for (int j = 0; j < k; j++) equalPairs += active & (b->rank[j][i] == r);
+            offSuit |= active & (b->suit[k][i] != b->suit[0][i]);
+            boost   |= active & ((b->multMask[i] >> r) & 1);
+            lo = r < lo ? r : lo;
+            hi = r > hi ? r : hi;
+        }
+
+        int straight = equalPairs == 0 && hi - lo == 4;
+        int key = (count << 6) | (straight << 5) | (!offSuit << 4) | equalPairsShape[equalPairs];
+        HandType type = (HandType)handClassTable[key];
+
+        int base = type == HAND_SINGLE ? b->singleScore[i]
+                 : type == HAND_PAIR   ? b->pairScore[i]
+                 : playBaseScore[type];
+        int hasBoost = boost && type != HAND_INVALID;
+        if (hasBoost) base = applyPercent(base, BOOST_PERCENT);
+
+        b->type[i]     = (unsigned char)type;
+        b->hasBoost[i] = (unsigned char)hasBoost;
+        b->baseGain[i] = base;
+        b->gain[i]     = type == HAND_SINGLE ? base : applyPercent(base, comboPercent(b->combo[i] + 1));
+    }
+}
+
+#ifdef HAVE_AVX2_KERNEL
+/* 8 個 byte → 8 個 32-bit */
+__attribute__((target("avx2")))
+static inline __m256i loadLanes8(const unsigned char *p) {
+    return _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)p));
+}
+
+/* 和 scorePlayLanesScalar 一樣的算法，一次 8 手 */
+__attribute__((target("avx2")))
+static void scorePlayLanesAvx2(PlayBatch *b, int begin, int end) {
+    const __m256i one  = _mm256_set1_epi32(1);
+    const __m256i zero = _mm256_setzero_si256();
+    // equalPairsShape 放進兩個 128-bit 半邊，用 vpshufb 查（index 0~10）
+    const __m256i shapeTable = _mm256_broadcastsi128_si256(_mm_setr_epi8(
+        (char)equalPairsShape[0], (char)equalPairsShape[1], (char)equalPairsShape[2], (char)equalPairsShape[3],
+        (char)equalPairsShape[4], (char)equalPairsShape[5], (char)equalPairsShape[6], (char)equalPairsShape[7],
+        (char)equalPairsShape[8], (char)equalPairsShape[9], (char)equalPairsShape[10], 0, 0, 0, 0, 0));
+
+    for (int i = begin; i < end; i += PLAY_LANES) {
+        __m256i count = loadLanes8(&b->count[i]);
+        __m256i mask  = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)&b->multMask[i]));
+        __m256i r[5];
+        r[0] = loadLanes8(&b->rank[0][i]);
+        __m256i s0 = loadLanes8(&b->suit[0][i]);
+        __m256i lo = r[0], hi = r[0], equalPairs = zero, offSuit = zero;
+        __m256i boost = _mm256_and_si256(_mm256_srlv_epi32(mask, r[0]), one);
+
+        for (int k = 1; k < 5; k++) {
+            __m256i active = _mm256_cmpgt_epi32(count, _mm256_set1_epi32(k));
+            r[k] = _mm256_blendv_epi8(r[0], loadLanes8(&b->rank[k][i]), active);
+            for (int j = 0; j < k; j++) {
+                // cmpeq 相等是 -1，減掉就是 +1
+                equalPairs = _mm256_sub_epi32(equalPairs, _mm256_and_si256(_mm256_cmpeq_epi32(r[j], r[k]), active));
+            }
+            __m256i sameSuit = _mm256_cmpeq_epi32(loadLanes8(&b->suit[k][i]), s0);
+            offSuit = _mm256_or_si256(offSuit, _mm256_andnot_si256(sameSuit, active));
+            boost = _mm256_or_si256(boost, _mm256_and_si256(_mm256_srlv_epi32(mask, r[k]), active));
+            lo = _mm256_min_epi32(lo, r[k]);
+            hi = _mm256_max_epi32(hi, r[k]);
+        }
+        boost = _mm256_and_si256(boost, one);
+
+        __m256i straight = _mm256_and_si256(_mm256_cmpeq_epi32(equalPairs, zero),
+                                            _mm256_cmpeq_epi32(_mm256_sub_epi32(hi, lo), _mm256_set1_epi32(4)));
+        __m256i flush = _mm256_cmpeq_epi32(offSuit, zero);
+        __m256i key = _mm256_or_si256(
+            _mm256_or_si256(_mm256_slli_epi32(count, 6), _mm256_and_si256(straight, _mm256_set1_epi32(1 << 5))),
+            _mm256_or_si256(_mm256_and_si256(flush, _mm256_set1_epi32(1 << 4)),
+                            _mm256_shuffle_epi8(shapeTable, equalPairs)));
+
+        // handClassTable 是 byte 表：抓包含那個 byte 的 32-bit 再移出來（不會讀出表外）
+        __m256i word = _mm256_i32gather_epi32((const int *)handClassTable, _mm256_srli_epi32(key, 2), 4);
+        __m256i type = _mm256_and_si256(
+            _mm256_srlv_epi32(word, _mm256_slli_epi32(_mm256_and_si256(key, _mm256_set1_epi32(3)), 3)),
+            _mm256_set1_epi32(0xFF));
+        __m256i hasBoost = _mm256_andnot_si256(_mm256_cmpeq_epi32(type, zero), boost);
+        __m256i isSingle = _mm256_cmpeq_epi32(type, _mm256_set1_epi32(HAND_SINGLE));
+        __m256i isPair   = _mm256_cmpeq_epi32(type, _mm256_set1_epi32(HAND_PAIR));
+        __m256i combo    = loadLanes8(&b->combo[i]);
+
+        __m256i base = _mm256_i32gather_epi32(playBaseScore, type, 4);
+        base = _mm256_blendv_epi8(base, _mm256_loadu_si256((const __m256i *)&b->singleScore[i]), isSingle);
+        base = _mm256_blendv_epi8(base, _mm256_loadu_si256((const __m256i *)&b->pairScore[i]), isPair);
+        // x1.5 四捨五入 = (3 * base + 1) >> 1（分數不會是負的）
+        __m256i boosted = _mm256_srli_epi32(_mm256_add_epi32(_mm256_add_epi32(base, _mm256_add_epi32(base, base)), one), 1);
+        base = _mm256_blendv_epi8(base, boosted, _mm256_cmpeq_epi32(hasBoost, one));
+        _mm256_storeu_si256((__m256i *)&b->baseGain[i], base);
+
+        // Combo：base * (100 + 15 * combo) 可能超過 32-bit，分兩半用 double 算（整數都在 2^53 內，除完取 floor 是準的）
+        __m256i percent = _mm256_add_epi32(_mm256_set1_epi32(100), _mm256_mullo_epi32(combo, _mm256_set1_epi32(15)));
+        __m128i gain[2];
+        for (int half = 0; half < 2; half++) {
+#define HALF(v) (half ? _mm256_extracti128_si256(v, 1) : _mm256_castsi256_si128(v))
+            __m256d scaled = _mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(HALF(base)), _mm256_cvtepi32_pd(HALF(percent))),
+                                           _mm256_set1_pd(50.0));
+            gain[half] = _mm256_cvttpd_epi32(_mm256_floor_pd(_mm256_div_pd(scaled, _mm256_set1_pd(100.0))));
+#undef HALF
+        }
+        __m256i comboGain = _mm256_inserti128_si256(_mm256_castsi128_si256(gain[0]), gain[1], 1);
+        _mm256_storeu_si256((__m256i *)&b->gain[i], _mm256_blendv_epi8(comboGain, base, isSingle));
+
+        int typeOut[PLAY_LANES], boostOut[PLAY_LANES];
+        _mm256_storeu_si256((__m256i *)typeOut, type);
+        _mm256_storeu_si256((__m256i *)boostOut, hasBoost);
+        for (int l = 0; l < PLAY_LANES; l++) {
+            b->type[i + l]     = (unsigned char)typeOut[l];
+            b->hasBoost[i + l] = (unsigned char)boostOut[l];
+        }
+    }
+}
+#endif
+
+static void (*playBatchKernel)(PlayBatch *b, int begin, int end) = scorePlayLanesScalar;
+static const char *playBatchKernelLabel = "scalar";
+
+static void initPlayBatchKernel(void) {
+    for (int t = 0; t < 8; t++) playBaseScore[t] = handTypeBaseScore((HandType)t);
+#ifdef HAVE_AVX2_KERNEL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        playBatchKernel = scorePlayLanesAvx2;
+        playBatchKernelLabel = "avx2";
+    }
+#endif
+}
+
+void scorePlayBatch(PlayBatch *b) {
+    // 最後不滿 PLAY_LANES 的那組也整組算（多出來的位置一定是合法的記憶體）
+    playBatchKernel(b, 0, (b->n + PLAY_LANES - 1) / PLAY_LANES * PLAY_LANES);
+}
+
+const char *playBatchKernelName(void) {
+    return playBatchKernelLabel;
+}
+
+void applySuitChange(GameState *game, int idx, int newSuit) {
+    Card changed = game->hand[idx];
+    changed.suit = newSuit;
+    setHandCard(game, idx, changed);
+    game->hasSuitChange = 0;  // 用掉
+}
+
+int drawBoostReveal(GameState *game, Card candidates[3]) {
+    if (game->deckIndex + 3 > NUM_CARDS) {
+        return 0;
+    }
+
+    // 翻出來的 3 張就算之後取消也不會放回牌堆
+    for (int i = 0; i < 3; i++) {
+        candidates[i] = drawCard(game);
+        game->playedMask |= cardBit(&candidates[i]);
+    }
+    return 1;
+}
+
+void drawBoostApply(GameState *game, const Card *picked, int replaceIndex) {
+    game->playedMask |= cardBit(&game->hand[replaceIndex]);
+    game->playedMask &= ~cardBit(picked);
+    setHandCard(game, replaceIndex, *picked);
+
+    // 其餘 2 張直接丟棄（不放回牌堆）
+
+    game->hasDrawBoost  = 0;  // 這張 Magic Card 用掉了
+    game->drawBoostUsed = 1;  // 這一輪遊戲已經發動過 Draw Boost
+}
+
+int rollMagicBonus(GameState *game) {
+    // 你可以固定 +1 或隨機 1~3（我先保留你原本的隨機）
+    return gameRandBelow(game, 3) + 1;
+}
+
+void applyMagicChoice(GameState *game, int choice, int bonus) {
+    if (choice == 1) {
+        game->pairBonus += bonus * SCORE_SCALE;
+    } else {
+        game->hasSuitChange = 1;
+    }
+}
+
+ShopResult shopBuy(GameState *game, int choice, int *outRank) {
+    if (choice == 1) {
+        if (game->hasDrawBoost)      return SHOP_ALREADY_OWNED;
+        if (game->gold < COST_DRAW)  return SHOP_NO_GOLD;
+        game->gold -= COST_DRAW;
+        game->hasDrawBoost = 1;
+        return SHOP_OK;
+    }
+
+    if (choice == 2) {
+        if (game->gold < COST_MULTI) return SHOP_NO_GOLD;
+
+        int available[13], cnt = 0;
+        for (int r = 1; r <= 13; r++) {
+            if (!rankBoosted(game, r)) {
+                available[cnt++] = r;
+            }
+        }
+        if (cnt == 0) return SHOP_SOLD_OUT;
+
+        game->gold -= COST_MULTI;
+
+        int chosenRank = available[gameRandBelow(game, cnt)];
+        game->multMask |= (unsigned short)(1u << chosenRank);
+        if (outRank) *outRank = chosenRank;
+        return SHOP_OK;
+    }
+
+    if (choice == 3) {
+        if (game->hasRedraw)          return SHOP_ALREADY_OWNED;
+        if (game->gold < COST_REDRAW) return SHOP_NO_GOLD;
+        game->gold -= COST_REDRAW;
+        game->hasRedraw = 1;
+        return SHOP_OK;
+    }
+
+    return SHOP_INVALID;
+}
+
+int updateHandAfterPlay(GameState *game, Card *played, int playedCount) {
+    // 1. 建立一個暫存的新手牌陣列
+    Card newHand[HAND_SIZE];
+    int newIndex = 0;
+
+    // 2. 把沒有被出的牌搬進 newHand（用 bit 判斷 hand[i] 是否在 played[] 裡）
+    //    出掉的牌的 hash key 先加起來，補牌成功才扣（hash 是加法）
+    CardMask playedBits = maskFromCards(played, playedCount);
+    unsigned long long playedKeys = 0;
+    for (int i = 0; i < HAND_SIZE; i++) {
+        int idx = cardIndex(&game->hand[i]);
+        if ((playedBits >> idx) & 1) {
+            playedKeys += zobristHandKey[idx];
+        } else {
+            newHand[newIndex] = game->hand[i];
+            newIndex++;
+        }
+    }
+
+    // 3. 補牌：補 (7 - newIndex) 張
+    int need = HAND_SIZE - newIndex;
+
+    if (game->deckIndex + need > NUM_CARDS) {
+        return 0;   // 牌堆不夠補新的手牌了（手牌維持原樣）
+    }
+
+    game->zobrist -= playedKeys;
+    for (int i = 0; i < need; i++) {
+        newHand[newIndex] = drawCard(game);
+        game->zobrist += zobristHandKey[cardIndex(&newHand[newIndex])];
+        newIndex++;
+    }
+    game->playedMask |= playedBits;
+    TRACE_COUNT(TRACE_CARDS_DRAWN, need);
+
+    // 4. 把 newHand 複製回玩家的手牌
+    memcpy(game->hand, newHand, sizeof(newHand));
+    return 1;
+}
+
+/* 牌型已經判斷好的結算（gameStep 先判斷過合不合法，不用再判斷一次） */
+static void scoreClassifiedHand(GameState *game, HandType type, Card *played, int playedCount, PlayResult *out) {
+    out->type = type;
+
+    // 先算：尚未套用 Combo 的 base gain（但已包含 x1.5 multiplier）
+    out->baseGain = scoreHandType(out->type, played, playedCount, game, &out->hasBoost);
+
+    out->gain = out->baseGain;   // 之後可能套 combo
+    out->comboPercent = 100;
+    out->brokeCombo = 0;
+
+    // Combo 規則
+    if (out->type == HAND_SINGLE) {
+        game->comboCount = 0;
+        out->brokeCombo = 1;
+    } else {
+        game->comboCount++;
+        out->comboPercent = comboPercent(game->comboCount);
+        out->gain = applyPercent(out->gain, out->comboPercent);
+    }
+
+    // 更新總分（都是定點數，直接加）
+    game->score += out->gain;
+
+    // Gold：實得分的整數部分
+    out->earnGold = out->gain / SCORE_SCALE;
+    if (out->earnGold < 0) out->earnGold = 0;
+    game->gold += out->earnGold;
+}
+
+void scorePlayedHand(GameState *game, Card *played, int playedCount, PlayResult *out) {
+    scoreClassifiedHand(game, classifyHand(played, playedCount), played, playedCount, out);
+}
+
+int useRedraw(GameState *game) {
+    if (game->deckIndex + HAND_SIZE > NUM_CARDS) {
+        return 0;
+    }
+
+    game->hasRedraw  = 0;   // 用掉
+    game->redrawUsedThisLevel = 1;
+
+    game->playedMask |= handMask(game);   // 舊手牌整手丟掉
+    for (int i = 0; i < HAND_SIZE; i++) {
+        setHandCard(game, i, drawCard(game));
+    }
+    return 1;
+}
+
+void freeGame(GameState *game) {
+    // GameState 不再持有外部記憶體，留著這個進入點給呼叫端對稱使用
+    (void)game;
+}
+/* ====== 模擬模式 ====== */
+
+/* 每一關最多模擬幾個回合（避免策略一直放棄出牌造成無窮迴圈） */
+#define SIM_MAX_TURNS 1000
+
+/* 取得單調時間（秒），計算 runs/sec 用 */
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * 模擬一關：規則和互動模式的遊戲流程完全相同
+ * 差別只在：不印東西、不播音效、不 sleep，所有選擇都交給 policy
+ */
+int simPlayLevel(GameState *game, const Policy *policy, SimStats *stats) {
+    StepResult r;
+
+    for (int turn = 0; turn < SIM_MAX_TURNS; turn++) {
+        if (game->phase != PHASE_TURN) {
+            return game->score >= game->target;
+        }
+
+        /* Redraw：用成功就用新手牌重新考慮 */
+        if (game->hasRedraw && !game->redrawUsedThisLevel &&
+            policy->wantRedraw(policy->ctx, game)) {
+            GameAction redraw = { ACT_REDRAW, 0 };
+            if (gameStep(game, redraw, &r)) {
+                continue;
+            }
+        }
+
+        /* Draw Boost */
+        if (game->hasDrawBoost && !game->drawBoostUsed &&
+            policy->wantDrawBoost(policy->ctx, game)) {
+            GameAction reveal = { ACT_DRAW_BOOST, 0 };
+            if (gameStep(game, reveal, &r)) {
+                int pick, replaceIndex;
+                GameAction keep = { ACT_SKIP, 0 };
+                if (policy->chooseDrawBoost(policy->ctx, game, boostCards(game), &pick, &replaceIndex) &&
+                    pick >= 0 && pick < 3 && replaceIndex >= 0 && replaceIndex < HAND_SIZE) {
+                    keep.type = ACT_BOOST_PICK;
+                    keep.arg = (unsigned char)(pick << 3 | replaceIndex);
+                }
+                gameStep(game, keep, &r);
+            }
+        }
+
+        /* 出牌：和互動模式一樣檢查 index，牌型交給引擎 */
+        int idx[5];
+        int count = policy->choosePlay(policy->ctx, game, idx);
+        unsigned int slots = 0;
+        int valid = (count >= 1 && count <= 5);
+
+        for (int i = 0; valid && i < count; i++) {
+            if (idx[i] < 0 || idx[i] >= HAND_SIZE || (slots & (1u << idx[i]))) {
+                valid = 0;
+                break;
+            }
+            slots |= 1u << idx[i];
+        }
+
+        GameAction play = { valid ? ACT_PLAY : ACT_PASS, (unsigned char)slots };
+        if (gameStep(game, play, &r) && valid && stats) stats->hands++;
+    }
+
+    if (stats) stats->stuckLevels++;
+    return 0;
+}
+
+int simRunGame(GameState *game, const Policy *policy, SimStats *stats) {
+    int cleared = 0;
+    StepResult r;
+
+    for (int lv = 1; lv <= NUM_LEVELS; lv++) {
+        if (game->phase == PHASE_SUIT_CHANGE) {
+            int idx, newSuit;
+            GameAction change = { ACT_SKIP, 0 };   // 輸入錯誤 → 魔法作廢
+            if (policy->chooseSuitChange(policy->ctx, game, &idx, &newSuit) &&
+                idx >= 0 && idx < HAND_SIZE && newSuit >= 0 && newSuit <= 3) {
+                change.type = ACT_SUIT_CHANGE;
+                change.arg = (unsigned char)(idx << 2 | newSuit);
+            }
+            gameStep(game, change, &r);
+        }
+
+        if (stats) stats->levelAttempts[lv]++;
+        if (!simPlayLevel(game, policy, stats)) {
+            break;
+        }
+        if (stats) stats->levelClears[lv]++;
+        cleared = lv;
+
+        if (lv < NUM_LEVELS) {
+            int choice = policy->chooseMagic(policy->ctx, game, peekMagicBonus(game));
+            GameAction magic = { ACT_MAGIC, (unsigned char)((choice == 2) ? 2 : 1) };
+            gameStep(game, magic, &r);
+
+            // 商店：和互動模式一樣，買成功一次或選 0 就離開（引擎接著開下一關）
+            for (int tries = 0; tries < 8 && game->phase == PHASE_SHOP; tries++) {
+                int shopChoice = policy->chooseShop(policy->ctx, game);
+                if (shopChoice == 0) break;
+                GameAction buy = { ACT_SHOP, (unsigned char)shopChoice };
+                gameStep(game, buy, &r);
+            }
+            if (game->phase == PHASE_SHOP) {
+                GameAction leave = { ACT_SKIP, 0 };
+                gameStep(game, leave, &r);
+            }
+        }
+    }
+
+    if (stats) {
+        stats->runs++;
+        if (cleared == NUM_LEVELS) stats->fullClears++;
+    }
+    return cleared;
+}
+
+/* ---- 內建基本策略：有 Pair 出 Pair，沒有就出第一張 Single ---- */
+
+static int basicChoosePlay(void *ctx, const GameState *game, int idx[5]) {
+    (void)ctx;
+    for (int i = 0; i < HAND_SIZE; i++) {
+        for (int j = i + 1; j < HAND_SIZE; j++) {
+            if (game->hand[i].rank == game->hand[j].rank) {
+                idx[0] = i;
+                idx[1] = j;
+                return 2;
+            }
+        }
+    }
+    idx[0] = 0;
+    return 1;
+}
+
+static int basicWantRedraw(void *ctx, const GameState *game) {
+    (void)ctx; (void)game;
+    return 0;
+}
+
+static int basicWantDrawBoost(void *ctx, const GameState *game) {
+    (void)ctx; (void)game;
+    return 1;
+}
+
+static int basicChooseDrawBoost(void *ctx, const GameState *game, const Card candidates[3],
+                                int *pick, int *replaceIndex) {
+    (void)ctx;
+    // 優先挑能和手牌湊成 Pair 的那張，換掉第一張湊不成對的手牌
+    *pick = 0;
+    for (int c = 0; c < 3; c++) {
+        for (int i = 0; i < HAND_SIZE; i++) {
+            if (game->hand[i].rank == candidates[c].rank) {
+                *pick = c;
+                c = 3;
+                break;
+            }
+        }
+    }
+    *replaceIndex = 0;
+    for (int i = 0; i < HAND_SIZE; i++) {
+        int paired = (game->hand[i].rank == candidates[*pick].rank);
+        for (int j = 0; j < HAND_SIZE && !paired; j++) {
+            if (j != i && game->hand[j].rank == game->hand[i].rank) paired = 1;
+        }
+        if (!paired) {
+            *replaceIndex = i;
+            break;
+        }
+    }
+    return 1;
+}
+
+static int basicChooseSuitChange(void *ctx, const GameState *game, int *idx, int *newSuit) {
+    (void)ctx;
+    // 把第一張牌改成手牌中最多的花色
+    int suitCount[4] = {0};
+    for (int i = 0; i < HAND_SIZE; i++) suitCount[game->hand[i].suit]++;
+    int best = 0;
+    for (int s = 1; s < 4; s++) {
+        if (suitCount[s] > suitCount[best]) best = s;
+    }
+    *idx = 0;
+    for (int i = 0; i < HAND_SIZE; i++) {
+        if (game->hand[i].suit != best) {
+            *idx = i;
+            break;
+        }
+    }
+    *newSuit = best;
+    return 1;
+}
+
+static int basicChooseMagic(void *ctx, const GameState *game, int bonus) {
+    (void)ctx; (void)game; (void)bonus;
+    return 1;   // Pair 永久加分
+}
+
+static int basicChooseShop(void *ctx, const GameState *game) {
+    (void)ctx;
+    if (game->gold >= COST_MULTI) return 2;
+    if (!game->hasRedraw && game->gold >= COST_REDRAW) return 3;
+    return 0;
+}
+
+/* ---- 貪婪策略：每回合出分數最高的那手，道具也挑讓最佳出牌分數最高的用法 ---- */
+
+static int bestPlayGain(const GameState *game) {
+    PlayOption opts[NUM_CANDIDATE_PLAYS];
+    enumeratePlays(game, opts);
+    return opts[0].gain;   // Single 一定合法，所以至少有一個
+}
+
+static int greedyChoosePlay(void *ctx, const GameState *game, int idx[5]) {
+    (void)ctx;
+    const PlayOption *best = currentPlays(game, NULL);
+    for (int i = 0; i < best->count; i++) idx[i] = best->idx[i];
+    return best->count;
+}
+
+static int greedyWantRedraw(void *ctx, const GameState *game) {
+    (void)ctx;
+    // 手上連一對都沒有才重抽
+    return currentPlays(game, NULL)->type == HAND_SINGLE;
+}
+
+static int greedyChooseDrawBoost(void *ctx, const GameState *game, const Card candidates[3],
+                                 int *pick, int *replaceIndex) {
+    (void)ctx;
+    GameState trial = *game;
+
+    int best = -1;
+    for (int c = 0; c < 3; c++) {
+        for (int r = 0; r < HAND_SIZE; r++) {
+            memcpy(trial.hand, game->hand, sizeof(trial.hand));
+            trial.hand[r] = candidates[c];
+            int g = bestPlayGain(&trial);
+            if (g > best) {
+                best = g;
+                *pick = c;
+                *replaceIndex = r;
+            }
+        }
+    }
+    return 1;
+}
+
+static int greedyChooseSuitChange(void *ctx, const GameState *game, int *idx, int *newSuit) {
+    (void)ctx;
+    GameState trial = *game;
+
+    int best = -1;
+    for (int i = 0; i < HAND_SIZE; i++) {
+        for (int st = 0; st < 4; st++) {
+            memcpy(trial.hand, game->hand, sizeof(trial.hand));
+            trial.hand[i].suit = st;
+            int g = bestPlayGain(&trial);
+            if (g > best) {
+                best = g;
+                *idx = i;
+                *newSuit = st;
+            }
+        }
+    }
+    return 1;
+}
+
+const Policy greedyPolicy = {
+    "greedy", NULL,
+    greedyChoosePlay,
+    greedyWantRedraw,
+    basicWantDrawBoost,
+    greedyChooseDrawBoost,
+    greedyChooseSuitChange,
+    basicChooseMagic,
+    basicChooseShop,
+};
+
+const Policy basicPolicy = {
+    "basic", NULL,
+    basicChoosePlay,
+    basicWantRedraw,
+    basicWantDrawBoost,
+    basicChooseDrawBoost,
+    basicChooseSuitChange,
+    basicChooseMagic,
+    basicChooseShop,
+};
+
+int runSimulation(long runs, const Policy *policy, unsigned long long masterSeed, int threads) {
+    if (threads <= 0) threads = cpuCount();
+
+    SimStats stats;
+    double start = nowSeconds();
+    runParallelSimulation(runs, policy, masterSeed, threads, &stats);
+    double elapsed = nowSeconds() - start;
+
+    printf("=== 模擬結果（策略：%s，%d 條執行緒，種子 %llu）===\n", policy->name, threads, masterSeed);
+    printf("總輪數：%ld  |  耗時：%.3f 秒  |  %.0f runs/sec\n",
+           stats.runs, elapsed, elapsed > 0 ? stats.runs / elapsed : 0.0);
+    printf("平均每輪出牌：%.2f 手\n", stats.runs ? (double)stats.hands / stats.runs : 0.0);
+    for (int lv = 1; lv <= NUM_LEVELS; lv++) {
+        long att = stats.levelAttempts[lv];
+        printf("第 %d 關：挑戰 %ld 次，過關 %ld 次，過關率 %.2f%%\n",
+               lv, att, stats.levelClears[lv], att ? 100.0 * stats.levelClears[lv] / att : 0.0);
+    }
+    printf("五關全過：%ld 輪（%.2f%%）\n",
+           stats.fullClears, stats.runs ? 100.0 * stats.fullClears / stats.runs : 0.0);
+    if (stats.stuckLevels) {
+        printf("超過回合上限而判定失敗的關卡：%ld\n", stats.stuckLevels);
+    }
+    return 0;
+}
+
+/* ====== 牌型判斷驗證 ====== */
+
+/* 比對 n 張牌（允許重複的牌，因為 Suit Change 可能做出兩張一樣的牌） */
+static long compareAllPlays(int n, long *mismatches) {
+    int idx[5] = {0};
+    long checked = 0;
+
+    while (1) {
+        Card cards[5];
+        for (int i = 0; i < n; i++) {
+            cards[i].suit = idx[i] / 13;
+            cards[i].rank = idx[i] % 13 + 1;
+        }
+        if (classifyHand(cards, n) != classifyHandReference(cards, n)) {
+            if (*mismatches < 5) {
+                printf("不一致：");
+                for (int i = 0; i < n; i++) printCard(&cards[i]);
+                printf(" 查表=%s 原本=%s\n", handTypeName(classifyHand(cards, n)),
+                       handTypeName(classifyHandReference(cards, n)));
+            }
+            (*mismatches)++;
+        }
+        checked++;
+
+        // 下一組 idx[0] <= idx[1] <= ... <= idx[n-1]
+        int k = n - 1;
+        while (k >= 0 && idx[k] == NUM_CARDS - 1) k--;
+        if (k < 0) break;
+        idx[k]++;
+        for (int i = k + 1; i < n; i++) idx[i] = idx[k];
+    }
+    return checked;
+}
+
+/* 批次算完的第 i 手和 classifyHand + scoreHandType 比對（gain 照 scorePlayedHand 套 Combo） */
+static int playBatchEntryMatches(const PlayBatch *b, int i) {
+    Card cards[5];
+    for (int k = 0; k < b->count[i]; k++) {
+        cards[k].rank = b->rank[k][i];
+        cards[k].suit = b->suit[k][i];
+    }
+    GameState rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.multMask    = b->multMask[i];
+    rules.singleScore = b->singleScore[i];
+    rules.pairScore   = b->pairScore[i];
+
+    int hasBoost;
+    HandType type = classifyHand(cards, b->count[i]);
+    int base = scoreHandType(type, cards, b->count[i], &rules, &hasBoost);
+    int gain = type == HAND_SINGLE ? base : applyPercent(base, comboPercent(b->combo[i] + 1));
+    return b->type[i] == type && b->hasBoost[i] == hasBoost && b->baseGain[i] == base && b->gain[i] == gain;
+}
+
+/* 所有 1~5 張的出牌（含 Suit Change 做得出來的重複牌）× 幾組規則，丟進 kernel 比對 */
+static long comparePlayBatch(void (*kernel)(PlayBatch *, int, int), long *mismatches) {
+    enum { RULE_SETS = 3 };
+    GameState rules[RULE_SETS];
+    memset(rules, 0, sizeof(rules));
+    rules[1].multMask = 1u << 7;
+    rules[1].comboCount = 3;
+    rules[1].singleScore = scoreFixed(1.3);
+    rules[1].pairScore = scoreFixed(2.6);
+    rules[2].multMask = (1u << 1) | (1u << 9) | (1u << 13);
+    rules[2].comboCount = 11;
+    rules[2].singleScore = 12345;
+    rules[2].pairScore = 54321;
+
+    PlayBatch batch;
+    if (!playBatchInit(&batch, 4096)) return 0;
+    long checked = 0;
+
+    for (int n = 1; n <= 5; n++) {
+        int idx[5] = {0};
+        int more = 1;
+        while (more) {
+            Card cards[5];
+            for (int i = 0; i < n; i++) {
+                cards[i].suit = idx[i] / 13;
+                cards[i].rank = idx[i] % 13 + 1;
+            }
+            for (int r = 0; r < RULE_SETS; r++) playBatchAdd(&batch, cards, n, &rules[r]);
+
+            // 下一組 idx[0] <= idx[1] <= ... <= idx[n-1]
+            int k = n - 1;
+            while (k >= 0 && idx[k] == NUM_CARDS - 1) k--;
+            if (k < 0) {
+                more = 0;
+            } else {
+                idx[k]++;
+                for (int i = k + 1; i < n; i++) idx[i] = idx[k];
+            }
+
+            if (batch.n + RULE_SETS > batch.capacity || (!more && batch.n > 0)) {
+                kernel(&batch, 0, batch.capacity);
+                for (int i = 0; i < batch.n; i++) {
+                    if (!playBatchEntryMatches(&batch, i)) (*mismatches)++;
+                }
+                checked += batch.n;
+                batch.n = 0;
+            }
+        }
+    }
+    playBatchFree(&batch);
+    return checked;
+}
+
+int checkClassifier(void) {
+    long mismatches = 0;
+    long checked = 0;
+
+    for (int n = 1; n <= 5; n++) {
+        checked += compareAllPlays(n, &mismatches);
+    }
+    printf("比對 %ld 種出牌組合，不一致 %ld 種。\n", checked, mismatches);
+
+    struct { const char *name; void (*kernel)(PlayBatch *, int, int); } kernels[] = {
+        { "scalar", scorePlayLanesScalar },
+#ifdef HAVE_AVX2_KERNEL
+        { "avx2", __builtin_cpu_supports("avx2") ? scorePlayLanesAvx2 : NULL },
+#endif
+    };
+    int numKernels = (int)(sizeof(kernels) / sizeof(kernels[0]));
+    for (int v = 0; v < numKernels; v++) {
+        if (kernels[v].kernel == NULL) {
+            printf("PlayBatch（%s）：這台 CPU 不支援，略過。\n", kernels[v].name);
+            continue;
+        }
+        long wrong = 0;
+        long n = comparePlayBatch(kernels[v].kernel, &wrong);
+        printf("PlayBatch（%s）：比對 %ld 手（含計分），不一致 %ld 手。\n", kernels[v].name, n, wrong);
+        mismatches += wrong;
+    }
+
+    // 速度：隨機 5 張牌，兩種版本各跑一次
+    enum { BENCH_HANDS = 1 << 16, BENCH_ROUNDS = 64 };
+    Card *hands = malloc(sizeof(Card) * 5 * BENCH_HANDS);
+    if (hands == NULL) {
+        printf("記憶體配置失敗！\n");
+        return 1;
+    }
+    Card deck[NUM_CARDS];
+    Rng rng;
+    rngSeed(&rng, 1);
+    initDeck(deck);
+    for (int h = 0; h < BENCH_HANDS; h++) {
+        shuffleDeck(deck, &rng);
+        memcpy(&hands[h * 5], deck, sizeof(Card) * 5);
+    }
+
+    for (int version = 0; version < 2; version++) {
+        volatile int sink = 0;
+        double start = nowSeconds();
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            for (int h = 0; h < BENCH_HANDS; h++) {
+                sink += version == 0 ? classifyHand(&hands[h * 5], 5)
+                                     : classifyHandReference(&hands[h * 5], 5);
+            }
+        }
+        double elapsed = nowSeconds() - start;
+        printf("%s：%.1f M hands/sec\n", version == 0 ? "查表版 classifyHand" : "原本的 classifyHandReference",
+               (double)BENCH_HANDS * BENCH_ROUNDS / elapsed / 1e6);
+    }
+
+    // 判斷 + 計分：一次一手的 evaluateHand 和整批的 PlayBatch
+    GameState rules;
+    memset(&rules, 0, sizeof(rules));
+    rules.multMask = 1u << 7;
+    rules.comboCount = 2;
+    rules.singleScore = scoreFixed(1.0);
+    rules.pairScore = scoreFixed(2.0);
+
+    PlayBatch batch;
+    if (!playBatchInit(&batch, BENCH_HANDS)) {
+        free(hands);
+        printf("記憶體配置失敗！\n");
+        return 1;
+    }
+    for (int h = 0; h < BENCH_HANDS; h++) playBatchAdd(&batch, &hands[h * 5], 5, &rules);
+
+    {
+        volatile int sink = 0;
+        double start = nowSeconds();
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            for (int h = 0; h < BENCH_HANDS; h++) {
+                sink += applyPercent(evaluateHand(&hands[h * 5], 5, &rules, NULL), comboPercent(rules.comboCount + 1));
+            }
+        }
+        double elapsed = nowSeconds() - start;
+        printf("一次一手 evaluateHand：%.1f M hands/sec\n", (double)BENCH_HANDS * BENCH_ROUNDS / elapsed / 1e6);
+    }
+    for (int v = 0; v < numKernels; v++) {
+        if (kernels[v].kernel == NULL) continue;
+        double start = nowSeconds();
+        for (int round = 0; round < BENCH_ROUNDS; round++) {
+            kernels[v].kernel(&batch, 0, batch.capacity);
+        }
+        double elapsed = nowSeconds() - start;
+        printf("PlayBatch（%s）：%.1f M hands/sec\n", kernels[v].name,
+               (double)BENCH_HANDS * BENCH_ROUNDS / elapsed / 1e6);
+    }
+    printf("scorePlayBatch 目前用的是 %s 版本。\n", playBatchKernelName());
+    playBatchFree(&batch);
+
+    free(hands);
+    return mismatches == 0 ? 0 : 1;
+}
+
+/* ====== 計分驗證（定點數 vs 原本的 double） ====== */
+
+typedef struct {
+    long turns;        // 檢查過幾個局面
+    long plays;        // 檢查過幾手候選出牌
+    long gainDiffs;    // 實得分不一致
+    long goldDiffs;    // Gold 不一致
+    long optionDiffs;  // enumeratePlays 的 gain 和實際出牌結算不一致
+} ScoringCheck;
+
+static void reportScoringDiff(const ScoringCheck *check, const GameState *game, const Card *played, int count,
+                              const char *what, long fixed, long reference) {
+    if (check->gainDiffs + check->goldDiffs + check->optionDiffs > 5) return;   // 只印前幾個
+    printf("不一致（%s）：", what);
+    for (int i = 0; i < count; i++) printCard(&played[i]);
+    printf(" Combo=%d Single=%d Pair=%d 強化=0x%04x  定點數=%ld 原本=%ld\n",
+           game->comboCount, game->singleScore, game->pairScore, game->multMask, fixed, reference);
+}
+
+/* 出牌前先把這個局面的每一手候選都比對一次，再照貪婪策略出 */
+static int checkScoringChoosePlay(void *ctx, const GameState *game, int idx[5]) {
+    ScoringCheck *check = ctx;
+    int n;
+    const PlayOption *opts = currentPlays(game, &n);
+    check->turns++;
+
+    for (int o = 0; o < n; o++) {
+        Card played[5];
+        for (int k = 0; k < opts[o].count; k++) played[k] = game->hand[opts[o].idx[k]];
+
+        GameState after = *game;
+        PlayResult res;
+        scorePlayedHand(&after, played, opts[o].count, &res);
+        int refGold;
+        int refGain = scorePlayReference(played, opts[o].count, game, &refGold);
+        check->plays++;
+
+        if (res.gain != refGain) {
+            check->gainDiffs++;
+            reportScoringDiff(check, game, played, opts[o].count, "實得分", res.gain, refGain);
+        }
+        if (res.earnGold != refGold) {
+            check->goldDiffs++;
+            reportScoringDiff(check, game, played, opts[o].count, "Gold", res.earnGold, refGold);
+        }
+        if (opts[o].gain != res.gain || opts[o].type != res.type) {
+            check->optionDiffs++;
+            reportScoringDiff(check, game, played, opts[o].count, "列舉", opts[o].gain, res.gain);
+        }
+    }
+    return greedyPolicy.choosePlay(greedyPolicy.ctx, game, idx);
+}
+
+int checkScoring(long games, unsigned long long seed) {
+    ScoringCheck check;
+    memset(&check, 0, sizeof(check));
+
+    Policy policy = greedyPolicy;
+    policy.name = "check-scoring";
+    policy.ctx = &check;
+    policy.choosePlay = checkScoringChoosePlay;
+
+    GameState game;
+    double start = nowSeconds();
+    for (long g = 0; g < games; g++) {
+        newGame(&game, seed, (unsigned long long)g);
+        simRunGame(&game, &policy, NULL);
+    }
+    double elapsed = nowSeconds() - start;
+    freeGame(&game);
+
+    printf("=== 計分驗證（定點數 vs double，%ld 局，種子 %llu）===\n", games, seed);
+    printf("局面：%ld  |  候選出牌：%ld  |  耗時：%.2f 秒\n", check.turns, check.plays, elapsed);
+    printf("實得分不一致：%ld  |  Gold 不一致：%ld  |  列舉和結算不一致：%ld\n",
+           check.gainDiffs, check.goldDiffs, check.optionDiffs);
+    return check.gainDiffs + check.goldDiffs + check.optionDiffs == 0 ? 0 : 1;
+}
+
+/* ====== 亂數產生器 ====== */
+
+/* 把 64-bit 整數徹底打散（splitmix64 的輸出函式） */
+unsigned long long mix64(unsigned long long z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void rngSeed(Rng *rng, unsigned long long seed) {
+    unsigned long long k = mix64(seed);
+    rng->key[0] = (unsigned int)k;
+    rng->key[1] = (unsigned int)(k >> 32);
+    rng->counter = 0;
+}
+
+void rngForGame(Rng *rng, unsigned long long seed, unsigned long long game) {
+    rngSeed(rng, mix64(seed) + game * 0x9E3779B97F4A7C15ULL);
+    rng->counter = RNG_MISC_BASE;
+}
+
+unsigned int rngNext32(Rng *rng) {
+    return counterHash32(rng->key[0], rng->key[1], rng->counter++);
+}
+
+unsigned long long rngNext(Rng *rng) {
+    unsigned long long hi = rngNext32(rng);
+    return (hi << 32) | rngNext32(rng);
+}
+
+/* Lemire 的乘法取範圍，落在偏差區就重抽 */
+unsigned int rngBelow(Rng *rng, unsigned int bound) {
+    unsigned long long m = (unsigned long long)rngNext32(rng) * bound;
+    unsigned int low = (unsigned int)m;
+    if (low < bound) {
+        unsigned int threshold = (0u - bound) % bound;
+        while (low < threshold) {
+            m = (unsigned long long)rngNext32(rng) * bound;
+            low = (unsigned int)m;
+        }
+    }
+    return (unsigned int)(m >> 32);
+}
+
+void shuffleCards(Card *cards, int n, Rng *rng) {
+    for (int i = n - 1; i > 0; i--) {
+        int j = (int)rngBelow(rng, (unsigned int)(i + 1));
+        Card temp = cards[i];
+        cards[i] = cards[j];
+        cards[j] = temp;
+    }
+}
+
+Rng deckStream(const Rng *gameRng, int level) {
+    Rng r = *gameRng;
+    r.counter = (unsigned int)level << RNG_DECK_SHIFT;
+    return r;
+}
+
+/*
+ * 一次處理 BATCH_LANES 副牌：同一步 i 的亂數對每副牌各算一個，
+ * 內層迴圈只有 32-bit 乘法 / 位移，編譯器可以自動向量化（SSE/AVX2/NEON）。
+ * 很少數落在偏差區要重抽的那副牌，再退回單副的 rngBelow 處理。
+ */
+#define BATCH_LANES 16
+
+void shuffleDeckBatch(unsigned char (*decks)[NUM_CARDS], const Rng *streams, int n) {
+    for (int base = 0; base < n; base += BATCH_LANES) {
+        int lanes = (n - base < BATCH_LANES) ? n - base : BATCH_LANES;
+        unsigned int k0[BATCH_LANES], k1[BATCH_LANES], ctr[BATCH_LANES];
+        unsigned int x[BATCH_LANES];
+
+        for (int l = 0; l < BATCH_LANES; l++) {
+            const Rng *src = &streams[base + (l < lanes ? l : 0)];
+            k0[l] = src->key[0];
+            k1[l] = src->key[1];
+            ctr[l] = src->counter;
+        }
+        for (int l = 0; l < lanes; l++) {
+            for (int c = 0; c < NUM_CARDS; c++) decks[base + l][c] = (unsigned char)c;
+        }
+
+        for (int i = NUM_CARDS - 1; i > 0; i--) {
+            unsigned int bound = (unsigned int)(i + 1);
+            unsigned int threshold = (0u - bound) % bound;
+
+            for (int l = 0; l < BATCH_LANES; l++) {
+                x[l] = counterHash32(k0[l], k1[l], ctr[l]);
+                ctr[l]++;
+            }
+            for (int l = 0; l < lanes; l++) {
+                unsigned long long m = (unsigned long long)x[l] * bound;
+                if ((unsigned int)m < threshold) {
+                    // 偏差區：和 rngBelow 一樣一直重抽
+                    Rng r = { { k0[l], k1[l] }, ctr[l] };
+                    while ((unsigned int)m < threshold) {
+                        m = (unsigned long long)rngNext32(&r) * bound;
+                    }
+                    ctr[l] = r.counter;
+                }
+                int j = (int)(m >> 32);
+                unsigned char *d = decks[base + l];
+                unsigned char t = d[i];
+                d[i] = d[j];
+                d[j] = t;
+            }
+        }
+    }
+}
+
+int gameRandBelow(GameState *game, int bound) {
+    return (int)rngBelow(&game->rng, (unsigned int)bound);
+}
+
+/* ====== 多執行緒模擬 ====== */
+
+int cpuCount(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+/*
+ * 每條執行緒有一段「還沒玩的局」[begin, end)，用一個 64-bit 原子變數存：
+ * 高 32 bit = begin、低 32 bit = end。
+ * 自己從前面一次拿一小塊，做完了就去別人那邊從後面偷一半。
+ */
+#define SIM_CHUNK 64
+
+typedef struct SimWorker {
+    _Alignas(64) _Atomic unsigned long long range;
+    _Alignas(64) SimStats stats;  // 這條執行緒自己的統計（最後才加總，不用鎖；和 range 分開 cache line）
+    int id;
+    int numWorkers;
+    const Policy *policy;
+    unsigned long long masterSeed;
+    struct SimWorker *all;
+} SimWorker;
+
+static unsigned long long packRange(unsigned int begin, unsigned int end) {
+    return ((unsigned long long)begin << 32) | end;
+}
+
+/* 從自己的範圍前面拿最多 SIM_CHUNK 局 */
+static int takeOwnWork(SimWorker *w, unsigned int *begin, unsigned int *end) {
+    unsigned long long cur = atomic_load(&w->range);
+    while (1) {
+        unsigned int b = (unsigned int)(cur >> 32), e = (unsigned int)cur;
+        if (b >= e) return 0;
+        unsigned int take = (e - b < SIM_CHUNK) ? e - b : SIM_CHUNK;
+        if (atomic_compare_exchange_weak(&w->range, &cur, packRange(b + take, e))) {
+            *begin = b;
+            *end = b + take;
+            return 1;
+        }
+    }
+}
+
+/* 從 victim 的範圍後面偷一半，放進自己的範圍 */
+static int stealWork(SimWorker *w, SimWorker *victim) {
+    unsigned long long cur = atomic_load(&victim->range);
+    while (1) {
+        unsigned int b = (unsigned int)(cur >> 32), e = (unsigned int)cur;
+        if (b >= e) return 0;
+        unsigned int mid = b + (e - b) / 2;   // 只剩 1 局也偷得走
+        if (atomic_compare_exchange_weak(&victim->range, &cur, packRange(b, mid))) {
+            // 自己的範圍現在是空的，別人不會來改
+            atomic_store(&w->range, packRange(mid, e));
+            return 1;
+        }
+    }
+}
+
+static void pinThread(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % CPU_SETSIZE, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;   // macOS 沒有硬性綁核心的 API
+#endif
+}
+
+static void *simWorkerMain(void *arg) {
+    SimWorker *w = arg;
+    TRACE_THREAD_NAME("sim worker");
+    SimWorker *all = w->all;
+    pinThread(w->id % cpuCount());
+
+    GameState game;
+    initGame(&game);
+
+    while (1) {
+        unsigned int begin, end;
+        if (!takeOwnWork(w, &begin, &end)) {
+            // 自己的做完了：依序看其他人，偷到就繼續
+            int stolen = 0;
+            for (int k = 1; k < w->numWorkers && !stolen; k++) {
+                stolen = stealWork(w, &all[(w->id + k) % w->numWorkers]);
+            }
+            if (!stolen) break;
+            continue;
+        }
+
+        for (unsigned int i = begin; i < end; i++) {
+            newGame(&game, w->masterSeed, i);
+            simRunGame(&game, w->policy, &w->stats);
+        }
+    }
+
+    freeGame(&game);
+    return NULL;
+}
+
+void runParallelSimulation(long runs, const Policy *policy, unsigned long long masterSeed,
+                           int threads, SimStats *out) {
+    if (threads <= 0) threads = cpuCount();
+    if (runs > 0xFFFFFFFFL) runs = 0xFFFFFFFFL;
+
+    SimWorker *workers = aligned_alloc(64, sizeof(SimWorker) * (size_t)threads);
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (workers == NULL || tids == NULL) {
+        printf("記憶體配置失敗！\n");
+        exit(1);
+    }
+
+    // 一開始平均分給每條執行緒
+    for (int t = 0; t < threads; t++) {
+        unsigned int begin = (unsigned int)(runs * t / threads);
+        unsigned int end   = (unsigned int)(runs * (t + 1) / threads);
+        atomic_init(&workers[t].range, packRange(begin, end));
+        memset(&workers[t].stats, 0, sizeof(SimStats));
+        workers[t].id = t;
+        workers[t].numWorkers = threads;
+        workers[t].policy = policy;
+        workers[t].masterSeed = masterSeed;
+        workers[t].all = workers;
+    }
+
+    int started = 1;
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&tids[t], NULL, simWorkerMain, &workers[t]) != 0) break;
+        started++;
+    }
+    simWorkerMain(&workers[0]);   // 沒開成功的執行緒，它的工作會被偷光
+    for (int t = 1; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+
+    memset(out, 0, sizeof(*out));
+    for (int t = 0; t < threads; t++) {
+        const SimStats *st = &workers[t].stats;
+        out->runs        += st->runs;
+        out->fullClears  += st->fullClears;
+        out->hands       += st->hands;
+        out->stuckLevels += st->stuckLevels;
+        for (int lv = 0; lv <= NUM_LEVELS; lv++) {
+            out->levelAttempts[lv] += st->levelAttempts[lv];
+            out->levelClears[lv]   += st->levelClears[lv];
+        }
+    }
+
+    free(workers);
+    free(tids);
+}
+
+/* ====== 關卡求解器 ====== */
+
+/* 出 slots 這幾張（和互動模式的結算一樣），回傳 0 表示不合法 */
+static int playSlots(GameState *game, unsigned int slots) {
+    StepResult r;
+    GameAction play = { ACT_PLAY, (unsigned char)slots };
+    return gameStep(game, play, &r);
+}
+
+static unsigned int bestSlots(const GameState *game) {
+    return currentPlays(game, NULL)->slots;
+}
+
+/* 一次模擬：執行 action 之後用貪婪策略把這關玩完，回傳 1 = 過關 */
+static int rolloutAction(const GameState *root, const SolverAction *action, Rng *rng) {
+    GameState world = *root;   // GameState 是值型別，複製就是 128 bytes
+    GameState *g = &world;
+
+    // 玩家不知道牌堆順序：沒發出來的牌每次都重新洗
+    shuffleCards(&g->deck[g->deckIndex], NUM_CARDS - g->deckIndex, rng);
+
+    StepResult r;
+    if (action->kind == ACTION_REDRAW) {
+        GameAction redraw = { ACT_REDRAW, 0 };
+        gameStep(g, redraw, &r);
+    } else {
+        if (action->kind == ACTION_DRAW_BOOST) {
+            int pick, replaceIndex;
+            GameAction reveal = { ACT_DRAW_BOOST, 0 };
+            gameStep(g, reveal, &r);
+            greedyPolicy.chooseDrawBoost(greedyPolicy.ctx, g, boostCards(g), &pick, &replaceIndex);
+            GameAction keep = { ACT_BOOST_PICK, (unsigned char)(pick << 3 | replaceIndex) };
+            gameStep(g, keep, &r);
+        }
+        // Draw Boost 之後同一回合還是要出牌
+        playSlots(g, action->kind == ACTION_PLAY ? action->slots : bestSlots(g));
+    }
+    return simPlayLevel(g, &greedyPolicy, NULL);
+}
+
+/* 列出目前局面可以做的動作 */
+static int listSolverActions(const GameState *game, SolverAction actions[MAX_SOLVER_ACTIONS]) {
+    int n = 0;
+    if (game->hasRedraw && !game->redrawUsedThisLevel && game->deckIndex + HAND_SIZE <= NUM_CARDS) {
+        memset(&actions[n], 0, sizeof(actions[n]));
+        actions[n++].kind = ACTION_REDRAW;
+    }
+    if (game->hasDrawBoost && !game->drawBoostUsed && game->deckIndex + 3 <= NUM_CARDS) {
+        memset(&actions[n], 0, sizeof(actions[n]));
+        actions[n++].kind = ACTION_DRAW_BOOST;
+    }
+
+    int count;
+    const PlayOption *opts = currentPlays(game, &count);
+    for (int i = 0; i < count; i++) {
+        memset(&actions[n], 0, sizeof(actions[n]));
+        actions[n].kind  = ACTION_PLAY;
+        actions[n].slots = opts[i].slots;
+        actions[n].type  = opts[i].type;
+        n++;
+    }
+    return n;
+}
+
+/* ---- 置換表：同一個局面（不管怎麼走到的）可以接續之前的模擬結果 ---- */
+
+/*
+ * 兩格一組的 hash table，不上鎖：
+ *   - 搶格子用 CAS 換 key，搶輸的就不用表（只用自己的統計）
+ *   - 次數用 atomic 加，所有執行緒（包括同時在算別的局面的）都看得到
+ * 動作清單不存在表裡，每次都由局面重新列出，所以統計就算有一點競爭誤差也不會出錯
+ */
+#define SOLVER_TABLE_SIZE 4096   // 總格數
+#define SOLVER_TABLE_WAYS 2
+#define SOLVER_TABLE_AGE  64     // TABLE_REPLACE_VISITS：超過幾次 solveLevel 沒用到就當成沒價值
+
+typedef struct {
+    _Atomic unsigned long long key;   // 0 = 空的
+    _Atomic int numActions;
+    _Atomic unsigned int stamp;       // 最後一次用到時的 solverTableClock
+    _Atomic unsigned int visits[MAX_SOLVER_ACTIONS];
+    _Atomic unsigned int wins[MAX_SOLVER_ACTIONS];
+} SolverEntry;
+
+static SolverEntry solverTable[SOLVER_TABLE_SIZE];
+static _Atomic unsigned int solverTableClock;
+static _Atomic long tableProbes, tableHits, tableStores, tableEvictions, tableRaces;
+
+/*
+ * 局面的 key：牌面用 GameState 裡一路更新的 Zobrist hash（手牌不管順序、剩下的牌），
+ * 再混進還差幾分、Combo、道具和這一輪的加成
+ */
+static unsigned long long solverKey(const GameState *game) {
+    unsigned long long need = (unsigned int)(game->target - game->score);
+    unsigned long long flags = (unsigned long long)game->comboCount
+                             | (unsigned long long)game->hasRedraw << 8
+                             | (unsigned long long)game->redrawUsedThisLevel << 9
+                             | (unsigned long long)game->hasDrawBoost << 10
+                             | (unsigned long long)game->drawBoostUsed << 11
+                             | (unsigned long long)game->level << 12
+                             | (unsigned long long)game->multMask << 16
+                             | (unsigned long long)(unsigned int)game->pairBonus << 32;
+
+    unsigned long long key = game->zobrist ^ mix64(need ^ 0x5555) ^ mix64(flags + 0x9E3779B97F4A7C15ULL);
+    return key ? key : 1;
+}
+
+static long entryVisits(SolverEntry *e) {
+    long total = 0;
+    int n = atomic_load_explicit(&e->numActions, memory_order_relaxed);
+    for (int a = 0; a < n && a < MAX_SOLVER_ACTIONS; a++) {
+        total += atomic_load_explicit(&e->visits[a], memory_order_relaxed);
+    }
+    return total;
+}
+
+/* 這一格被蓋掉的代價（越小越該蓋） */
+static long entryWorth(SolverEntry *e, TableReplace replace, unsigned int now) {
+    unsigned int age = now - atomic_load_explicit(&e->stamp, memory_order_relaxed);
+    if (replace == TABLE_REPLACE_RECENT || age > SOLVER_TABLE_AGE) return -(long)age;
+    return entryVisits(e);
+}
+
+/* 找 key 的格子（沒有的話照替換策略搶一格），回傳 NULL 表示搶輸了 */
+static SolverEntry *solverTableProbe(unsigned long long key, int numActions, TableReplace replace, int *hit) {
+    unsigned int now = atomic_fetch_add_explicit(&solverTableClock, 1, memory_order_relaxed) + 1;
+    SolverEntry *bucket = &solverTable[(key % (SOLVER_TABLE_SIZE / SOLVER_TABLE_WAYS)) * SOLVER_TABLE_WAYS];
+    atomic_fetch_add_explicit(&tableProbes, 1, memory_order_relaxed);
+    *hit = 0;
+
+    for (int w = 0; w < SOLVER_TABLE_WAYS; w++) {
+        SolverEntry *e = &bucket[w];
+        if (atomic_load_explicit(&e->key, memory_order_acquire) == key &&
+            atomic_load_explicit(&e->numActions, memory_order_relaxed) == numActions) {
+            atomic_store_explicit(&e->stamp, now, memory_order_relaxed);
+            atomic_fetch_add_explicit(&tableHits, 1, memory_order_relaxed);
+            *hit = 1;
+            return e;
+        }
+    }
+
+    // 沒找到：空格優先，不然蓋掉比較沒價值的那格
+    SolverEntry *victim = &bucket[0];
+    long victimWorth = 0;
+    for (int w = 0; w < SOLVER_TABLE_WAYS; w++) {
+        SolverEntry *e = &bucket[w];
+        long worth = atomic_load_explicit(&e->key, memory_order_relaxed) == 0
+                   ? LONG_MIN : entryWorth(e, replace, now);
+        if (w == 0 || worth < victimWorth) {
+            victim = e;
+            victimWorth = worth;
+        }
+    }
+
+    unsigned long long old = atomic_load_explicit(&victim->key, memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&victim->key, &old, key,
+                                                 memory_order_acq_rel, memory_order_relaxed)) {
+        atomic_fetch_add_explicit(&tableRaces, 1, memory_order_relaxed);
+        return NULL;
+    }
+    atomic_fetch_add_explicit(old ? &tableEvictions : &tableStores, 1, memory_order_relaxed);
+
+    for (int a = 0; a < MAX_SOLVER_ACTIONS; a++) {
+        atomic_store_explicit(&victim->visits[a], 0, memory_order_relaxed);
+        atomic_store_explicit(&victim->wins[a], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&victim->numActions, numActions, memory_order_relaxed);
+    atomic_store_explicit(&victim->stamp, now, memory_order_release);
+    return victim;
+}
+
+void solverTableStats(SolverTableStats *out) {
+    out->probes    = atomic_load(&tableProbes);
+    out->hits      = atomic_load(&tableHits);
+    out->stores    = atomic_load(&tableStores);
+    out->evictions = atomic_load(&tableEvictions);
+    out->races     = atomic_load(&tableRaces);
+}
+
+void solverTableClear(void) {
+    for (int i = 0; i < SOLVER_TABLE_SIZE; i++) {
+        atomic_store(&solverTable[i].key, 0);
+    }
+    atomic_store(&tableProbes, 0);
+    atomic_store(&tableHits, 0);
+    atomic_store(&tableStores, 0);
+    atomic_store(&tableEvictions, 0);
+    atomic_store(&tableRaces, 0);
+}
+
+/* ---- 多執行緒：所有執行緒在置換表的同一格上跑 UCB1 ---- */
+
+typedef struct {
+    const GameState *root;
+    const SolverConfig *cfg;
+    SolverEntry *entry;         // 共用的統計（NULL = 搶不到格子，只用自己的）
+    unsigned long long key;
+    int numActions;
+    SolverAction actions[MAX_SOLVER_ACTIONS];   // 這條執行緒自己的統計
+    Rng rng;
+    double deadline;
+    long iterations;
+} SolverWorker;
+
+static void *solverWorkerMain(void *arg) {
+    SolverWorker *wk = arg;
+    SolverAction *acts = wk->actions;
+    SolverEntry *e = wk->entry;
+
+    for (long it = 0; ; it++) {
+        if (wk->cfg->maxIterations > 0 && it >= wk->cfg->maxIterations) break;
+        if ((it & 15) == 0 && nowSeconds() >= wk->deadline) break;
+
+        // 格子被別的局面搶走的話，之後只看自己的統計
+        if (e && atomic_load_explicit(&e->key, memory_order_relaxed) != wk->key) e = NULL;
+
+        long visits[MAX_SOLVER_ACTIONS], wins[MAX_SOLVER_ACTIONS], total = 0;
+        for (int a = 0; a < wk->numActions; a++) {
+            visits[a] = e ? (long)atomic_load_explicit(&e->visits[a], memory_order_relaxed) : acts[a].visits;
+            wins[a]   = e ? (long)atomic_load_explicit(&e->wins[a], memory_order_relaxed) : acts[a].wins;
+            total += visits[a];
+        }
+
+        // UCB1：沒試過的先試，之後挑「過關率 + 探索加分」最高的
+        int pick = 0;
+        double bestScore = -1.0;
+        for (int a = 0; a < wk->numActions; a++) {
+            double ucb;
+            if (visits[a] == 0) {
+                ucb = 1e9 - a;
+            } else {
+                ucb = (double)wins[a] / visits[a]
+                    + 0.7 * sqrt(log((double)total + 1.0) / visits[a]);
+            }
+            if (ucb > bestScore) {
+                bestScore = ucb;
+                pick = a;
+            }
+        }
+
+        // 先記一次造訪（virtual loss），別的執行緒就不會全部擠到同一個動作
+        if (e) atomic_fetch_add_explicit(&e->visits[pick], 1, memory_order_relaxed);
+        int won = rolloutAction(wk->root, &acts[pick], &wk->rng);
+        if (e && won) atomic_fetch_add_explicit(&e->wins[pick], 1, memory_order_relaxed);
+
+        acts[pick].wins += won;
+        acts[pick].visits++;
+        wk->iterations++;
+    }
+    return NULL;
+}
+
+void solverDefaultConfig(SolverConfig *cfg) {
+    cfg->timeBudget = 0.050;
+    cfg->threads = 1;
+    cfg->maxIterations = 0;
+    cfg->seed = 0;
+    cfg->replace = TABLE_REPLACE_VISITS;
+}
+
+int solveLevel(const GameState *game, const SolverConfig *cfg, SolverResult *out) {
+    double start = nowSeconds();
+    memset(out, 0, sizeof(*out));
+
+    out->numActions = listSolverActions(game, out->actions);
+    if (out->numActions == 0) return 0;
+
+    // 置換表：同一個局面、同一組動作 → 從上次的統計接著算
+    unsigned long long key = solverKey(game);
+    SolverEntry *entry = solverTableProbe(key, out->numActions, cfg->replace, &out->tableHit);
+    if (out->tableHit) {
+        for (int a = 0; a < out->numActions; a++) {
+            out->actions[a].visits = atomic_load_explicit(&entry->visits[a], memory_order_relaxed);
+            out->actions[a].wins   = atomic_load_explicit(&entry->wins[a], memory_order_relaxed);
+        }
+    }
+
+    int threads = cfg->threads < 1 ? 1 : cfg->threads;
+    SolverWorker *workers = calloc((size_t)threads, sizeof(SolverWorker));
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (workers == NULL || tids == NULL) {
+        free(workers);
+        free(tids);
+        return 0;
+    }
+
+    unsigned long long seed = cfg->seed ? cfg->seed : (unsigned long long)time(NULL) ^ key;
+    for (int t = 0; t < threads; t++) {
+        workers[t].root = game;
+        workers[t].cfg = cfg;
+        workers[t].entry = entry;
+        workers[t].key = key;
+        workers[t].numActions = out->numActions;
+        workers[t].deadline = start + cfg->timeBudget;
+        rngSeed(&workers[t].rng, mix64(seed + (unsigned long long)t * 0x9E3779B97F4A7C15ULL));
+        // 舊的統計只給第一條執行緒（避免重複計算）
+        memcpy(workers[t].actions, out->actions, sizeof(SolverAction) * out->numActions);
+        if (t > 0) {
+            for (int a = 0; a < out->numActions; a++) {
+                workers[t].actions[a].visits = 0;
+                workers[t].actions[a].wins = 0;
+            }
+        }
+    }
+
+    // 第 0 條在目前的執行緒上跑，其他的開新執行緒
+    int started = 1;
+    for (int t = 1; t < threads; t++) {
+        if (pthread_create(&tids[t], NULL, solverWorkerMain, &workers[t]) != 0) break;
+        started++;
+    }
+    solverWorkerMain(&workers[0]);
+    for (int t = 1; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+
+    // 結果用各執行緒自己的統計加起來（表裡的可能被同時在算的其他局面蓋掉）
+    for (int a = 0; a < out->numActions; a++) {
+        out->actions[a].visits = 0;
+        out->actions[a].wins = 0;
+        for (int t = 0; t < started; t++) {
+            out->actions[a].visits += workers[t].actions[a].visits;
+            out->actions[a].wins   += workers[t].actions[a].wins;
+        }
+        out->iterations += out->actions[a].visits;
+    }
+    free(workers);
+    free(tids);
+
+    // 最佳動作：過關率最高（樣本太少的不算）
+    double bestRate = -1.0;
+    for (int a = 0; a < out->numActions; a++) {
+        const SolverAction *act = &out->actions[a];
+        if (act->visits == 0) continue;
+        double rate = (double)act->wins / act->visits;
+        if (act->visits * 4 < out->iterations / out->numActions) rate -= 1.0;
+        if (rate > bestRate) {
+            bestRate = rate;
+            out->best = a;
+        }
+    }
+
+    out->elapsed = nowSeconds() - start;
+    return out->numActions;
+}
+
+void describeAction(const GameState *game, const SolverAction *action, char *buf, size_t size) {
+    if (action->kind == ACTION_REDRAW) {
+        snprintf(buf, size, "使用 Redraw");
+        return;
+    }
+    if (action->kind == ACTION_DRAW_BOOST) {
+        snprintf(buf, size, "使用 Draw Boost");
+        return;
+    }
+    int len = snprintf(buf, size, "出 ");
+    for (int i = 0; i < HAND_SIZE && len < (int)size; i++) {
+        if (action->slots & (1u << i)) {
+            len += snprintf(buf + len, size - len, "[%d]", i);
+        }
+    }
+    if (len < (int)size) {
+        snprintf(buf + len, size - len, " %s", handTypeName(action->type));
+    }
+    (void)game;
+}
+
+void printSolverHint(const GameState *game, double budget) {
+    TRACE_SCOPE(TRACE_HINT);
+    SolverConfig cfg;
+    solverDefaultConfig(&cfg);
+    cfg.timeBudget = budget;
+
+    SolverResult res;
+    if (!solveLevel(game, &cfg, &res)) return;
+
+    // 過關率前三名
+    int order[MAX_SOLVER_ACTIONS];
+    for (int i = 0; i < res.numActions; i++) order[i] = i;
+    for (int i = 0; i < res.numActions && i < 3; i++) {
+        for (int j = i + 1; j < res.numActions; j++) {
+            const SolverAction *x = &res.actions[order[i]], *y = &res.actions[order[j]];
+            double rx = x->visits ? (double)x->wins / x->visits : -1.0;
+            double ry = y->visits ? (double)y->wins / y->visits : -1.0;
+            if (ry > rx || (ry == rx && y->visits > x->visits)) {
+                int t = order[i]; order[i] = order[j]; order[j] = t;
+            }
+        }
+    }
+
+    printf("%s求解器（%ld 次模擬）：%s", C_CYAN, res.iterations, C_RESET);
+    for (int i = 0; i < res.numActions && i < 3; i++) {
+        const SolverAction *act = &res.actions[order[i]];
+        if (act->visits == 0) break;
+        char desc[64];
+        describeAction(game, act, desc, sizeof(desc));
+        printf("%s%s 過關 %.0f%%", i ? "｜" : "", desc, 100.0 * act->wins / act->visits);
+    }
+    printf("\n");
+}
+
+int runSolverBench(long positions, const SolverConfig *cfg) {
+    GameState game;
+    initGame(&game);
+
+    long iterations = 0;
+    double elapsed = 0.0, worst = 0.0;
+    for (long p = 0; p < positions; p++) {
+        resetGameState(&game);
+        game.hasRedraw = (p % 2 == 0);
+        game.hasDrawBoost = (p % 3 == 0);
+        startLevel(&game, 1 + (int)(p % NUM_LEVELS));
+
+        SolverResult res;
+        solveLevel(&game, cfg, &res);
+        iterations += res.iterations;
+        elapsed += res.elapsed;
+        if (res.elapsed > worst) worst = res.elapsed;
+    }
+
+    printf("=== 求解器（%d 條執行緒，每個局面 %.0f ms）===\n", cfg->threads, cfg->timeBudget * 1000);
+    printf("局面數：%ld  |  總模擬：%ld 次  |  %.0f 次模擬/秒\n",
+           positions, iterations, elapsed > 0 ? iterations / elapsed : 0.0);
+    printf("平均每個局面 %.1f ms，最久 %.1f ms\n",
+           positions ? elapsed / positions * 1000 : 0.0, worst * 1000);
+
+    SolverTableStats ts;
+    solverTableStats(&ts);
+    printf("置換表（%s）：查 %ld 次，命中 %ld 次（%.1f%%），新增 %ld、蓋掉 %ld、搶輸 %ld\n",
+           cfg->replace == TABLE_REPLACE_RECENT ? "recent" : "visits",
+           ts.probes, ts.hits, ts.probes ? 100.0 * ts.hits / ts.probes : 0.0,
+           ts.stores, ts.evictions, ts.races);
+
+    freeGame(&game);
+    return 0;
+}
+
+/* ====== 過關機率 ====== */
+
+/*
+ * 區間版的 expectimax：
+ *   - 決策點取所有動作裡最好的，抽牌點把每一種抽法平均
+ *   - 看到 depth 次抽牌還沒結束的局面回傳 [0, 1]，所以結果永遠是真正機率的上下界，
+ *     depth 一層一層加上去，上下界就越夾越緊，整棵樹看完就是精確值
+ *   - 抽法太多的動作（例如牌堆還很多時的 Redraw）直接當成 [0, 1]，不展開
+ *
+ * 一定過得了的局面不用往下算：
+ *   牌堆補不滿時手牌維持原樣、分數照算（見 updateHandAfterPlay），所以只要手上有一手
+ *   2 張以上的合法牌、牌堆還有牌，先出 Single 把牌堆耗到比那手少，再一直出那一手就會過關
+ */
+#define ODDS_TABLE_SIZE   (1 << 18)
+#define ODDS_CHANCE_LIMIT 20000   // 一個動作最多展開幾種抽法
+#define ODDS_EXACT_DEPTH  0xFFFF
+
+typedef struct {
+    double lo, hi;
+} OddsBounds;
+
+/*
+ * 共用的結果表（不上鎖）：check = key ^ lo ^ hi ^ depth，
+ * 兩條執行緒同時寫同一格時讀到的欄位會對不上，就當成沒找到
+ */
+typedef struct {
+    _Atomic unsigned long long check;
+    _Atomic unsigned long long lo, hi;   // double 的 bits
+    _Atomic unsigned long long depth;    // 這個結果看了幾次抽牌（ODDS_EXACT_DEPTH = 精確值）
+} OddsEntry;
+
+static OddsEntry *oddsTable;
+static pthread_once_t oddsTableOnce = PTHREAD_ONCE_INIT;
+
+static void oddsTableAlloc(void) {
+    oddsTable = calloc(ODDS_TABLE_SIZE, sizeof(OddsEntry));
+}
+
+typedef struct {
+    double deadline;
+    int timedOut;
+    long nodes;
+    long hits;
+    long work;      // 展開的局面 + 試過的抽法，每 256 個看一次時鐘
+} OddsSearch;
+
+/* 時間到了嗎：抽法的迴圈裡也要看，不然一個動作幾萬種抽法會一路跑完才停 */
+static int oddsOutOfTime(OddsSearch *search) {
+    if ((search->work++ & 255) == 0 && nowSeconds() >= search->deadline) search->timedOut = 1;
+    return search->timedOut;
+}
+
+/* 局面的 key：求解器的 key 再加上現在的階段和 Draw Boost 翻出來的牌 */
+static unsigned long long oddsKey(const GameState *game) {
+    unsigned long long key = solverKey(game) ^ mix64(0x0DD5ULL + game->phase);
+    if (game->phase == PHASE_BOOST_PICK) {
+        const Card *c = boostCards(game);
+        key ^= mix64(((unsigned long long)cardIndex(&c[0]) << 16 |
+                      (unsigned long long)cardIndex(&c[1]) << 8 |
+                      (unsigned long long)cardIndex(&c[2])) + 0xB0057ULL);
+    }
+    return key;
+}
+
+static int oddsLookup(unsigned long long key, int depth, OddsBounds *out) {
+    if (oddsTable == NULL) return 0;
+    OddsEntry *e = &oddsTable[key & (ODDS_TABLE_SIZE - 1)];
+    unsigned long long lo = atomic_load_explicit(&e->lo, memory_order_relaxed);
+    unsigned long long hi = atomic_load_explicit(&e->hi, memory_order_relaxed);
+    unsigned long long d  = atomic_load_explicit(&e->depth, memory_order_relaxed);
+    unsigned long long check = atomic_load_explicit(&e->check, memory_order_acquire);
+    if ((check ^ lo ^ hi ^ d) != key || (int)d < depth) return 0;
+    memcpy(&out->lo, &lo, sizeof(double));
+    memcpy(&out->hi, &hi, sizeof(double));
+    return 1;
+}
+
+static void oddsStore(unsigned long long key, int depth, OddsBounds b) {
+    if (oddsTable == NULL) return;
+    OddsEntry *e = &oddsTable[key & (ODDS_TABLE_SIZE - 1)];
+    unsigned long long lo, hi, d = (unsigned long long)(b.lo == b.hi ? ODDS_EXACT_DEPTH : depth);
+    memcpy(&lo, &b.lo, sizeof(lo));
+    memcpy(&hi, &b.hi, sizeof(hi));
+    // 已經有比較深的結果就不要蓋掉（同一格換了局面就照蓋）
+    unsigned long long oldD = atomic_load_explicit(&e->depth, memory_order_relaxed);
+    unsigned long long oldCheck = atomic_load_explicit(&e->check, memory_order_relaxed);
+    unsigned long long oldLo = atomic_load_explicit(&e->lo, memory_order_relaxed);
+    unsigned long long oldHi = atomic_load_explicit(&e->hi, memory_order_relaxed);
+    if ((oldCheck ^ oldLo ^ oldHi ^ oldD) == key && oldD > d) return;
+
+    atomic_store_explicit(&e->lo, lo, memory_order_relaxed);
+    atomic_store_explicit(&e->hi, hi, memory_order_relaxed);
+    atomic_store_explicit(&e->depth, d, memory_order_relaxed);
+    atomic_store_explicit(&e->check, key ^ lo ^ hi ^ d, memory_order_release);
+}
+
+/* 手上有 2 張以上的合法牌、牌堆還有牌 → 一定過得了（見上面的說明） */
+static int oddsSureClear(const GameState *game) {
+    if (game->deckIndex >= NUM_CARDS) return 0;
+    int n;
+    const PlayOption *opts = currentPlays(game, &n);
+    for (int i = 0; i < n; i++) {
+        if (opts[i].count >= 2) return 1;
+    }
+    return 0;
+}
+
+static OddsBounds oddsValue(const GameState *game, int depth, OddsSearch *search);
+
+/*
+ * 執行一個會從牌堆抽 draw 張的動作：把每一種「接下來 draw 張是哪幾張」都試一次
+ * （順序不影響結果，因為之後的抽牌都會重新展開），回傳平均
+ */
+static OddsBounds oddsChance(const GameState *game, GameAction action, int draw, int depth, OddsSearch *search) {
+    OddsBounds sure = { 1.0, 1.0 }, unknown = { 0.0, 1.0 };
+
+    // 出完就過關：計分只看出的牌，補到哪幾張都一樣，不用展開
+    if (action.type == ACT_PLAY) {
+        GameState child = *game;
+        StepResult r;
+        if (gameStep(&child, action, &r) && child.score >= child.target) return sure;
+    }
+
+    int left = NUM_CARDS - game->deckIndex;
+    if (draw > left) draw = 0;   // 補不滿：手牌維持原樣，沒有抽牌
+    if (draw > 0 && binomial(left, draw) > ODDS_CHANCE_LIMIT) return unknown;
+
+    Card rest[NUM_CARDS];
+    memcpy(rest, &game->deck[game->deckIndex], sizeof(Card) * left);
+
+    int pick[HAND_SIZE];
+    for (int i = 0; i < draw; i++) pick[i] = i;
+
+    OddsBounds sum = { 0.0, 0.0 };
+    long outcomes = 0;
+    while (1) {
+        if (oddsOutOfTime(search)) return unknown;
+        GameState child = *game;
+        Card *d = &child.deck[child.deckIndex];
+        int taken = 0, k = 0;
+        for (int i = 0; i < left; i++) {
+            if (k < draw && pick[k] == i) {
+                d[k++] = rest[i];
+            } else {
+                d[draw + taken++] = rest[i];
+            }
+        }
+
+        StepResult r;
+        gameStep(&child, action, &r);
+        OddsBounds b = oddsValue(&child, depth - 1, search);
+        sum.lo += b.lo;
+        sum.hi += b.hi;
+        outcomes++;
+
+        // 下一個組合（字典順序）
+        int i = draw - 1;
+        while (i >= 0 && pick[i] == left - draw + i) i--;
+        if (i < 0) break;
+        pick[i]++;
+        for (int j = i + 1; j < draw; j++) pick[j] = pick[j - 1] + 1;
+    }
+    sum.lo /= outcomes;
+    sum.hi /= outcomes;
+    return sum;
+}
+
+/* 列出這個局面可以做的動作，draw[i] = 這個動作會從牌堆抽幾張 */
+static int oddsActions(const GameState *game, GameAction actions[], int draw[]) {
+    int n = 0;
+    if (game->phase == PHASE_BOOST_PICK) {
+        for (int pick = 0; pick < 3; pick++) {
+            for (int r = 0; r < HAND_SIZE; r++) {
+                actions[n].type = ACT_BOOST_PICK;
+                actions[n].arg = (unsigned char)(pick << 3 | r);
+                draw[n++] = 0;
+            }
+        }
+        actions[n].type = ACT_SKIP;
+        actions[n].arg = 0;
+        draw[n++] = 0;
+        return n;
+    }
+
+    int count;
+    const PlayOption *opts = currentPlays(game, &count);
+    for (int i = 0; i < count; i++) {
+        actions[n].type = ACT_PLAY;
+        actions[n].arg = opts[i].slots;
+        draw[n++] = opts[i].count;
+    }
+    if (game->hasDrawBoost && !game->drawBoostUsed && game->deckIndex + 3 <= NUM_CARDS) {
+        actions[n].type = ACT_DRAW_BOOST;
+        actions[n].arg = 0;
+        draw[n++] = 3;
+    }
+    if (game->hasRedraw && !game->redrawUsedThisLevel && game->deckIndex + HAND_SIZE <= NUM_CARDS) {
+        actions[n].type = ACT_REDRAW;
+        actions[n].arg = 0;
+        draw[n++] = HAND_SIZE;
+    }
+    return n;
+}
+
+#define MAX_ODDS_ACTIONS (NUM_CANDIDATE_PLAYS + 2 + 3 * HAND_SIZE + 1)
+
+static OddsBounds oddsAction(const GameState *game, GameAction action, int draw, int depth, OddsSearch *search) {
+    if (draw > 0) return oddsChance(game, action, draw, depth, search);
+    // 不用抽牌的決定（Draw Boost 選牌）：同一層繼續往下
+    GameState child = *game;
+    StepResult r;
+    gameStep(&child, action, &r);
+    return oddsValue(&child, depth, search);
+}
+
+static OddsBounds oddsValue(const GameState *game, int depth, OddsSearch *search) {
+    OddsBounds sure = { 1.0, 1.0 }, lost = { 0.0, 0.0 }, unknown = { 0.0, 1.0 };
+
+    if (game->phase != PHASE_TURN && game->phase != PHASE_BOOST_PICK) {
+        return game->score >= game->target ? sure : lost;
+    }
+    if (game->phase == PHASE_TURN && oddsSureClear(game)) return sure;
+
+    unsigned long long key = oddsKey(game);
+    OddsBounds b;
+    if (oddsLookup(key, depth, &b)) {
+        search->hits++;
+        return b;
+    }
+    if (depth <= 0) return unknown;
+    if (oddsOutOfTime(search)) return unknown;
+    search->nodes++;
+
+    GameAction actions[MAX_ODDS_ACTIONS];
+    int draw[MAX_ODDS_ACTIONS];
+    int n = oddsActions(game, actions, draw);
+
+    OddsBounds best = lost;
+    for (int a = 0; a < n && best.lo < 1.0; a++) {
+        OddsBounds v = oddsAction(game, actions[a], draw[a], depth, search);
+        if (v.lo > best.lo) best.lo = v.lo;
+        if (v.hi > best.hi) best.hi = v.hi;
+    }
+    if (!search->timedOut) oddsStore(key, depth, best);
+    return best;
+}
+
+/* ---- 第一層的動作分給多條執行緒 ---- */
+
+typedef struct {
+    const GameState *root;
+    const GameAction *actions;
+    const int *draw;
+    int numActions;
+    int depth;
+    _Atomic int *next;          // 下一個還沒人算的動作
+    OddsBounds *values;         // 每個動作的結果
+    OddsSearch search;
+} OddsWorker;
+
+static void *oddsWorkerMain(void *arg) {
+    OddsWorker *wk = arg;
+    int a;
+    while ((a = atomic_fetch_add(wk->next, 1)) < wk->numActions) {
+        wk->values[a] = oddsAction(wk->root, wk->actions[a], wk->draw[a], wk->depth, &wk->search);
+    }
+    return NULL;
+}
+
+void oddsDefaultConfig(OddsConfig *cfg) {
+    cfg->timeBudget = 1.0;
+    cfg->threads = 1;
+    cfg->maxDepth = 0;
+}
+
+int clearOdds(const GameState *game, const OddsConfig *cfg, OddsResult *out) {
+    double start = nowSeconds();
+    memset(out, 0, sizeof(*out));
+    out->hi = 1.0;
+    pthread_once(&oddsTableOnce, oddsTableAlloc);
+
+    if (game->phase != PHASE_TURN && game->phase != PHASE_BOOST_PICK) {
+        out->lo = out->hi = game->score >= game->target ? 1.0 : 0.0;
+        out->exact = 1;
+        return 1;
+    }
+    if (game->phase == PHASE_TURN && oddsSureClear(game)) {
+        out->lo = 1.0;
+        out->exact = 1;
+        return 1;
+    }
+
+    GameAction actions[MAX_ODDS_ACTIONS];
+    int draw[MAX_ODDS_ACTIONS];
+    int n = oddsActions(game, actions, draw);
+    int threads = cfg->threads < 1 ? 1 : cfg->threads;
+    OddsWorker *workers = calloc((size_t)threads, sizeof(OddsWorker));
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (workers == NULL || tids == NULL) {
+        free(workers);
+        free(tids);
+        return 0;
+    }
+
+    // 一層一層加深，時間到就停在目前夾出來的上下界
+    int maxDepth = cfg->maxDepth > 0 ? cfg->maxDepth : NUM_CARDS;
+    for (int depth = 1; depth <= maxDepth; depth++) {
+        OddsBounds values[MAX_ODDS_ACTIONS];
+        _Atomic int next = 0;
+        for (int t = 0; t < threads; t++) {
+            workers[t].root = game;
+            workers[t].actions = actions;
+            workers[t].draw = draw;
+            workers[t].numActions = n;
+            workers[t].depth = depth;
+            workers[t].next = &next;
+            workers[t].values = values;
+            memset(&workers[t].search, 0, sizeof(OddsSearch));
+            workers[t].search.deadline = start + cfg->timeBudget;
+        }
+
+        int started = 1;
+        for (int t = 1; t < threads; t++) {
+            if (pthread_create(&tids[t], NULL, oddsWorkerMain, &workers[t]) != 0) break;
+            started++;
+        }
+        oddsWorkerMain(&workers[0]);
+        for (int t = 1; t < started; t++) {
+            pthread_join(tids[t], NULL);
+        }
+
+        OddsBounds best = { 0.0, 0.0 };
+        int timedOut = 0;
+        for (int a = 0; a < n; a++) {
+            if (values[a].lo > best.lo) best.lo = values[a].lo;
+            if (values[a].hi > best.hi) best.hi = values[a].hi;
+        }
+        for (int t = 0; t < threads; t++) {
+            out->nodes += workers[t].search.nodes;
+            out->cacheHits += workers[t].search.hits;
+            timedOut |= workers[t].search.timedOut;
+        }
+
+        // 每一輪的結果都是真正機率的上下界，取交集
+        if (best.lo > out->lo) out->lo = best.lo;
+        if (best.hi < out->hi) out->hi = best.hi;
+        out->depth = depth;
+        if (out->lo >= out->hi || timedOut) break;
+    }
+    free(workers);
+    free(tids);
+
+    if (out->lo >= out->hi) {
+        out->hi = out->lo;
+        out->exact = 1;
+        oddsStore(oddsKey(game), ODDS_EXACT_DEPTH, (OddsBounds){ out->lo, out->hi });
+    }
+    out->elapsed = nowSeconds() - start;
+    return 1;
+}
+
+void printOddsHint(const GameState *game, double budget) {
+    TRACE_SCOPE(TRACE_HINT);
+    OddsConfig cfg;
+    oddsDefaultConfig(&cfg);
+    cfg.timeBudget = budget;
+
+    OddsResult res;
+    if (!clearOdds(game, &cfg, &res)) return;
+
+    if (res.exact) {
+        printf("%s最佳打法的過關機率：%.2f%%%s\n", C_CYAN, 100.0 * res.lo, C_RESET);
+    } else {
+        printf("%s最佳打法的過關機率：%.2f%% ~ %.2f%%%s\n", C_CYAN, 100.0 * res.lo, 100.0 * res.hi, C_RESET);
+    }
+}
+
+int runOddsBench(long positions, const OddsConfig *cfg, unsigned long long seed) {
+    GameState game;
+    initGame(&game);
+
+    long exact = 0, nodes = 0, hits = 0, followHits = 0;
+    double elapsed = 0.0, worst = 0.0, width = 0.0, followElapsed = 0.0;
+    for (long p = 0; p < positions; p++) {
+        // 用貪婪策略打到這一關的一半，再從那裡開始算
+        newGame(&game, seed, (unsigned long long)p);
+        game.hasRedraw = (p % 2 == 0);
+        game.hasDrawBoost = (p % 3 == 0);
+        while (game.phase == PHASE_TURN && game.deckIndex < NUM_CARDS / 2) {
+            playSlots(&game, bestSlots(&game));
+        }
+        if (game.phase != PHASE_TURN) {
+            p--;
+            seed++;
+            continue;
+        }
+
+        OddsResult res;
+        clearOdds(&game, cfg, &res);
+        exact += res.exact;
+        nodes += res.nodes;
+        hits += res.cacheHits;
+        width += res.hi - res.lo;
+        elapsed += res.elapsed;
+        if (res.elapsed > worst) worst = res.elapsed;
+
+        // 再出一手，看表裡留下來的子問題能省多少
+        playSlots(&game, bestSlots(&game));
+        if (game.phase == PHASE_TURN) {
+            clearOdds(&game, cfg, &res);
+            followHits += res.cacheHits;
+            followElapsed += res.elapsed;
+        }
+    }
+
+    printf("=== 過關機率（%d 條執行緒，每個局面最多 %.0f ms）===\n", cfg->threads, cfg->timeBudget * 1000);
+    printf("局面數：%ld  |  精確值：%ld 個  |  平均區間寬度 %.4f\n",
+           positions, exact, positions ? width / positions : 0.0);
+    printf("平均每個局面 %.1f ms，最久 %.1f ms，展開 %.0f 個局面，查表命中 %.0f 次\n",
+           positions ? elapsed / positions * 1000 : 0.0, worst * 1000,
+           positions ? (double)nodes / positions : 0.0, positions ? (double)hits / positions : 0.0);
+    printf("下一手再算：平均 %.1f ms，查表命中 %.0f 次\n",
+           positions ? followElapsed / positions * 1000 : 0.0, positions ? (double)followHits / positions : 0.0);
+
+    freeGame(&game);
+    return 0;
+}
+
+/* ====== 洗牌驗證 ====== */
+
+int checkShuffle(unsigned long long seed) {
+    enum { DECKS = 1 << 14, ROUNDS = 16 };
+    unsigned char (*batch)[NUM_CARDS] = malloc(sizeof(*batch) * DECKS);
+    Rng *streams = malloc(sizeof(Rng) * DECKS);
+    if (batch == NULL || streams == NULL) {
+        printf("記憶體配置失敗！\n");
+        return 1;
+    }
+
+    // 每一局第 1~5 關的牌堆各一個亂數流
+    for (int d = 0; d < DECKS; d++) {
+        Rng gameRng;
+        rngForGame(&gameRng, seed, (unsigned long long)(d / NUM_LEVELS));
+        streams[d] = deckStream(&gameRng, d % NUM_LEVELS + 1);
+    }
+
+    // 1) 正確性：批次洗牌必須和 startLevel 用的 shuffleDeck 一模一樣
+    shuffleDeckBatch(batch, streams, DECKS);
+    long mismatches = 0;
+    for (int d = 0; d < DECKS; d++) {
+        Card deck[NUM_CARDS];
+        Rng r = streams[d];
+        initDeck(deck);
+        shuffleDeck(deck, &r);
+        for (int c = 0; c < NUM_CARDS; c++) {
+            if (cardIndex(&deck[c]) != batch[d][c]) {
+                mismatches++;
+                break;
+            }
+        }
+    }
+    printf("比對 %d 副牌，批次洗牌和單副洗牌不一致 %ld 副。\n", DECKS, mismatches);
+
+    // 2) 速度：原本的 rand() 版、計數器式單副、計數器式批次
+    Card deck[NUM_CARDS];
+    double start = nowSeconds();
+    srand((unsigned int)seed);
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int d = 0; d < DECKS; d++) {
+            initDeck(deck);
+            for (int i = NUM_CARDS - 1; i > 0; i--) {
+                int j = rand() % (i + 1);
+                Card temp = deck[i];
+                deck[i] = deck[j];
+                deck[j] = temp;
+            }
+        }
+    }
+    double legacy = nowSeconds() - start;
+
+    start = nowSeconds();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int d = 0; d < DECKS; d++) {
+            Rng r = streams[d];
+            initDeck(deck);
+            shuffleDeck(deck, &r);
+        }
+    }
+    double single = nowSeconds() - start;
+
+    start = nowSeconds();
+    for (int round = 0; round < ROUNDS; round++) {
+        shuffleDeckBatch(batch, streams, DECKS);
+    }
+    double batched = nowSeconds() - start;
+
+    double total = (double)DECKS * ROUNDS;
+    printf("原本 rand() %% (i+1)：%.2f M decks/sec\n", total / legacy / 1e6);
+    printf("計數器式 shuffleDeck：%.2f M decks/sec\n", total / single / 1e6);
+    printf("批次 shuffleDeckBatch：%.2f M decks/sec\n", total / batched / 1e6);
+
+    free(batch);
+    free(streams);
+    return mismatches == 0 ? 0 : 1;
+}
+
+/* ====== 音效引擎 ====== */
+
+static const char *const soundPaths[NUM_SOUNDS] = {
+    "sounds/出牌成功.mp3",
+    "sounds/出牌失敗.mp3",
+    "sounds/遊戲成功.mp3",
+    "sounds/遊戲最後一關成功.mp3",
+    "sounds/遊戲失敗.mp3",
+    "sounds/combo.mp3",
+};
+
+/* 啟動時讀進記憶體的音效檔 */
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    double duration;   // 秒
+} SoundClip;
+
+static SoundClip soundClips[NUM_SOUNDS];
+
+/* 從第一個 MP3 frame 的檔頭算 bitrate，再用檔案大小估長度（CBR） */
+static double mp3Duration(const unsigned char *d, size_t n) {
+    static const int kbpsMpeg1[16] = {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0};
+    static const int kbpsMpeg2[16] = {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0};
+    size_t pos = 0;
+
+    // 跳過 ID3v2 標籤（長度是 4 個 7-bit 的 synchsafe 整數）
+    if (n >= 10 && memcmp(d, "ID3", 3) == 0) {
+        pos = 10 + ((size_t)(d[6] & 0x7F) << 21 | (size_t)(d[7] & 0x7F) << 14 |
+                    (size_t)(d[8] & 0x7F) << 7  | (size_t)(d[9] & 0x7F));
+    }
+    while (pos + 4 <= n && !(d[pos] == 0xFF && (d[pos + 1] & 0xE0) == 0xE0)) pos++;
+    if (pos + 4 > n) return 0.0;
+
+    int version = (d[pos + 1] >> 3) & 3;   // 3 = MPEG-1
+    int layer   = (d[pos + 1] >> 1) & 3;   // 1 = Layer III
+    int brIndex = d[pos + 2] >> 4;
+    if (layer != 1) return 0.0;
+
+    int kbps = (version == 3) ? kbpsMpeg1[brIndex] : kbpsMpeg2[brIndex];
+    if (kbps == 0) return 0.0;
+    return (double)(n - pos) * 8.0 / (kbps * 1000.0);
+}
+
+static void loadSoundClips(void) {
+    for (int i = 0; i < NUM_SOUNDS; i++) {
+        SoundClip *clip = &soundClips[i];
+        FILE *fp = fopen(soundPaths[i], "rb");
+        if (fp == NULL) continue;   // 沒有音效檔就安靜地略過
+
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        if (size > 0 && (clip->data = malloc((size_t)size)) != NULL) {
+            clip->size = fread(clip->data, 1, (size_t)size, fp);
+            clip->duration = mp3Duration(clip->data, clip->size);
+        }
+        fclose(fp);
+    }
+}
+
+double soundDuration(SoundId id) {
+    return soundClips[id].duration;
+}
+
+/*
+ * 播放後端：全部都在音效執行緒上被呼叫
+ * now = 從 audioInit 開始經過的秒數
+ */
+typedef struct {
+    const char *name;
+    int  (*open)(const char *arg);
+    void (*play)(SoundId id, double now);
+    void (*stop)(double now);
+    void (*close)(double now);
+} AudioBackend;
+
+/* ---- null：什麼都不做 ---- */
+
+static int nullOpen(const char *arg) { (void)arg; return 1; }
+static void nullPlay(SoundId id, double now) { (void)id; (void)now; }
+static void nullStop(double now) { (void)now; }
+
+static const AudioBackend nullBackend = { "null", nullOpen, nullPlay, nullStop, nullStop };
+
+/* ---- afplay：直接 posix_spawn，不經過 shell，也不用 killall ---- */
+
+extern char **environ;
+static pid_t afplayPid = 0;
+
+static void afplayStop(double now) {
+    (void)now;
+    if (afplayPid > 0) {
+        kill(afplayPid, SIGTERM);
+        waitpid(afplayPid, NULL, 0);
+        afplayPid = 0;
+    }
+}
+
+static void afplayPlay(SoundId id, double now) {
+    afplayStop(now);   // 先停掉上一個正在播的
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+
+    char *args[] = { "afplay", (char *)soundPaths[id], NULL };
+    if (posix_spawnp(&afplayPid, "afplay", &actions, NULL, args, environ) != 0) {
+        afplayPid = 0;
+    }
+    posix_spawn_file_actions_destroy(&actions);
+}
+
+static const AudioBackend afplayBackend = { "afplay", nullOpen, afplayPlay, afplayStop, afplayStop };
+
+/*
+ * ---- wav：把音效時間軸寫成 WAV 檔 ----
+ * 沒有 MP3 解碼器，所以每個音效用一段不同音高的提示音代替（長度 = MP3 長度），
+ * 新的音效一來就切掉舊的，和 afplay 的行為一樣，可以在沒有喇叭的機器上檢查節奏。
+ */
+#define WAV_RATE 8000
+
+static FILE *wavFile = NULL;
+static long wavSamples = 0;        // 已經寫了幾個 sample
+static int wavCurrent = -1;        // 正在「播」的音效（-1 = 沒有）
+static long wavCurrentStart = 0;   // 它從第幾個 sample 開始
+
+static const double wavToneHz[NUM_SOUNDS] = { 660.0, 220.0, 880.0, 1046.5, 165.0, 990.0 };
+
+static void wavWriteHeader(long samples) {
+    unsigned char h[44];
+    unsigned int dataBytes = (unsigned int)(samples * 2);
+    unsigned int fields[] = { 36 + dataBytes, 16, WAV_RATE, WAV_RATE * 2, dataBytes };
+    memcpy(h, "RIFF", 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    memcpy(h + 36, "data", 4);
+    for (int i = 0; i < 4; i++) {
+        h[4 + i]  = (unsigned char)(fields[0] >> (8 * i));
+        h[16 + i] = (unsigned char)(fields[1] >> (8 * i));
+        h[24 + i] = (unsigned char)(fields[2] >> (8 * i));
+        h[28 + i] = (unsigned char)(fields[3] >> (8 * i));
+        h[40 + i] = (unsigned char)(fields[4] >> (8 * i));
+    }
+    h[20] = 1;  h[21] = 0;    // PCM
+    h[22] = 1;  h[23] = 0;    // 單聲道
+    h[32] = 2;  h[33] = 0;    // 每個 sample 2 bytes
+    h[34] = 16; h[35] = 0;    // 16-bit
+    fseek(wavFile, 0, SEEK_SET);
+    fwrite(h, 1, sizeof(h), wavFile);
+    fseek(wavFile, 0, SEEK_END);
+}
+
+/* 把時間軸寫到第 until 個 sample（目前的音效播完就補靜音） */
+static void wavRenderUntil(long until) {
+    short buf[1024];
+    while (wavSamples < until) {
+        int n = 0;
+        while (n < 1024 && wavSamples < until) {
+            double v = 0.0;
+            if (wavCurrent >= 0) {
+                double len = soundClips[wavCurrent].duration > 0 ? soundClips[wavCurrent].duration : 0.3;
+                double t = (double)(wavSamples - wavCurrentStart) / WAV_RATE;
+                if (t < len) {
+                    double env = 1.0 - t / len;   // 慢慢變小聲
+                    v = 0.3 * env * sin(2.0 * M_PI * wavToneHz[wavCurrent] * t);
+                }
+            }
+            buf[n++] = (short)(v * 32767);
+            wavSamples++;
+        }
+        fwrite(buf, sizeof(short), (size_t)n, wavFile);
+    }
+}
+
+static int wavOpen(const char *arg) {
+    wavFile = fopen(arg, "wb");
+    if (wavFile == NULL) return 0;
+    wavSamples = 0;
+    wavCurrent = -1;
+    wavWriteHeader(0);
+    return 1;
+}
+
+static void wavPlay(SoundId id, double now) {
+    wavRenderUntil((long)(now * WAV_RATE));   // 舊的音效播到現在為止（被切掉）
+    wavCurrent = id;
+    wavCurrentStart = wavSamples;
+}
+
+static void wavStop(double now) {
+    wavRenderUntil((long)(now * WAV_RATE));
+    wavCurrent = -1;
+}
+
+static void wavClose(double now) {
+    (void)now;
+    if (wavCurrent >= 0) {
+        // 最後一個音效完整寫完
+        double len = soundClips[wavCurrent].duration > 0 ? soundClips[wavCurrent].duration : 0.3;
+        wavRenderUntil(wavCurrentStart + (long)(len * WAV_RATE));
+    }
+    wavWriteHeader(wavSamples);
+    fclose(wavFile);
+    wavFile = NULL;
+}
+
+static const AudioBackend wavBackend = { "wav", wavOpen, wavPlay, wavStop, wavClose };
+
+/*
+ * ---- 單一生產者 / 單一消費者的無鎖佇列 ----
+ * 遊戲執行緒只寫 head、音效執行緒只寫 tail；
+ * 丟完之後往 pipe 寫一個 byte 叫醒音效執行緒（pipe 是非阻塞的，滿了就算了）
+ */
+#define AUDIO_QUEUE_SIZE 64
+#define AUDIO_CMD_QUIT   0xFF
+
+static struct {
+    _Atomic unsigned int head;
+    _Atomic unsigned int tail;
+    unsigned char items[AUDIO_QUEUE_SIZE];
+} audioQueue;
+
+static const AudioBackend *audioBackend = NULL;
+static int audioDoorbell[2] = { -1, -1 };
+static pthread_t audioThread;
+static int audioRunning = 0;
+static double audioEpoch = 0.0;
+
+static void audioPush(unsigned char cmd) {
+    unsigned int head = atomic_load_explicit(&audioQueue.head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&audioQueue.tail, memory_order_acquire);
+    if (head - tail >= AUDIO_QUEUE_SIZE) return;   // 滿了：丟掉這個音效，不等
+
+    audioQueue.items[head % AUDIO_QUEUE_SIZE] = cmd;
+    atomic_store_explicit(&audioQueue.head, head + 1, memory_order_release);
+
+    char bell = 1;
+    ssize_t ignored = write(audioDoorbell[1], &bell, 1);
+    (void)ignored;
+}
+
+static void *audioThreadMain(void *arg) {
+    (void)arg;
+    TRACE_THREAD_NAME("audio");
+    struct pollfd pfd = { audioDoorbell[0], POLLIN, 0 };
+
+    while (1) {
+        poll(&pfd, 1, -1);
+        char drain[64];
+        while (read(audioDoorbell[0], drain, sizeof(drain)) > 0) {}
+
+        unsigned int tail = atomic_load_explicit(&audioQueue.tail, memory_order_relaxed);
+        unsigned int head = atomic_load_explicit(&audioQueue.head, memory_order_acquire);
+        for (; tail != head; tail++) {
+            unsigned char cmd = audioQueue.items[tail % AUDIO_QUEUE_SIZE];
+            atomic_store_explicit(&audioQueue.tail, tail + 1, memory_order_release);
+
+            double now = nowSeconds() - audioEpoch;
+            if (cmd == AUDIO_CMD_QUIT) {
+                audioBackend->close(now);
+                return NULL;
+            }
+            TRACE_SCOPE(TRACE_AUDIO);
+            TRACE_COUNT(TRACE_SOUNDS, 1);
+            audioBackend->play((SoundId)cmd, now);   // 後端自己負責切掉舊的
+        }
+    }
+}
+
+int audioInit(const char *spec) {
+    if (audioRunning) return 1;
+
+    const char *arg = NULL;
+    if (spec == NULL) {
+#ifdef __APPLE__
+        audioBackend = &afplayBackend;
+#else
+        audioBackend = &nullBackend;
+#endif
+    } else if (strcmp(spec, "afplay") == 0) {
+        audioBackend = &afplayBackend;
+    } else if (strcmp(spec, "null") == 0) {
+        audioBackend = &nullBackend;
+    } else if (strncmp(spec, "wav:", 4) == 0 && spec[4] != '\0') {
+        audioBackend = &wavBackend;
+        arg = spec + 4;
+    } else {
+        return 0;
+    }
+
+    loadSoundClips();
+    if (!audioBackend->open(arg)) {
+        audioBackend = &nullBackend;
+    }
+
+    if (pipe(audioDoorbell) != 0) return 1;   // 沒有 pipe 就不出聲
+    fcntl(audioDoorbell[0], F_SETFL, O_NONBLOCK);
+    fcntl(audioDoorbell[1], F_SETFL, O_NONBLOCK);
+
+    audioEpoch = nowSeconds();
+    if (pthread_create(&audioThread, NULL, audioThreadMain, NULL) == 0) {
+        audioRunning = 1;
+    }
+    return 1;
+}
+
+void playSound(SoundId id) {
+    if (audioRunning) audioPush((unsigned char)id);
+}
+
+void audioShutdown(void) {
+    if (!audioRunning) return;
+    audioPush(AUDIO_CMD_QUIT);
+    pthread_join(audioThread, NULL);
+    audioRunning = 0;
+
+    close(audioDoorbell[0]);
+    close(audioDoorbell[1]);
+    for (int i = 0; i < NUM_SOUNDS; i++) {
+        free(soundClips[i].data);
+        soundClips[i].data = NULL;
+    }
+}
+
+/* ====== 畫面緩衝區 ====== */
+
+/* 一格：一個字（UTF-8，最多 4 bytes）＋屬性；寬字的右半格 len = 0 */
+typedef struct {
+    char ch[4];
+    unsigned char len;
+    unsigned char attr;
+} Cell;
+
+typedef struct {
+    int rows;                                   // 這一塊畫面有幾行
+    int shownRows;                              // 上一次 flush 出去的行數
+    Cell cells[FRAME_MAX_ROWS][FRAME_MAX_COLS]; // 正在畫的畫面
+    Cell shown[FRAME_MAX_ROWS][FRAME_MAX_COLS]; // 上一次 flush 後終端機上的畫面
+    int fd;
+    char out[FRAME_MAX_ROWS * FRAME_MAX_COLS * 16];
+    size_t outLen;
+    long bytesWritten;
+} Frame;
+
+static Frame mainScreen = { .fd = STDOUT_FILENO };
+static _Thread_local Frame *screen = &mainScreen;   // 伺服器的 worker 各自換成自己的一塊
+
+static const Cell blankCell = { " ", 1, FG_DEFAULT };
+
+/* 終端機上的寬度：中日韓文字與全形符號佔 2 格，框線、花色符號佔 1 格 */
+static int glyphWidth(unsigned int cp) {
+    if (cp >= 0x1100 && cp <= 0x115F) return 2;
+    if (cp >= 0x2E80 && cp <= 0xA4CF) return 2;
+    if (cp >= 0xAC00 && cp <= 0xD7A3) return 2;
+    if (cp >= 0xF900 && cp <= 0xFAFF) return 2;
+    if (cp >= 0xFE30 && cp <= 0xFE4F) return 2;
+    if (cp >= 0xFF00 && cp <= 0xFF60) return 2;
+    if (cp >= 0xFFE0 && cp <= 0xFFE6) return 2;
+    return 1;
+}
+
+void frameSetOutput(int fd) {
+    screen->fd = fd;
+}
+
+int frameUseThreadBuffer(void) {
+    Frame *own = calloc(1, sizeof(Frame));
+    if (!own) return 0;
+    own->fd = -1;
+    screen = own;
+    return 1;
+}
+
+void frameReleaseThreadBuffer(void) {
+    if (screen == &mainScreen) return;
+    free(screen);
+    screen = &mainScreen;
+}
+
+const char *frameOutput(size_t *len) {
+    *len = screen->outLen;
+    return screen->out;
+}
+
+long frameBytesWritten(void) {
+    return screen->bytesWritten;
+}
+
+void frameBegin(int rows) {
+    if (rows > FRAME_MAX_ROWS) rows = FRAME_MAX_ROWS;
+    screen->rows = rows;
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < FRAME_MAX_COLS; c++) screen->cells[r][c] = blankCell;
+    }
+}
+
+int framePutText(int row, int col, int attr, const char *text) {
+    const unsigned char *p = (const unsigned char *)text;
+    if (row < 0 || row >= screen->rows) return col;
+
+    while (*p) {
+        int len = (*p >= 0xF0) ? 4 : (*p >= 0xE0) ? 3 : (*p >= 0xC0) ? 2 : 1;
+        unsigned int cp = (len == 1) ? *p : (unsigned int)(*p & (0x3F >> (len - 1)));
+        for (int i = 1; i < len; i++) {
+            if (!p[i]) return col;              // 字串被截斷
+            cp = (cp << 6) | (p[i] & 0x3F);
+        }
+
+        int w = glyphWidth(cp);
+        if (col + w > FRAME_MAX_COLS) break;
+
+        Cell *cell = &screen->cells[row][col];
+        memcpy(cell->ch, p, (size_t)len);
+        cell->len = (unsigned char)len;
+        cell->attr = (unsigned char)attr;
+        if (w == 2) {
+            cell[1].len = 0;                    // 右半格：跟著左半格一起輸出
+            cell[1].attr = (unsigned char)attr;
+        }
+        col += w;
+        p += len;
+    }
+    return col;
+}
+
+int framePrintf(int row, int col, int attr, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    return framePutText(row, col, attr, buf);
+}
+
+static void frameEmit(const char *s, size_t n) {
+    if (screen->outLen + n > sizeof(screen->out)) return;   // 不會發生：out 已經留了最壞情況的大小
+    memcpy(screen->out + screen->outLen, s, n);
+    screen->outLen += n;
+}
+
+static void frameEmitf(const char *fmt, int v) {
+    char buf[16];
+    int n = snprintf(buf, sizeof(buf), fmt, v);
+    frameEmit(buf, (size_t)n);
+}
+
+/* 從 from 的顏色切換到 to；只有拿掉粗體或回到預設前景色才要整個重設 */
+static void frameEmitAttr(int from, int to) {
+    static const char *const fg[] = { "", C_RED, C_GREEN, C_YELLOW, C_MAG, C_CYAN };
+    if ((from & ~to & ATTR_BOLD) ||
+        ((to & 0x0F) == FG_DEFAULT && (from & 0x0F) != FG_DEFAULT)) {
+        frameEmit(C_RESET, strlen(C_RESET));
+        from = FG_DEFAULT;
+    }
+    if (to & ~from & ATTR_BOLD) frameEmit(C_BOLD, strlen(C_BOLD));
+    if ((to & 0x0F) != (from & 0x0F)) frameEmit(fg[to & 0x0F], strlen(fg[to & 0x0F]));
+}
+
+/* 輸出第 r 行的 [from, to) 格；呼叫前游標要在 from 上 */
+static void frameEmitRun(int r, int from, int to, int *curAttr) {
+    for (int c = from; c < to; c++) {
+        const Cell *cell = &screen->cells[r][c];
+        if (cell->len == 0) continue;           // 寬字右半格
+        if (cell->attr != *curAttr) {
+            frameEmitAttr(*curAttr, cell->attr);
+            *curAttr = cell->attr;
+        }
+        frameEmit(cell->ch, cell->len);
+    }
+}
+
+static int cellSame(const Cell *a, const Cell *b) {
+    return a->len == b->len && a->attr == b->attr && memcmp(a->ch, b->ch, a->len) == 0;
+}
+
+/* 一行最後一個不是預設空白的格子 + 1 */
+static int rowUsedCols(int r) {
+    int c = FRAME_MAX_COLS;
+    while (c > 0 && cellSame(&screen->cells[r][c - 1], &blankCell)) c--;
+    return c;
+}
+
+void frameFlush(int inPlace) {
+    int curAttr = FG_DEFAULT;
+    screen->outLen = 0;
+
+    if (!inPlace || screen->shownRows != screen->rows) {
+        // 整塊印在游標下面
+        for (int r = 0; r < screen->rows; r++) {
+            frameEmitRun(r, 0, rowUsedCols(r), &curAttr);
+            if (curAttr != FG_DEFAULT) {
+                frameEmit(C_RESET, strlen(C_RESET));
+                curAttr = FG_DEFAULT;
+            }
+            frameEmit("\n", 1);
+        }
+    } else {
+        // 游標在上一塊的下一行開頭：往回走，只補有變的格子
+        int curRow = screen->rows;
+        for (int r = 0; r < screen->rows; r++) {
+            int c = 0;
+            while (c < FRAME_MAX_COLS) {
+                if (cellSame(&screen->cells[r][c], &screen->shown[r][c])) { c++; continue; }
+
+                int from = c;
+                while (c < FRAME_MAX_COLS && !cellSame(&screen->cells[r][c], &screen->shown[r][c])) c++;
+                if (from > 0 && screen->cells[r][from].len == 0) from--;            // 從寬字左半開始
+                if (c < FRAME_MAX_COLS && screen->cells[r][c].len == 0) c++;        // 包住寬字右半
+
+                if (curRow > r) frameEmitf("\033[%dA", curRow - r);
+                else if (curRow < r) frameEmitf("\033[%dB", r - curRow);
+                frameEmit("\r", 1);
+                if (from > 0) frameEmitf("\033[%dC", from);
+                curRow = r;
+
+                frameEmitRun(r, from, c, &curAttr);
+            }
+        }
+        if (curAttr != FG_DEFAULT) frameEmit(C_RESET, strlen(C_RESET));
+        if (curRow < screen->rows) frameEmitf("\033[%dB", screen->rows - curRow);
+        frameEmit("\r", 1);
+    }
+
+    memcpy(screen->shown, screen->cells, sizeof(screen->cells[0]) * (size_t)screen->rows);
+    screen->shownRows = screen->rows;
+
+    if (screen->fd < 0) return;   // 留在 out 裡，呼叫的人用 frameOutput 拿
+
+    // stdio 裡還沒印出去的提示要先送，畫面順序才不會亂
+    fflush(stdout);
+    size_t done = 0;
+    while (done < screen->outLen) {
+        ssize_t n = write(screen->fd, screen->out + done, screen->outLen - done);
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    screen->bytesWritten += (long)done;
+    TRACE_COUNT(TRACE_FRAME_BYTES, (long)done);
+}
+
+/* ====== 終端機按鍵輸入 ====== */
+
+static int termMode = -1;              // -1 = 還沒判斷，0 = 一行一行讀，1 = 按鍵
+static struct termios termSaved;
+static int termRaw = 0;
+static struct sigaction termOldInt, termOldTerm, termOldHup;
+
+int termInteractive(void) {
+    if (termMode < 0) termMode = isatty(STDIN_FILENO) && isatty(STDOUT_FILENO);
+    return termMode;
+}
+
+void termForceLineInput(void) {
+    termMode = 0;
+}
+
+/* raw mode 中被中斷：先把終端機設定還原，再用原本的處理方式結束 */
+static void termOnSignal(int sig) {
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &termSaved);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void termRawBegin(void) {
+    if (termRaw || tcgetattr(STDIN_FILENO, &termSaved) != 0) return;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = termOnSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &termOldInt);
+    sigaction(SIGTERM, &sa, &termOldTerm);
+    sigaction(SIGHUP, &sa, &termOldHup);
+
+    struct termios raw = termSaved;
+    raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO);   // ISIG 留著：Ctrl-C 還是有效
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);   // 已經按下去的鍵留著（打字快的人不會掉鍵）
+    termRaw = 1;
+}
+
+void termRawEnd(void) {
+    if (!termRaw) return;
+    tcsetattr(STDIN_FILENO, TCSANOW, &termSaved);
+    sigaction(SIGINT, &termOldInt, NULL);
+    sigaction(SIGTERM, &termOldTerm, NULL);
+    sigaction(SIGHUP, &termOldHup, NULL);
+    termRaw = 0;
+}
+
+/* 等 stdin 有東西讀，最多 timeoutMs（< 0 = 一直等）；被訊號打斷就重等 */
+static int termWait(int timeoutMs) {
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+    int r;
+    while ((r = poll(&pfd, 1, timeoutMs)) < 0 && errno == EINTR) {}
+    return r > 0;
+}
+
+static int termReadByte(int timeoutMs) {
+    unsigned char c;
+    if (!termWait(timeoutMs)) return KEY_NONE;
+    return read(STDIN_FILENO, &c, 1) == 1 ? c : KEY_EOF;
+}
+
+int termReadKey(int timeoutMs) {
+    TRACE_SCOPE(TRACE_INPUT);
+    int c = termReadByte(timeoutMs);
+    if (c == '\r') return KEY_ENTER;
+    if (c == 8) return KEY_BACKSPACE;
+    if (c != KEY_ESC) return c;
+
+    // 方向鍵是 ESC [ A~D（有些終端機是 ESC O A~D）；後面一小段時間沒東西就是單純的 Esc
+    int c1 = termReadByte(30);
+    if (c1 != '[' && c1 != 'O') return KEY_ESC;
+    switch (termReadByte(30)) {
+        case 'A': return KEY_UP;
+        case 'B': return KEY_DOWN;
+        case 'C': return KEY_RIGHT;
+        case 'D': return KEY_LEFT;
+        default:  return KEY_ESC;
+    }
+}
+
+/* ====== 計時器 ====== */
+
+/*
+ * hashed timer wheel：時間切成 10 ms 一格，事件掛在「到期那一格 % 格數」的串列上
+ * 比一圈還久的事件留在串列裡，輪到那一格時比對 tick 還沒到就跳過
+ * 主迴圈每次醒來只走過期的那幾格，不用每次掃全部事件
+ */
+#define TIMER_SLOTS 64
+#define TIMER_TICK  0.010
+#define TIMER_MAX   32
+
+enum { TIMER_FREE = 0, TIMER_PENDING, TIMER_CANCELLED };
+
+typedef struct {
+    double due;        // 到期時間（nowSeconds）
+    long tick;         // 到期的格子編號（絕對值，不取餘數）
+    TimerFn fn;
+    void *ctx;
+    int value;
+    int next;          // 同一格的下一個事件（-1 = 沒有）
+    int state;
+    unsigned gen;      // 每次重用加一，舊的 id 取消不到新事件
+} Timer;
+
+static Timer timerPool[TIMER_MAX];
+static int timerSlot[TIMER_SLOTS];
+static int timerReady = 0;
+static double timerEpoch;
+static long timerTick;           // 已經處理到哪一格
+static int timerCount = 0;       // 還沒觸發的事件數（含已取消、還沒從串列拿掉的）
+static double timeScaleValue = 1.0;
+
+void timeSetScale(double scale) {
+    timeScaleValue = scale > 0 ? scale : 0;
+}
+
+double timeScale(void) {
+    return timeScaleValue;
+}
+
+static long timerTickOf(double t) {
+    return (long)floor((t - timerEpoch) / TIMER_TICK);
+}
+
+static void timerInit(void) {
+    for (int i = 0; i < TIMER_SLOTS; i++) timerSlot[i] = -1;
+    timerEpoch = nowSeconds();
+    timerTick = 0;
+    timerReady = 1;
+}
+
+int timerAfter(double seconds, TimerFn fn, void *ctx, int value) {
+    double delay = timeScaleValue > 0 ? seconds / timeScaleValue : 0;
+    if (delay <= 0) {
+        fn(ctx, value);
+        return -1;
+    }
+    if (!timerReady) timerInit();
+
+    int idx = 0;
+    while (idx < TIMER_MAX && timerPool[idx].state != TIMER_FREE) idx++;
+    if (idx == TIMER_MAX) return -1;
+
+    Timer *t = &timerPool[idx];
+    t->due = nowSeconds() + delay;
+    t->tick = timerTickOf(t->due) + 1;   // 整格走完才算到期，不會早觸發
+    if (t->tick <= timerTick) t->tick = timerTick + 1;
+    t->fn = fn;
+    t->ctx = ctx;
+    t->value = value;
+    t->state = TIMER_PENDING;
+    t->gen++;
+
+    int slot = (int)(t->tick % TIMER_SLOTS);
+    t->next = timerSlot[slot];
+    timerSlot[slot] = idx;
+    timerCount++;
+    return (int)((t->gen & 0x7fffff) << 8) | idx;
+}
+
+void timerCancel(int id) {
+    if (id < 0) return;
+    Timer *t = &timerPool[id & 0xff];
+    if (t->state == TIMER_PENDING && (t->gen & 0x7fffff) == ((unsigned)id >> 8)) {
+        t->state = TIMER_CANCELLED;   // 輪到它那一格時再從串列拿掉
+    }
+}
+
+static int timerIsPending(int id) {
+    Timer *t = &timerPool[id & 0xff];
+    return t->state == TIMER_PENDING && (t->gen & 0x7fffff) == ((unsigned)id >> 8);
+}
+
+/* 處理第 k 格：到期的觸發、取消的拿掉；fn 裡面排新的事件也安全（新事件一定在 k 之後） */
+static void timerFireSlot(long k) {
+    int *link = &timerSlot[k % TIMER_SLOTS];
+    while (*link >= 0) {
+        Timer *t = &timerPool[*link];
+        if (t->state == TIMER_PENDING && t->tick > k) {   // 還要再轉幾圈
+            link = &t->next;
+            continue;
+        }
+        *link = t->next;
+        timerCount--;
+        int fire = t->state == TIMER_PENDING;
+        TimerFn fn = t->fn;
+        void *ctx = t->ctx;
+        int value = t->value;
+        t->state = TIMER_FREE;
+        if (fire) fn(ctx, value);
+    }
+}
+
+/* 把時間推進到現在：走過從上次到現在的每一格 */
+static void timerAdvance(void) {
+    long now = timerTickOf(nowSeconds());
+    // 很久沒推進（例如一直在等輸入）：超過一圈的部分每格都已經看過一次，直接跳到最後一圈
+    if (now - timerTick > TIMER_SLOTS) timerTick = now - TIMER_SLOTS;
+    while (timerTick < now) {
+        timerTick++;
+        timerFireSlot(timerTick);
+    }
+}
+
+/* 跳過：把還沒到期的事件照到期順序全部觸發 */
+static void timerFlush(void) {
+    while (timerCount > 0) {
+        long k = -1;
+        for (int i = 0; i < TIMER_MAX; i++) {
+            if (timerPool[i].state != TIMER_FREE && (k < 0 || timerPool[i].tick < k)) k = timerPool[i].tick;
+        }
+        if (k < 0) break;
+        timerTick = k;
+        timerFireSlot(k);
+    }
+}
+
+/* 離最近的事件還有多少毫秒（無條件進位；沒有事件 = -1） */
+static int timerNextTimeout(void) {
+    double next = -1;
+    for (int i = 0; i < TIMER_MAX; i++) {
+        if (timerPool[i].state != TIMER_PENDING) continue;
+        double due = timerEpoch + timerPool[i].tick * TIMER_TICK;
+        if (next < 0 || due < next) next = due;
+    }
+    if (next < 0) return -1;
+    double ms = (next - nowSeconds()) * 1000.0;
+    return ms <= 0 ? 0 : (int)ceil(ms);
+}
+
+void timerRunUntil(int id, int skippable) {
+    if (!timerReady) return;
+    int keys = skippable && termInteractive();
+    if (keys) termRawBegin();
+
+    while (1) {
+        timerAdvance();
+        if (id >= 0 ? !timerIsPending(id) : timerCount == 0) break;
+
+        int timeout = timerNextTimeout();
+        if (keys) {
+            if (termWait(timeout)) {
+                termReadKey(0);   // 按鍵只用來跳過，吃掉不留給下一個輸入
+                timerFlush();
+                break;
+            }
+        } else {
+            while (poll(NULL, 0, timeout) < 0 && errno == EINTR) {}
+        }
+    }
+
+    if (keys) termRawEnd();
+}
+
+static void timerWake(void *ctx, int value) {
+    (void)ctx;
+    (void)value;
+}
+
+void waitFor(double seconds) {
+    TRACE_SCOPE(TRACE_SLEEP);
+    int id = timerAfter(seconds, timerWake, NULL, 0);
+    if (id >= 0) {
+        timerRunUntil(id, 1);
+    } else if (timerReady) {
+        timerAdvance();   // 倍率 0：不等，但已經到期的事件照樣觸發
+    }
+}
+
+static void timerPlaySound(void *ctx, int value) {
+    (void)ctx;
+    playSound((SoundId)value);
+}
+
+void cueSound(SoundId id, double delay) {
+    timerAfter(delay, timerPlaySound, NULL, (int)id);
+}
+
+/* ====== 遊戲流程 ====== */
+
+/* 按鍵選牌畫面下方的提示（GameFlow.notice 存的是 index，存檔裡不放指標） */
+enum { NOTICE_NONE, NOTICE_EMPTY, NOTICE_INVALID, NOTICE_TOO_MANY };
+
+static const char *const flowNotices[] = {
+    NULL,
+    "先選要出的牌",
+    "這不是合法的牌型，換幾張再出",
+    "最多只能出 5 張",
+};
+
+#define FLOW_FILE_MAGIC   0x4c464743u   // "CGFL"
+#define FLOW_FILE_VERSION 1u
+
+static void flowSelectedArray(const GameFlow *f, int selected[HAND_SIZE]) {
+    for (int i = 0; i < HAND_SIZE; i++) selected[i] = (f->selected >> i) & 1;
+}
+
+/* 停 tenths 個 0.1 秒，之後從 next 繼續 */
+static void flowPause(GameFlow *f, int tenths, FlowState next) {
+    f->state = (unsigned char)next;
+    f->pause = (unsigned char)tenths;
+    f->wait = FLOW_WAIT_PAUSE;
+}
+
+/* 進入一個等輸入的狀態並印出它的提問（輸入錯誤要重問時也走這裡） */
+static void flowAsk(GameFlow *f, FlowState state) {
+    const GameState *game = &f->game;
+    f->state = (unsigned char)state;
+    f->wait = FLOW_WAIT_INT;
+
+    switch (state) {
+    case FLOW_SUIT_PICK:
+        printf("請輸入要改花色的牌的 index（0 ~ %d）：", HAND_SIZE - 1);
+        break;
+    case FLOW_SUIT_NEW:
+        printf("輸入花色編號：");
+        break;
+    case FLOW_REDRAW_ASK:
+    case FLOW_BOOST_ASK:
+        printf("是否要使用？(1 = 使用, 0 = 不使用)：");
+        break;
+    case FLOW_BOOST_PICK:
+        printf("請選擇你要留下的牌（輸入 0~2）：");
+        break;
+    case FLOW_BOOST_REPLACE:
+        printf("請選擇要被替換掉的手牌 index（0 ~ %d）：", HAND_SIZE - 1);
+        break;
+    case FLOW_PICK: {
+        int selected[HAND_SIZE];
+        flowSelectedArray(f, selected);
+        drawHandPicker(game, selected, f->cursor, flowNotices[f->notice]);
+        frameFlush(0);
+        f->wait = FLOW_WAIT_KEY;
+        break;
+    }
+    case FLOW_PLAY_COUNT:
+        printf("你想出幾張牌？(可出 1 / 2 / 5，輸入 0 結束回合): ");
+        break;
+    case FLOW_PLAY_INDEX:
+        printf("請輸入第 %d 張要出的牌 index：", f->picked + 1);
+        break;
+    case FLOW_SETTLE:
+        f->wait = FLOW_WAIT_ENTER;   // 「按 Enter 繼續」由 waitEnter 印
+        break;
+    case FLOW_MAGIC:
+        printf("請輸入 1 或 2：");
+        break;
+    case FLOW_SHOP:
+        printf("\n你目前 %sGold：%d%s\n", C_YELLOW, game->gold, C_RESET);
+        printf("你可以選擇購買：\n");
+        printf(" [1] Draw Boost（%d Gold）\n", COST_DRAW);
+        printf("     效果：下一次回合可抽 3 選 1，替換手牌一次（每關最多一次、不能囤多張）\n\n");
+
+        printf(" [2] Card Multiplier（%d Gold）\n", COST_MULTI);
+        printf("     效果：隨機強化一個 rank，之後出牌含該 rank → 該手分數 x1.5（永久）\n\n");
+
+        printf(" [3] Redraw（%d Gold）\n", COST_REDRAW);
+        printf("     效果：本關可重抽整手牌一次（每關最多一次、不能囤多張）\n\n");
+
+        printf(" [0] 離開商店\n\n");
+        printf("請輸入 0 / 1 / 2 / 3：");
+        break;
+    case FLOW_REPLAY_ASK:
+        printf("\n要再玩一次嗎？(1 = 再玩一次, 0 = 離開)：");
+        break;
+    default:
+        f->wait = FLOW_WAIT_DONE;   // 不是等輸入的狀態：存檔壞了才會到這裡
+        break;
+    }
+}
+
+/* 選要改花色的那張之後：亮黃框的手牌和 4 個花色 */
+static void flowShowSuitChoice(const GameFlow *f) {
+    int selected[HAND_SIZE] = {0};
+    selected[f->arg] = 1;
+    printHandBoxedSelected(f->game.hand, selected);
+    printf("\n請選擇新的花色（輸入 0~3）：\n");
+    printSuitOptionsBoxed(-1);
+}
+
+static void flowShowMagic(const GameFlow *f) {
+    printf("\n=== ChooseMagicCard（免費二選一）===\n");
+    printf("請從以下兩張 Basic Magic Card 選一張（免費）：\n");
+    printf(" [1] Hand Score Upgrade\n");
+    printf("     效果：之後所有關卡 Pair 額外 +%d 分（永久累積）\n\n", peekMagicBonus(&f->game));
+
+    printf(" [2] Suit Change\n");
+    printf("     效果：下一關開始時，可把起手牌其中一張改花色一次\n\n");
+}
+
+static void flowSuitCancel(GameFlow *f) {
+    StepResult r;
+    GameAction cancel = { ACT_SKIP, 0 };
+    printf("輸入錯誤，Suit Change 魔法作廢。\n");
+    gameStep(&f->game, cancel, &r);
+    logEvent(EV_SUIT_CANCEL, 0);
+    f->state = FLOW_LEVEL_INTRO;
+}
+
+static void flowBoostCancel(GameFlow *f) {
+    StepResult r;
+    GameAction cancel = { ACT_SKIP, 0 };
+    printf("輸入錯誤，Draw Boost 取消。\n");
+    gameStep(&f->game, cancel, &r);
+    logEvent(EV_DRAW_BOOST_CANCEL, 0);
+    f->state = FLOW_PLAY_START;
+}
+
+/* 不用等輸入的狀態一路跑下去，直到要等輸入、停頓或結束 */
+static void flowRun(GameFlow *f) {
+    GameState *game = &f->game;
+    StepResult r;
+
+    while (f->wait == FLOW_WAIT_NONE) {
+        switch (f->state) {
+        case FLOW_GAME_START:
+            // 這一局的亂數只看 種子 + 局號，回報問題時附上就能重現
+            newGame(game, f->seed, f->gameNo);
+            logGameStart(f->gameNo);
+            printf("本局種子：%llu，第 %llu 局（--seed %llu --game %llu 可重玩這一局）\n\n",
+                   f->seed, f->gameNo, f->seed, f->gameNo);
+            f->state = FLOW_LEVEL_START;
+            break;
+
+        case FLOW_LEVEL_START:
+            logEvent(EV_LEVEL_START, game->level);
+            if (game->phase != PHASE_SUIT_CHANGE) {
+                f->state = FLOW_LEVEL_INTRO;
+                break;
+            }
+            printf("\n=== Suit Change Magic Card ===\n");
+            printf("你可以把手牌中「一張牌」的花色改成你指定的花色。\n");
+            printf("目前你的起手牌是：\n");
+            printHandBoxed(game->hand);
+            flowAsk(f, FLOW_SUIT_PICK);
+            break;
+
+        case FLOW_LEVEL_INTRO:
+            printf("=== 開始第 %d 關 ===\n", game->level);
+            printf("目標分數：%.1f\n", scoreValue(game->target));
+            printf("目前牌堆位置：%d / %d\n\n", game->deckIndex, NUM_CARDS);
+            f->state = FLOW_TURN_START;
+            break;
+
+        case FLOW_TURN_START:
+            printf("\n目前分數：%.1f  |  目前 %sGold：%d%s\n",
+            scoreValue(game->score), C_YELLOW, game->gold, C_RESET);
+            if (game->comboCount > 1) {
+                printf("%s%s當前 Combo：%d 連擊，倍率 x%.2f%s\n", C_MAG, C_BOLD, game->comboCount,
+                       comboPercent(game->comboCount) / 100.0, C_RESET);
+            } else if (game->comboCount == 1) {
+                printf("當前 Combo：1 連擊（尚未加成）\n");
+            } else {
+                printf("當前 Combo：無\n");
+            }
+
+            // 過關或牌堆用完時，引擎會離開出牌回合
+            if (game->phase != PHASE_TURN) {
+                f->state = FLOW_LEVEL_END;
+                break;
+            }
+
+            // 求解器建議和最佳打法的過關機率（--hints 才有）：預算的 1/3 和 2/3
+            if (f->hints) {
+                double budget = f->hints / 100.0;
+                printSolverHint(game, budget / 3);
+                printOddsHint(game, budget * 2 / 3);
+            }
+
+            /* 如果有 Redraw（商店買的），本關可用一次，不扣分 */
+            if (game->hasRedraw && !game->redrawUsedThisLevel) {
+                printf("\n你擁有一張『Redraw』Magic Card。\n");
+                flowAsk(f, FLOW_REDRAW_ASK);
+            } else {
+                f->state = FLOW_BOOST_OFFER;
+            }
+            break;
+
+        case FLOW_BOOST_OFFER:
+            /* 如果有 Draw Boost，問玩家這回合要不要用 */
+            if (game->hasDrawBoost && !game->drawBoostUsed) {
+                printf("\n你擁有一張『Draw Boost』Magic Card。\n");
+                flowAsk(f, FLOW_BOOST_ASK);
+            } else {
+                f->state = FLOW_PLAY_START;
+            }
+            break;
+
+        case FLOW_PLAY_START:
+            // ===== 正常出牌流程 =====
+            f->selected = 0;
+            f->picked = 0;
+            f->cursor = 0;
+            f->notice = NOTICE_NONE;
+            if (f->keys) {
+                termRawBegin();   // 先進 raw mode：畫面還沒印完就按的鍵也不會被回顯
+                printOuts(game);
+                printPlayHint(game);
+                flowAsk(f, FLOW_PICK);
+            } else {
+                // 只印一次手牌（不要每選一張就重印）
+                printHandBoxed(game->hand);
+                printOuts(game);
+                printPlayHint(game);
+                flowAsk(f, FLOW_PLAY_COUNT);
+            }
+            break;
+
+        case FLOW_PLAY: {
+            GameAction play = { f->arg ? ACT_PLAY : ACT_PASS, f->selected };
+            gameStep(game, play, &r);
+            if (!f->arg || !r.ok) {
+                if (f->arg) {
+                    printf("%s這不是合法的牌型，這一回合作廢。%s\n", C_RED, C_RESET);
+                }
+                printf("你這回合沒有成功出牌。\n");
+                logEvent(EV_PLAY_FAIL, 0);
+                cueSound(SOUND_PLAY_FAIL, 0);
+                flowPause(f, 9, FLOW_TURN_START);   // 讓音效播完，和成功音效節奏一致
+                break;
+            }
+            logEvent(EV_PLAY, f->selected);
+            cueSound(SOUND_PLAY_OK, 0);
+            f->play = r.play;
+            f->refillFailed = (unsigned char)r.refillFailed;
+            flowPause(f, 9, FLOW_SETTLE_SHOW);
+            break;
+        }
+
+        case FLOW_SETTLE_SHOW:
+            /* ===== 回合結算面板 ===== */
+            printf("\n");
+            printSettlementPanel(game, &f->play);
+            flowAsk(f, FLOW_SETTLE);
+            break;
+
+        case FLOW_LEVEL_END:
+            if (game->score >= game->target) {
+                printf("%s%s恭喜！你已達成目標分數，通過第 %d 關！%s\n", C_GREEN, C_BOLD, game->level, C_RESET);
+                printf("你在本關總共出了 %d 手牌。\n", game->handsUsed);
+                if (game->level == 5) {
+                    cueSound(SOUND_FINAL_CLEAR, 0);
+                    flowPause(f, 12, FLOW_LEVEL_DONE);
+                } else {
+                    cueSound(SOUND_LEVEL_CLEAR, 0);
+                    flowPause(f, 9, FLOW_LEVEL_DONE);
+                }
+            } else {
+                printf("%s%s牌堆用完了，但分數還沒達到目標，遊戲失敗 QQ%s\n", C_RED, C_BOLD, C_RESET);
+                cueSound(SOUND_LEVEL_FAIL, 0);
+                flowPause(f, 12, FLOW_LEVEL_DONE);
+            }
+            break;
+
+        case FLOW_LEVEL_DONE:
+            logLevelEnd(game);
+            if (game->score < game->target) {
+                // 這一關失敗，結束本輪遊戲
+                printf("遊戲在第 %d 關結束。\n", game->level);
+                flowAsk(f, FLOW_REPLAY_ASK);
+            } else if (game->phase == PHASE_GAME_OVER) {
+                printf("\n恭喜你通過所有關卡！\n");
+                flowAsk(f, FLOW_REPLAY_ASK);
+            } else {
+                // 過關但還沒到第 5 關：免費二選一，然後商店（花 Gold 買），離開後就是下一關
+                printf("\n=== 你已通過第 %d 關 ===\n", game->level);
+                flowShowMagic(f);
+                flowAsk(f, FLOW_MAGIC);
+            }
+            break;
+
+        case FLOW_NEXT_LEVEL:
+            printf("準備進入第 %d 關。\n\n", game->level);
+            f->state = FLOW_LEVEL_START;
+            break;
+
+        case FLOW_EXIT:
+            f->wait = FLOW_WAIT_DONE;
+            break;
+
+        default:
+            flowAsk(f, (FlowState)f->state);   // 等輸入的狀態：再問一次
+            break;
+        }
+    }
+}
+
+void flowBegin(GameFlow *f, unsigned long long seed, unsigned long long gameNo, int keys, int hintMs) {
+    memset(f, 0, sizeof(*f));
+    f->seed = seed;
+    f->gameNo = gameNo;
+    f->keys = (unsigned char)(keys != 0);
+    if (hintMs > 0) f->hints = (unsigned char)(hintMs >= 2550 ? 255 : (hintMs + 9) / 10);
+    f->state = FLOW_GAME_START;
+    flowRun(f);
+}
+
+/* 按鍵選牌：每按一個鍵就更新畫面，合法的牌型才能按 Enter 出 */
+static void flowPickKey(GameFlow *f, int key) {
+    const GameState *game = &f->game;
+    int count = __builtin_popcount(f->selected);
+    int result = -1;
+    int toggle = -1;
+    f->notice = NOTICE_NONE;
+
+    if (key >= '0' && key < '0' + HAND_SIZE) {
+        toggle = f->cursor = (unsigned char)(key - '0');
+    } else if (key == ' ') {
+        toggle = f->cursor;
+    } else if (key == KEY_LEFT) {
+        f->cursor = (unsigned char)((f->cursor + HAND_SIZE - 1) % HAND_SIZE);
+    } else if (key == KEY_RIGHT) {
+        f->cursor = (unsigned char)((f->cursor + 1) % HAND_SIZE);
+    } else if (key == 'c' || key == KEY_BACKSPACE) {
+        f->selected = 0;
+    } else if (key == 'h') {
+        PlayOption opts[NUM_CANDIDATE_PLAYS];
+        enumeratePlays(game, opts);
+        f->selected = 0;
+        for (int k = 0; k < opts[0].count; k++) f->selected |= 1u << opts[0].idx[k];
+    } else if (key == 'q' || key == KEY_EOF) {
+        result = 0;
+    } else if (key == KEY_ENTER) {
+        Card played[HAND_SIZE];
+        int n = 0;
+        for (int i = 0; i < HAND_SIZE; i++) {
+            if (f->selected >> i & 1) played[n++] = game->hand[i];
+        }
+        if (n == 0) f->notice = NOTICE_EMPTY;
+        else if (classifyHand(played, n) == HAND_INVALID) f->notice = NOTICE_INVALID;
+        else result = n;
+    }
+
+    if (toggle >= 0) {
+        if (!(f->selected >> toggle & 1) && count >= 5) f->notice = NOTICE_TOO_MANY;
+        else f->selected ^= 1u << toggle;
+    }
+
+    {
+        TRACE_SCOPE(TRACE_RENDER);
+        int selected[HAND_SIZE];
+        flowSelectedArray(f, selected);
+        drawHandPicker(game, selected, f->cursor, result < 0 ? flowNotices[f->notice] : NULL);
+        frameFlush(1);   // 只重畫有變的格子
+    }
+    if (result < 0) {
+        f->wait = FLOW_WAIT_KEY;   // 繼續選
+        return;
+    }
+    termRawEnd();
+
+    f->arg = (unsigned char)result;
+    if (result == 0) f->selected = 0;
+    f->state = FLOW_PLAY;
+}
+
+/* 輸入張數和 index：輸入錯誤整個回合作廢 */
+static void flowPlayIndex(GameFlow *f, int ok, int idx) {
+    const GameState *game = &f->game;
+    f->state = FLOW_PLAY;
+    if (!ok) {
+        f->arg = 0;
+        return;
+    }
+    if (idx < 0 || idx >= HAND_SIZE) {
+        printf("%s輸入超出範圍，回合作廢。%s\n", C_RED, C_RESET);
+        f->arg = 0;
+        return;
+    }
+    if (f->selected >> idx & 1) {
+        printf("%s這張牌你已經選過了，回合作廢。%s\n", C_RED, C_RESET);
+        f->arg = 0;
+        return;
+    }
+
+    f->selected |= 1u << idx;
+
+    // 不重印整副牌，只給 feedback
+    printf("已選：[%d] ", idx);
+    printCard(&game->hand[idx]);
+    printf("\n");
+
+    printf("目前已選 index：");
+    for (int k = 0; k < HAND_SIZE; k++) {
+        if (f->selected >> k & 1) printf("[%d] ", k);
+    }
+    printf("\n");
+
+    if (++f->picked < f->arg) {
+        flowAsk(f, FLOW_PLAY_INDEX);
+        return;
+    }
+
+    // 最後一次再印高亮確認（印一次就好）
+    int selected[HAND_SIZE];
+    flowSelectedArray(f, selected);
+    printf("\n%s你本回合選到的牌（高亮確認）：%s\n", C_BOLD, C_RESET);
+    printHandBoxedSelected(game->hand, selected);
+}
+
+static void flowMagic(GameFlow *f, int ok, int choice) {
+    TRACE_SCOPE(TRACE_MAGIC);
+    if (!ok) {
+        printf("輸入錯誤，請重試。\n");
+        flowAsk(f, FLOW_MAGIC);
+        return;
+    }
+    if (choice != 1 && choice != 2) {
+        printf("只能選 1 或 2。\n");
+        flowAsk(f, FLOW_MAGIC);
+        return;
+    }
+
+    StepResult r;
+    GameAction act = { ACT_MAGIC, (unsigned char)choice };
+    gameStep(&f->game, act, &r);
+    logEvent(EV_MAGIC, choice);
+
+    if (choice == 1) {
+        printf("\n你選擇了 Hand Score Upgrade！\n");
+        printf("目前累積的 Pair 額外加分總共：+%.1f 分。\n", scoreValue(f->game.pairBonus));
+    } else {
+        printf("\n你選擇了 Suit Change！\n");
+        printf("將在【下一關開始時】對起手牌使用一次。\n");
+    }
+
+    printf("\n=== Shop（花 Gold 購買）===\n");
+    flowAsk(f, FLOW_SHOP);
+}
+
+/* 商店：買成功一次或選 0 就離開（引擎接著開下一關），其他情況再問一次 */
+static void flowShop(GameFlow *f, int ok, int choice) {
+    TRACE_SCOPE(TRACE_SHOP);
+    GameState *game = &f->game;
+    StepResult r;
+
+    if (!ok) {
+        printf("輸入錯誤，請重試。\n");
+        flowAsk(f, FLOW_SHOP);
+        return;
+    }
+    if (choice == 0) {
+        GameAction leave = { ACT_SKIP, 0 };
+        gameStep(game, leave, &r);   // 離開商店 → 引擎開始下一關
+        printf("離開商店。\n");
+        f->state = FLOW_NEXT_LEVEL;
+        return;
+    }
+    if (choice < 0 || choice > 3) {
+        printf("只能輸入 0 / 1 / 2 / 3。\n");
+        flowAsk(f, FLOW_SHOP);
+        return;
+    }
+
+    int cost = (choice == 1) ? COST_DRAW : (choice == 2) ? COST_MULTI : COST_REDRAW;
+    GameAction buy = { ACT_SHOP, (unsigned char)choice };
+    gameStep(game, buy, &r);   // 買成功也會直接進下一關
+
+    if (r.shop == SHOP_ALREADY_OWNED) {
+        if (choice == 1) {
+            printf("\n⚠ 你已經持有尚未使用的 Draw Boost，不能再買一張。\n");
+        } else {
+            printf("\n⚠ 你已經持有一張 Redraw，不能再買。\n");
+        }
+        flowAsk(f, FLOW_SHOP);
+        return;
+    }
+    if (r.shop == SHOP_NO_GOLD) {
+        printf("%s%s\nGold 不足！需要 %d，但你只有 %d。%s\n", C_RED, C_BOLD, cost, game->gold, C_RESET);
+        flowAsk(f, FLOW_SHOP);
+        return;
+    }
+    if (r.shop == SHOP_SOLD_OUT) {
+        printf("\n⚠ 1~13 全都已被強化，無法再買 Card Multiplier。\n");
+        flowAsk(f, FLOW_SHOP);
+        return;
+    }
+    logEvent(EV_SHOP, choice);
+
+    if (choice == 1) {
+        printf("\n購買成功：Draw Boost！剩餘 Gold：%d\n", game->gold);
+    } else if (choice == 2) {
+        printf("\n購買成功：Card Multiplier！剩餘 Gold：%d\n", game->gold);
+        printf("已隨機強化點數：%d（之後出牌含 %d → 該手分數 x1.5）\n", r.shopRank, r.shopRank);
+    } else {
+        printf("\n購買成功：Redraw！剩餘 Gold：%d\n", game->gold);
+    }
+    f->state = FLOW_NEXT_LEVEL;
+}
+
+void flowInput(GameFlow *f, int status, int value) {
+    GameState *game = &f->game;
+    StepResult r;
+    int ok = (status == 1);
+
+    if (f->wait == FLOW_WAIT_DONE) return;
+    f->wait = FLOW_WAIT_NONE;
+    f->pause = 0;
+
+    switch (f->state) {
+    case FLOW_SUIT_PICK: {
+        TRACE_SCOPE(TRACE_MAGIC);
+        if (!ok || value < 0 || value >= HAND_SIZE) {
+            flowSuitCancel(f);
+            break;
+        }
+        // 亮黃框顯示你選到的那張
+        f->arg = (unsigned char)value;
+        printf("\n你選擇要改的牌是：\n");
+        flowShowSuitChoice(f);
+        flowAsk(f, FLOW_SUIT_NEW);
+        break;
+    }
+
+    case FLOW_SUIT_NEW: {
+        TRACE_SCOPE(TRACE_MAGIC);
+        if (!ok || value < 0 || value > 3) {
+            flowSuitCancel(f);
+            break;
+        }
+        // 亮黃框顯示你選到的花色
+        printf("\n你選擇的新花色是：\n");
+        printSuitOptionsBoxed(value);
+
+        int idx = f->arg;
+        int oldSuit = game->hand[idx].suit;
+        GameAction change = { ACT_SUIT_CHANGE, (unsigned char)(idx << 2 | value) };
+        gameStep(game, change, &r);
+        logEvent(EV_SUIT_CHANGE, idx << 2 | value);
+
+        printf("\n已將第 %d 張牌的花色從 ", idx);
+        printf("%s%s%s", suitColor(oldSuit), suitSymbol(oldSuit), C_RESET);
+        printf(" 改成 ");
+        printf("%s%s%s。\n", suitColor(value), suitSymbol(value), C_RESET);
+
+        printf("修改後的手牌：\n");
+        printHandBoxed(game->hand);
+        f->state = FLOW_LEVEL_INTRO;
+        break;
+    }
+
+    case FLOW_REDRAW_ASK:
+        f->state = FLOW_BOOST_OFFER;
+        if (ok && value == 1) {
+            GameAction redraw = { ACT_REDRAW, 0 };
+            if (!gameStep(game, redraw, &r)) {
+                printf("牌堆剩餘牌數不足，無法重抽整手牌。\n");
+            } else {
+                logEvent(EV_REDRAW, 0);
+                printf("已重抽整手牌！新的手牌為：\n");
+                printHandBoxed(game->hand);
+                f->state = FLOW_TURN_START;   // 用新手牌重新考慮
+            }
+        }
+        break;
+
+    case FLOW_BOOST_ASK:
+        f->state = FLOW_PLAY_START;
+        if (ok && value == 1) {
+            TRACE_SCOPE(TRACE_MAGIC);
+            // 牌堆不夠抽 3 張時引擎會拒絕
+            GameAction reveal = { ACT_DRAW_BOOST, 0 };
+            if (!gameStep(game, reveal, &r)) {
+                printf("牌堆剩餘牌數不足，無法使用 Draw Boost。\n");
+                break;
+            }
+            printf("\n=== Draw Boost 發動！===\n");
+            printf("從牌堆抽出 3 張牌：\n");
+            print3CardsBoxed(boostCards(game));
+            flowAsk(f, FLOW_BOOST_PICK);
+        }
+        break;
+
+    case FLOW_BOOST_PICK:
+        if (!ok || value < 0 || value >= 3) {
+            flowBoostCancel(f);
+            break;
+        }
+        f->arg = (unsigned char)value;
+        printf("\n你目前的手牌為：\n");
+        printHandBoxed(game->hand);
+        flowAsk(f, FLOW_BOOST_REPLACE);
+        break;
+
+    case FLOW_BOOST_REPLACE: {
+        if (!ok || value < 0 || value >= HAND_SIZE) {
+            flowBoostCancel(f);
+            break;
+        }
+        printf("你將手牌第 %d 張換成 ", value);
+        printCard(&boostCards(game)[f->arg]);
+        printf("。\n");
+
+        GameAction keep = { ACT_BOOST_PICK, (unsigned char)(f->arg << 3 | value) };
+        gameStep(game, keep, &r);
+        logEvent(EV_DRAW_BOOST, f->arg << 3 | value);
+        f->state = FLOW_PLAY_START;
+        break;
+    }
+
+    case FLOW_PICK:
+        flowPickKey(f, value);
+        break;
+
+    case FLOW_PLAY_COUNT:
+        if (!ok || value <= 0 || value > 5) {
+            f->arg = 0;   // 0 或輸入錯誤：這回合放棄
+            f->state = FLOW_PLAY;
+            break;
+        }
+        f->arg = (unsigned char)value;
+        flowAsk(f, FLOW_PLAY_INDEX);
+        break;
+
+    case FLOW_PLAY_INDEX:
+        flowPlayIndex(f, ok, value);
+        break;
+
+    case FLOW_SETTLE:
+        if (f->refillFailed) {
+            printf("牌堆不夠補新的手牌了！\n");
+        }
+        f->state = FLOW_TURN_START;
+        break;
+
+    case FLOW_MAGIC:
+        flowMagic(f, ok, value);
+        break;
+
+    case FLOW_SHOP:
+        flowShop(f, ok, value);
+        break;
+
+    case FLOW_REPLAY_ASK:
+        if (!ok || value == 0) {
+            printf("謝謝遊玩！\n");
+            f->state = FLOW_EXIT;
+            break;
+        }
+        // ==== 下一輪：newGame 會重設 GameState ====
+        f->gameNo++;
+        f->state = FLOW_GAME_START;
+        break;
+
+    default:
+        break;   // 停頓結束：state 已經是停頓之後要去的地方
+    }
+
+    flowRun(f);
+}
+
+void flowResume(GameFlow *f) {
+    const GameState *game = &f->game;
+    printf("=== 從存檔繼續：種子 %llu，第 %llu 局，第 %d 關 ===\n", f->seed, f->gameNo, game->level);
+    printf("目前分數：%.1f / %.1f  |  目前 %sGold：%d%s\n\n",
+           scoreValue(game->score), scoreValue(game->target), C_YELLOW, game->gold, C_RESET);
+
+    f->wait = FLOW_WAIT_NONE;
+    f->pause = 0;
+    switch (f->state) {
+    case FLOW_PICK:
+    case FLOW_PLAY_COUNT:
+    case FLOW_PLAY_INDEX:
+        // 選到一半的牌不保留，用現在的輸入方式重新選
+        f->state = FLOW_PLAY_START;
+        break;
+    case FLOW_SUIT_PICK:
+    case FLOW_REDRAW_ASK:
+    case FLOW_BOOST_ASK:
+    case FLOW_BOOST_REPLACE:
+        printHandBoxed(game->hand);
+        break;
+    case FLOW_SUIT_NEW:
+        flowShowSuitChoice(f);
+        break;
+    case FLOW_BOOST_PICK:
+        printf("從牌堆抽出 3 張牌：\n");
+        print3CardsBoxed(boostCards(game));
+        break;
+    case FLOW_SETTLE:
+        // 結算面板存檔前已經看過了（waitEnter 在新的 stdin 上會多等一行），直接進下一回合
+        if (f->refillFailed) {
+            printf("牌堆不夠補新的手牌了！\n");
+        }
+        f->state = FLOW_TURN_START;
+        break;
+    case FLOW_MAGIC:
+        flowShowMagic(f);
+        break;
+    default:
+        break;
+    }
+    f->keys = (unsigned char)termInteractive();
+    flowRun(f);
+}
+
+/* ---- 存檔 ---- */
+
+size_t flowSave(const GameFlow *f, unsigned char *buf, size_t size) {
+    unsigned int header[3] = { FLOW_FILE_MAGIC, FLOW_FILE_VERSION, (unsigned int)sizeof(GameFlow) };
+    if (size < FLOW_SAVE_SIZE) return 0;
+    memcpy(buf, header, sizeof(header));
+    memcpy(buf + sizeof(header), f, sizeof(GameFlow));
+    return FLOW_SAVE_SIZE;
+}
 
 /*
- * 印整副手牌（橫向框框）
- * selected[i]=1 → 第 i 張高亮（黃+粗體框線）
+ * 存檔裡的牌會被拿來當陣列 index 和位移量（rankHave[rank]、cardBit）：
+ * 每張牌的點數都要是 1~13（花色是 2-bit 欄位，一定是 0~3），牌堆是 52 張不重複的牌，
+ * deckMask、hash 也要和牌對得上
  */
-void printHandBoxedSelected(const Card *hand, const int selected[HAND_SIZE]){
-    printf("你的手牌：\n");
-    for (int line = 0; line < 5; line++){
-        for (int i = 0; i < HAND_SIZE; i++){
-            int sel = selected ? selected[i] : 0;
-            printCardBoxLineSelected(&hand[i], i, line, sel);
-            printf(" ");
+static int flowCardsValid(const GameState *game) {
+    CardMask seen = 0;
+    CardMask left = 0;
+    for (int i = 0; i < NUM_CARDS; i++) {
+        const Card *c = &game->deck[i];
+        if (c->rank < 1 || c->rank > 13 || maskHas(seen, c)) return 0;
+        seen |= cardBit(c);
+        if (i >= game->deckIndex) left |= cardBit(c);
+    }
+    for (int i = 0; i < HAND_SIZE; i++) {
+        if (game->hand[i].rank < 1 || game->hand[i].rank > 13) return 0;
+    }
+    if (game->deckMask != left || (game->playedMask & ~FULL_DECK_MASK) != 0) return 0;
+    return game->zobrist == zobristFromScratch(game);
+}
+
+int flowLoad(GameFlow *f, const unsigned char *buf, size_t size) {
+    unsigned int header[3];
+    if (size != FLOW_SAVE_SIZE) return 0;
+    memcpy(header, buf, sizeof(header));
+    if (header[0] != FLOW_FILE_MAGIC || header[1] != FLOW_FILE_VERSION || header[2] != sizeof(GameFlow)) {
+        return 0;
+    }
+
+    GameFlow loaded;
+    memcpy(&loaded, buf + sizeof(header), sizeof(loaded));
+    const GameState *game = &loaded.game;
+    // 數字都拿來當 index 用，超出範圍的存檔一律不收
+    if (loaded.state >= FLOW_NUM_STATES || loaded.wait > FLOW_WAIT_DONE ||
+        loaded.arg >= HAND_SIZE || loaded.picked > 5 || loaded.cursor >= HAND_SIZE ||
+        loaded.notice > NOTICE_TOO_MANY || (loaded.selected >> HAND_SIZE) != 0 ||
+        game->level < 1 || game->level > NUM_LEVELS || game->phase > PHASE_GAME_OVER ||
+        game->deckIndex > NUM_CARDS) {
+        return 0;
+    }
+    if ((loaded.state == FLOW_BOOST_PICK || loaded.state == FLOW_BOOST_REPLACE) &&
+        (game->deckIndex < 3 || (loaded.state == FLOW_BOOST_REPLACE && loaded.arg >= 3))) {
+        return 0;   // 翻出來的 3 張要還在牌堆裡
+    }
+    if (!flowCardsValid(game)) return 0;
+    *f = loaded;
+    return 1;
+}
+
+int flowSaveFile(const GameFlow *f, const char *path) {
+    unsigned char buf[FLOW_SAVE_SIZE];
+    size_t n = flowSave(f, buf, sizeof(buf));
+    size_t tmpSize = strlen(path) + sizeof(".tmp");
+    char *tmp = malloc(tmpSize);
+    if (!tmp) return 0;
+    snprintf(tmp, tmpSize, "%s.tmp", path);
+
+    FILE *fp = fopen(tmp, "wb");
+    int ok = fp != NULL;
+    if (fp) {
+        ok = fwrite(buf, 1, n, fp) == n;
+        ok = (fclose(fp) == 0) && ok;
+    }
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    if (!ok) remove(tmp);
+    free(tmp);
+    return ok;
+}
+
+int flowLoadFile(GameFlow *f, const char *path) {
+    unsigned char buf[FLOW_SAVE_SIZE + 1];
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return 0;
+    size_t n = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    return flowLoad(f, buf, n);
+}
+
+/* ---- 驗證 ---- */
+
+#define FLOW_CHECK_MAX_INPUTS 20000   // 一個 session 最多餵幾個輸入（流程卡住時不會無限跑）
+
+/* 腳本輸入：只看 session 自己的亂數和目前的狀態，所以不管怎麼交錯跑，餵進去的東西都一樣 */
+static void flowScriptInput(const GameFlow *f, Rng *rng, int *status, int *value) {
+    const GameState *game = &f->game;
+    *status = 1;
+    *value = 0;
+    if (f->wait != FLOW_WAIT_INT && f->wait != FLOW_WAIT_KEY) return;   // Enter / 停頓
+
+    if (f->wait == FLOW_WAIT_INT && f->state != FLOW_REPLAY_ASK && rngBelow(rng, 20) == 0) {
+        *status = 0;   // 偶爾輸入不是數字
+        return;
+    }
+
+    PlayOption opts[NUM_CANDIDATE_PLAYS];
+    switch (f->state) {
+    case FLOW_SUIT_PICK:
+    case FLOW_BOOST_REPLACE:
+        *value = (int)rngBelow(rng, HAND_SIZE + 1);   // 含一個超出範圍的
+        break;
+    case FLOW_SUIT_NEW:
+        *value = (int)rngBelow(rng, 5);
+        break;
+    case FLOW_REDRAW_ASK:
+    case FLOW_BOOST_ASK:
+        *value = (int)rngBelow(rng, 2);
+        break;
+    case FLOW_BOOST_PICK:
+        *value = (int)rngBelow(rng, 4);
+        break;
+    case FLOW_PLAY_COUNT:
+        enumeratePlays(game, opts);
+        *value = rngBelow(rng, 4) ? opts[0].count : (int)rngBelow(rng, 7);
+        break;
+    case FLOW_PLAY_INDEX:
+        enumeratePlays(game, opts);
+        if (f->arg == opts[0].count && rngBelow(rng, 8)) *value = opts[0].idx[f->picked];
+        else *value = (int)rngBelow(rng, HAND_SIZE + 1);
+        break;
+    case FLOW_PICK: {
+        static const int keys[] = { ' ', KEY_LEFT, KEY_RIGHT, 'c', 'q', KEY_ENTER, KEY_ENTER };
+        unsigned int roll = rngBelow(rng, 16);
+        if (roll < 6) *value = f->selected ? KEY_ENTER : 'h';
+        else if (roll < 9) *value = '0' + (int)rngBelow(rng, HAND_SIZE);
+        else *value = keys[rngBelow(rng, sizeof(keys) / sizeof(keys[0]))];
+        break;
+    }
+    case FLOW_MAGIC:
+        *value = 1 + (int)rngBelow(rng, 3);
+        break;
+    case FLOW_SHOP:
+        *value = (int)rngBelow(rng, 5);
+        break;
+    case FLOW_REPLAY_ASK:
+        *value = rngBelow(rng, 4) == 0;   // 大約四分之一會再玩一局
+        break;
+    default:
+        break;
+    }
+}
+
+/* 每次輸入之後的局面都算進去：流程走的路只要有一步不一樣，結果就會不同 */
+static unsigned long long flowDigest(unsigned long long h, const GameFlow *f) {
+    return mix64(h ^ stateChecksum(&f->game) ^ (unsigned long long)f->state << 32 ^
+                 (unsigned long long)f->selected << 40 ^ (unsigned long long)f->gameNo << 48);
+}
+
+int checkFlow(long sessions, unsigned long long seed) {
+    if (sessions <= 0) sessions = 1;
+
+    // 流程照常印東西：丟到 /dev/null，最後再把 stdout 接回來
+    fflush(stdout);
+    int savedOut = dup(STDOUT_FILENO);
+    int devNull = open("/dev/null", O_WRONLY);
+    if (savedOut < 0 || devNull < 0 || dup2(devNull, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "無法把輸出導到 /dev/null\n");
+        if (savedOut >= 0) close(savedOut);
+        if (devNull >= 0) close(devNull);
+        return 1;
+    }
+    close(devNull);
+
+    unsigned long long *expect = malloc(sizeof(*expect) * (size_t)sessions);
+    unsigned long long *got = malloc(sizeof(*got) * (size_t)sessions);
+    Rng *rngs = malloc(sizeof(*rngs) * (size_t)sessions);
+    unsigned char *blobs = malloc(FLOW_SAVE_SIZE * (size_t)sessions);
+    if (!expect || !got || !rngs || !blobs) {
+        dup2(savedOut, STDOUT_FILENO);
+        close(savedOut);
+        fprintf(stderr, "記憶體不足\n");
+        free(expect);
+        free(got);
+        free(rngs);
+        free(blobs);
+        return 1;
+    }
+
+    double oldScale = timeScale();
+    timeSetScale(0);
+
+    // 第一次：一個 session 從頭跑到尾（單數號用按鍵選牌，雙數號輸入張數和 index）
+    GameFlow f;
+    long inputs = 0;
+    long stuck = 0;
+    double start = nowSeconds();
+    for (long s = 0; s < sessions; s++) {
+        Rng rng;
+        rngForGame(&rng, seed ^ 0x5eed5eedULL, (unsigned long long)s);
+        flowBegin(&f, seed, (unsigned long long)s, (int)(s & 1), 0);
+        unsigned long long h = flowDigest(0, &f);
+        long n = 0;
+        while (f.wait != FLOW_WAIT_DONE && n < FLOW_CHECK_MAX_INPUTS) {
+            int status, value;
+            flowScriptInput(&f, &rng, &status, &value);
+            flowInput(&f, status, value);
+            h = flowDigest(h, &f);
+            n++;
+        }
+        if (f.wait != FLOW_WAIT_DONE) stuck++;
+        expect[s] = h;
+        inputs += n;
+    }
+    double alone = nowSeconds() - start;
+
+    // 第二次：所有 session 輪流一次一個輸入，中間只留存檔
+    start = nowSeconds();
+    for (long s = 0; s < sessions; s++) {
+        rngForGame(&rngs[s], seed ^ 0x5eed5eedULL, (unsigned long long)s);
+        flowBegin(&f, seed, (unsigned long long)s, (int)(s & 1), 0);
+        got[s] = flowDigest(0, &f);
+        flowSave(&f, blobs + FLOW_SAVE_SIZE * (size_t)s, FLOW_SAVE_SIZE);
+    }
+    long live = sessions;
+    long loadFails = 0;
+    for (long round = 0; live > 0 && round < FLOW_CHECK_MAX_INPUTS; round++) {
+        live = 0;
+        for (long s = 0; s < sessions; s++) {
+            unsigned char *blob = blobs + FLOW_SAVE_SIZE * (size_t)s;
+            if (!flowLoad(&f, blob, FLOW_SAVE_SIZE)) {
+                loadFails++;
+                continue;
+            }
+            if (f.wait == FLOW_WAIT_DONE) continue;
+            int status, value;
+            flowScriptInput(&f, &rngs[s], &status, &value);
+            flowInput(&f, status, value);
+            got[s] = flowDigest(got[s], &f);
+            flowSave(&f, blob, FLOW_SAVE_SIZE);
+            live++;
+        }
+    }
+    double interleaved = nowSeconds() - start;
+
+    termRawEnd();
+    timeSetScale(oldScale);
+    fflush(stdout);
+    dup2(savedOut, STDOUT_FILENO);
+    close(savedOut);
+
+    long diffs = 0;
+    for (long s = 0; s < sessions; s++) {
+        if (expect[s] == got[s]) continue;
+        if (diffs++ < 5) printf("不一致：第 %ld 個 session\n", s);
+    }
+
+    printf("=== 流程驗證（%ld 個 session，種子 %llu）===\n", sessions, seed);
+    printf("輸入：%ld  |  存檔大小：%zu bytes\n", inputs, (size_t)FLOW_SAVE_SIZE);
+    printf("一個一個跑：%.2f 秒（每個輸入 %.1f µs）\n", alone, inputs ? alone * 1e6 / inputs : 0.0);
+    printf("輪流跑 + 每步存讀檔：%.2f 秒（每個輸入 %.1f µs）\n", interleaved,
+           inputs ? interleaved * 1e6 / inputs : 0.0);
+    printf("結果不一致：%ld  |  沒跑完：%ld  |  讀檔失敗：%ld\n", diffs, stuck, loadFails);
+
+    free(expect);
+    free(got);
+    free(rngs);
+    free(blobs);
+    return diffs + stuck + loadFails == 0 ? 0 : 1;
+}
+
+/* ====== 效能追蹤 ====== */
+
+#ifdef GAME_TRACE
+
+#define TRACE_RING_SIZE (1 << 16)   // 每條執行緒留最近幾段（滿了蓋掉最舊的，統計不受影響）
+#define TRACE_MAX_DEPTH 16
+
+typedef struct {
+    unsigned long long start;   // ns（從 traceStart 開始算）
+    unsigned long long dur;     // ns
+    int phase;
+} TraceEvent;
+
+/* 每條執行緒一個，第一次記錄時配置，只有自己寫 */
+typedef struct TraceRing {
+    struct TraceRing *next;                        // 所有執行緒的 ring 串成一條（只有加進來時加鎖）
+    int tid;
+    char name[24];
+    int depth;                                     // 目前巢狀幾層
+    unsigned long long childTime[TRACE_MAX_DEPTH]; // 每一層裡面的子段加起來多久（算 self time）
+    unsigned long long total[NUM_TRACE_PHASES];    // 含子段
+    unsigned long long self[NUM_TRACE_PHASES];     // 扣掉子段
+    unsigned long long maxDur[NUM_TRACE_PHASES];
+    long count[NUM_TRACE_PHASES];
+    long counters[NUM_TRACE_COUNTERS];
+    unsigned long written;                         // 總共記了幾段
+    TraceEvent events[TRACE_RING_SIZE];
+} TraceRing;
+
+static const char *const tracePhaseNames[NUM_TRACE_PHASES] = {
+    "input", "render", "audio", "score", "refill", "shop", "magic", "hint", "sleep",
+};
+
+static const char *const traceCounterNames[NUM_TRACE_COUNTERS] = {
+    "hands", "cardsDrawn", "frameBytes", "sounds",
+};
+
+static _Thread_local TraceRing *traceRing = NULL;
+static TraceRing *traceRings = NULL;
+static int traceThreads = 0;
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static const char *tracePath = NULL;
+static struct timespec traceEpoch;
+
+static unsigned long long traceClock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)(ts.tv_sec - traceEpoch.tv_sec) * 1000000000ULL
+         + (unsigned long long)ts.tv_nsec - (unsigned long long)traceEpoch.tv_nsec;
+}
+
+static TraceRing *traceThreadRing(void) {
+    if (traceRing) return traceRing;
+    TraceRing *ring = calloc(1, sizeof(TraceRing));
+    if (ring == NULL) return NULL;
+    pthread_mutex_lock(&traceLock);
+    ring->tid = ++traceThreads;
+    snprintf(ring->name, sizeof(ring->name), "thread %d", ring->tid);
+    ring->next = traceRings;
+    traceRings = ring;
+    pthread_mutex_unlock(&traceLock);
+    traceRing = ring;
+    return ring;
+}
+
+void traceNameThread(const char *name) {
+    TraceRing *ring = traceThreadRing();
+    if (ring) snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
+
+unsigned long long traceEnter(void) {
+    TraceRing *ring = traceThreadRing();
+    if (ring && ring->depth < TRACE_MAX_DEPTH) ring->childTime[ring->depth] = 0;
+    if (ring) ring->depth++;
+    return traceClock();
+}
+
+void traceLeave(const TraceScope *scope) {
+    unsigned long long end = traceClock();
+    TraceRing *ring = traceRing;
+    if (ring == NULL) return;
+
+    unsigned long long dur = end - scope->start;
+    int d = --ring->depth;
+    unsigned long long inner = d < TRACE_MAX_DEPTH ? ring->childTime[d] : 0;
+    if (d > 0 && d - 1 < TRACE_MAX_DEPTH) ring->childTime[d - 1] += dur;
+
+    ring->total[scope->phase] += dur;
+    ring->self[scope->phase]  += dur > inner ? dur - inner : 0;
+    ring->count[scope->phase]++;
+    if (dur > ring->maxDur[scope->phase]) ring->maxDur[scope->phase] = dur;
+
+    TraceEvent *ev = &ring->events[ring->written++ % TRACE_RING_SIZE];
+    ev->start = scope->start;
+    ev->dur = dur;
+    ev->phase = scope->phase;
+}
+
+void traceCount(TraceCounter counter, long n) {
+    TraceRing *ring = traceThreadRing();
+    if (ring) ring->counters[counter] += n;
+}
+
+/* Chrome trace：每段是一個 "X"（complete）事件，時間單位是 µs */
+static int traceWriteChrome(const char *path, unsigned long long wall) {
+    FILE *fp = fopen(path, "w");
+    if (fp == NULL) return 0;
+
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"cardgame\"}}");
+    long counters[NUM_TRACE_COUNTERS] = {0};
+    for (const TraceRing *ring = traceRings; ring; ring = ring->next) {
+        fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+                ring->tid, ring->name);
+        unsigned long first = ring->written > TRACE_RING_SIZE ? ring->written - TRACE_RING_SIZE : 0;
+        for (unsigned long i = first; i < ring->written; i++) {
+            const TraceEvent *ev = &ring->events[i % TRACE_RING_SIZE];
+            fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"game\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, "
+                        "\"ts\": %.3f, \"dur\": %.3f}",
+                    tracePhaseNames[ev->phase], ring->tid, ev->start / 1000.0, ev->dur / 1000.0);
+        }
+        for (int c = 0; c < NUM_TRACE_COUNTERS; c++) counters[c] += ring->counters[c];
+    }
+    // 計數器在結束時間點記一次總數
+    for (int c = 0; c < NUM_TRACE_COUNTERS; c++) {
+        fprintf(fp, ",\n{\"name\": \"%s\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.3f, \"args\": {\"value\": %ld}}",
+                traceCounterNames[c], wall / 1000.0, counters[c]);
+    }
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0;
+}
+
+/* 結束時（atexit）：寫 trace 檔，印每個階段的統計 */
+static void traceStop(void) {
+    if (!traceEnabled) return;
+    unsigned long long wall = traceClock();
+    traceEnabled = 0;
+
+    unsigned long long total[NUM_TRACE_PHASES] = {0}, self[NUM_TRACE_PHASES] = {0}, maxDur[NUM_TRACE_PHASES] = {0};
+    long count[NUM_TRACE_PHASES] = {0}, counters[NUM_TRACE_COUNTERS] = {0};
+    unsigned long dropped = 0;
+    for (const TraceRing *ring = traceRings; ring; ring = ring->next) {
+        for (int p = 0; p < NUM_TRACE_PHASES; p++) {
+            total[p] += ring->total[p];
+            self[p]  += ring->self[p];
+            count[p] += ring->count[p];
+            if (ring->maxDur[p] > maxDur[p]) maxDur[p] = ring->maxDur[p];
+        }
+        for (int c = 0; c < NUM_TRACE_COUNTERS; c++) counters[c] += ring->counters[c];
+        if (ring->written > TRACE_RING_SIZE) dropped += ring->written - TRACE_RING_SIZE;
+    }
+
+    int saved = traceWriteChrome(tracePath, wall);
+    fprintf(stderr, "\n=== 效能追蹤（%.3f 秒，%d 條執行緒）===\n", wall / 1e9, traceThreads);
+    fprintf(stderr, "%-8s %10s %12s %12s %10s %10s %7s\n",
+            "phase", "count", "total ms", "self ms", "avg us", "max us", "self %");
+    for (int p = 0; p < NUM_TRACE_PHASES; p++) {
+        if (count[p] == 0) continue;
+        fprintf(stderr, "%-8s %10ld %12.3f %12.3f %10.2f %10.2f %6.2f%%\n",
+                tracePhaseNames[p], count[p], total[p] / 1e6, self[p] / 1e6,
+                total[p] / 1e3 / count[p], maxDur[p] / 1e3, wall ? 100.0 * self[p] / wall : 0.0);
+    }
+    for (int c = 0; c < NUM_TRACE_COUNTERS; c++) {
+        fprintf(stderr, "%s%s=%ld", c ? "  " : "", traceCounterNames[c], counters[c]);
+    }
+    fprintf(stderr, "\n");
+    if (dropped) fprintf(stderr, "ring 滿了蓋掉 %lu 段（統計仍然完整，trace 檔只有最近的）\n", dropped);
+    if (saved) fprintf(stderr, "Chrome trace：%s\n", tracePath);
+    else       fprintf(stderr, "無法寫入 trace 檔：%s\n", tracePath);
+    // ring 不放掉：程式要結束了，還沒收掉的執行緒（例如求解器的 worker）可能正在一段裡面
+}
+
+int traceStart(const char *path) {
+    if (traceEnabled) return 1;
+    tracePath = path;
+    clock_gettime(CLOCK_MONOTONIC, &traceEpoch);
+    traceEnabled = 1;
+    traceNameThread("main");
+    atexit(traceStop);
+    return 1;
+}
+
+#else
+
+int traceStart(const char *path) {
+    (void)path;
+    return 0;
+}
+
+#endif
+
+/* ====== 重播紀錄 ====== */
+
+/* 紀錄檔的寫入緩衝區：事件先存在這裡，關卡結束或關檔時才 write */
+static struct {
+    int fd;
+    unsigned char buf[4096];
+    size_t len;
+} replayLog = { .fd = -1 };
+
+static void replayLogFlush(void) {
+    size_t done = 0;
+    while (done < replayLog.len) {
+        ssize_t n = write(replayLog.fd, replayLog.buf + done, replayLog.len - done);
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    replayLog.len = 0;
+}
+
+static void replayLogBytes(const unsigned char *p, size_t n) {
+    if (replayLog.fd < 0) return;
+    if (replayLog.len + n > sizeof(replayLog.buf)) replayLogFlush();
+    memcpy(replayLog.buf + replayLog.len, p, n);
+    replayLog.len += n;
+}
+
+/* little endian 寫入 n bytes */
+static void replayLogUint(unsigned long long v, int n) {
+    unsigned char b[8];
+    for (int i = 0; i < n; i++) b[i] = (unsigned char)(v >> (8 * i));
+    replayLogBytes(b, (size_t)n);
+}
+
+int replayLogOpen(const char *path, unsigned long long seed) {
+    replayLog.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (replayLog.fd < 0) return 0;
+
+    replayLog.len = 0;
+    replayLogBytes((const unsigned char *)REPLAY_MAGIC, 4);
+    replayLogUint(REPLAY_VERSION, 1);
+    replayLogUint(seed, 8);
+    return 1;
+}
+
+void replayLogClose(void) {
+    if (replayLog.fd < 0) return;
+    replayLogFlush();
+    close(replayLog.fd);
+    replayLog.fd = -1;
+}
+
+void logEvent(ReplayOp op, int arg) {
+    if (op == EV_PLAY) {
+        replayLogUint(EV_PLAY | (unsigned int)arg, 1);
+    } else if (op == EV_PLAY_FAIL || op == EV_REDRAW || op == EV_DRAW_BOOST_CANCEL || op == EV_SUIT_CANCEL) {
+        replayLogUint(op, 1);
+    } else {
+        unsigned char b[2] = { (unsigned char)op, (unsigned char)arg };
+        replayLogBytes(b, 2);
+    }
+}
+
+void logGameStart(unsigned long long gameNo) {
+    replayLogUint(EV_GAME_START, 1);
+    replayLogUint(gameNo, 8);
+}
+
+void logLevelEnd(const GameState *game) {
+    if (replayLog.fd < 0) return;
+    replayLogUint(EV_LEVEL_END, 1);
+    replayLogUint(stateChecksum(game), 4);
+    replayLogFlush();   // 每關寫一次，當機也最多只掉一關
+}
+
+unsigned int stateChecksum(const GameState *game) {
+    unsigned long long h = 0x9E3779B97F4A7C15ULL;
+    unsigned long long bits;
+
+    h = mix64(h ^ (unsigned long long)game->level);
+    h = mix64(h ^ game->deckMask);
+    h = mix64(h ^ game->playedMask);
+    h = mix64(h ^ (unsigned long long)game->deckIndex);
+
+    unsigned long long hand = 0;
+    for (int i = 0; i < HAND_SIZE; i++) {
+        hand = hand << 6 | (unsigned long long)cardIndex(&game->hand[i]);
+    }
+    h = mix64(h ^ hand);
+
+    bits = (unsigned long long)(unsigned int)game->score;
+    h = mix64(h ^ bits);
+    bits = (unsigned long long)(unsigned int)game->pairBonus;
+    h = mix64(h ^ bits);
+
+    unsigned long long flags = (unsigned long long)game->gold;
+    flags = flags << 8 | (unsigned long long)game->comboCount;
+    flags = flags << 8 | (unsigned long long)game->handsUsed;
+    flags = flags << 5 | (unsigned long long)(game->hasSuitChange << 4 | game->hasRedraw << 3 |
+                                              game->redrawUsedThisLevel << 2 |
+                                              game->hasDrawBoost << 1 | game->drawBoostUsed);
+    h = mix64(h ^ flags);
+
+    h = mix64(h ^ game->multMask ^ (unsigned long long)game->rng.counter << 32);
+
+    return (unsigned int)(h ^ (h >> 32));
+}
+
+/* 重播統計 */
+typedef struct {
+    long sessions;
+    long games;
+    long levels;
+    long events;
+    long rejected;    // 在目前狀態下不成立的事件（規則改過之後可能發生）
+    long mismatches;  // checksum 對不上的關卡數
+    long unverified;  // 舊版紀錄檔的關卡（checksum 算法不同，沒辦法比對）
+} ReplayStats;
+
+static unsigned long long readUint(const unsigned char *p, int n) {
+    unsigned long long v = 0;
+    for (int i = n - 1; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+/* 把一個動作交給引擎，不成立就記下來 */
+static void replayStep(GameState *game, int type, int arg, ReplayStats *stats) {
+    StepResult r;
+    GameAction action = { (unsigned char)type, (unsigned char)arg };
+    if (!gameStep(game, action, &r)) stats->rejected++;
+}
+
+/* 重播一個 session，回傳用掉的 bytes（0 = 檔案格式錯誤） */
+static size_t replaySession(const unsigned char *p, size_t size, GameState *game, ReplayStats *stats) {
+    if (size < 13 || memcmp(p, REPLAY_MAGIC, 4) != 0 || p[4] < 1 || p[4] > REPLAY_VERSION) {
+        return 0;
+    }
+    int verify = p[4] == REPLAY_VERSION;
+    unsigned long long seed = readUint(p + 5, 8);
+    unsigned long long gameNo = 0;
+    size_t pos = 13;
+    stats->sessions++;
+
+    while (pos < size && p[pos] != REPLAY_MAGIC[0]) {
+        unsigned char op = p[pos++];
+        int arg = 0;
+        stats->events++;
+
+        if (op & EV_PLAY) {
+            replayStep(game, ACT_PLAY, op & 0x7F, stats);
+            continue;
+        }
+
+        // 帶 1 byte 參數的事件
+        if (op == EV_DRAW_BOOST || op == EV_SUIT_CHANGE || op == EV_MAGIC ||
+            op == EV_SHOP || op == EV_LEVEL_START) {
+            if (pos + 1 > size) return 0;
+            arg = p[pos++];
+        }
+
+        switch (op) {
+        case EV_PLAY_FAIL:
+            replayStep(game, ACT_PASS, 0, stats);
+            break;
+        case EV_REDRAW:
+            replayStep(game, ACT_REDRAW, 0, stats);
+            break;
+        case EV_DRAW_BOOST:
+        case EV_DRAW_BOOST_CANCEL:
+            // 先翻 3 張，再選或取消
+            replayStep(game, ACT_DRAW_BOOST, 0, stats);
+            if (game->phase == PHASE_BOOST_PICK) {
+                replayStep(game, op == EV_DRAW_BOOST ? ACT_BOOST_PICK : ACT_SKIP, arg, stats);
+                if (game->phase == PHASE_BOOST_PICK) replayStep(game, ACT_SKIP, 0, stats);
+            }
+            break;
+        case EV_SUIT_CHANGE:
+            replayStep(game, ACT_SUIT_CHANGE, arg, stats);
+            break;
+        case EV_SUIT_CANCEL:
+            replayStep(game, ACT_SKIP, 0, stats);
+            break;
+        case EV_MAGIC:
+            replayStep(game, ACT_MAGIC, arg, stats);
+            break;
+        case EV_SHOP:
+            replayStep(game, ACT_SHOP, arg, stats);
+            break;
+        case EV_LEVEL_START:
+            // 沒買東西就離開商店的話，下一關從這裡開始
+            if (game->phase == PHASE_SHOP) replayStep(game, ACT_SKIP, 0, stats);
+            if (game->level != arg) stats->rejected++;
+            stats->levels++;
+            break;
+        case EV_LEVEL_END: {
+            if (pos + 4 > size) return 0;
+            unsigned int expect = (unsigned int)readUint(p + pos, 4);
+            unsigned int got = stateChecksum(game);
+            pos += 4;
+            if (!verify) {
+                stats->unverified++;
+            } else if (expect != got) {
+                if (stats->mismatches < 10) {
+                    printf("種子 %llu 第 %llu 局第 %d 關：checksum 不符（紀錄 %08x，重播 %08x）\n",
+                           seed, gameNo, game->level, expect, got);
+                }
+                stats->mismatches++;
+            }
+            break;
+        }
+        case EV_GAME_START:
+            if (pos + 8 > size) return 0;
+            gameNo = readUint(p + pos, 8);
+            pos += 8;
+            newGame(game, seed, gameNo);
+            stats->games++;
+            break;
+        default:
+            return 0;   // 不認得的事件碼
         }
-        printf("\n");
     }
+    return pos;
 }
 
-/* 沒有選取狀態時的簡化版（全都不高亮） */
-void printHandBoxed(const Card *hand){
-    int dummy[HAND_SIZE] = {0};
-    printHandBoxedSelected(hand, dummy);
-}
+int runReplay(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "無法開啟紀錄檔：%s\n", path);
+        return 1;
+    }
 
-/* 印 3 張候選卡（橫向框框） */
-void print3CardsBoxed(const Card cards[3]) {
-    for (int line = 0; line < 5; line++) {
-        for (int i = 0; i < 3; i++) {
-            // 這裡 selected 一律 0，代表不高亮
-            printCardBoxLineSelected(&cards[i], i, line, 0);
-            printf(" ");
-        }
-        printf("\n");
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "紀錄檔是空的：%s\n", path);
+        close(fd);
+        return 1;
     }
-}
 
-/* ===== Suit 選擇框框（4個） ===== */
-/* 印單個 suit 選擇框框的某一行（line=0~4）
- * selected=1 → 黃框粗體
- */
-void printSuitBoxLineSelected(int suit, int idx, int line, int selected){
-    const char *sym = suitSymbol(suit);      // 方案A：回傳純符號 "♠"
-    const char *faceCol = suitColor(suit);   // 紅/青
-    const char *boxCol  = selected ? C_YELLOW : C_RESET;
-    const char *boxBold = selected ? C_BOLD   : "";
-
-    if (line == 0) {
-        printf("%s%s┌─────┐%s", boxCol, boxBold, C_RESET);
-    } else if (line == 1) {
-        printf("%s%s│ [%d] │%s", boxCol, boxBold, idx, C_RESET);
-    } else if (line == 2) {
-        // 中間放花色符號
-        printf("%s%s│%s", boxCol, boxBold, C_RESET);
-        printf("  "); // 左邊兩格
-        printf("%s%s%s", faceCol, sym, C_RESET);
-        printf("  "); // 右邊兩格
-        printf("%s%s│%s", boxCol, boxBold, C_RESET);
-    } else if (line == 3) {
-        printf("%s%s│     │%s", boxCol, boxBold, C_RESET);
-    } else { // line == 4
-        printf("%s%s└─────┘%s", boxCol, boxBold, C_RESET);
+    size_t size = (size_t)st.st_size;
+    const unsigned char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "無法讀取紀錄檔：%s\n", path);
+        return 1;
     }
-}
+    madvise((void *)data, size, MADV_SEQUENTIAL);
 
-/* 印 4 個 suit 選項（橫向框框）
- * selectedSuit = -1 表示都不亮；0~3 表示那個亮黃框
- */
-void printSuitOptionsBoxed(int selectedSuit){
-    for(int line = 0; line < 5; line++){
-        for(int s = 0; s < 4; s++){
-            int sel = (s == selectedSuit);
-            printSuitBoxLineSelected(s, s, line, sel);
-            printf(" ");
+    GameState game;
+    initGame(&game);
+    ReplayStats stats = {0};
+    int corrupt = 0;
+
+    double start = nowSeconds();
+    size_t pos = 0;
+    while (pos < size) {
+        size_t used = replaySession(data + pos, size - pos, &game, &stats);
+        if (used == 0) {
+            corrupt = 1;
+            break;
         }
-        printf("\n");
+        pos += used;
+    }
+    double elapsed = nowSeconds() - start;
+
+    printf("重播 %s：%ld 個 session、%ld 局、%ld 關、%ld 個事件（%zu bytes）\n",
+           path, stats.sessions, stats.games, stats.levels, stats.events, size);
+    printf("耗時 %.3f 秒（%.2f M 事件/秒）\n",
+           elapsed, elapsed > 0 ? stats.events / elapsed / 1e6 : 0.0);
+    if (stats.rejected) {
+        printf("%s%ld 個事件在目前規則下不成立%s\n", C_YELLOW, stats.rejected, C_RESET);
+    }
+    if (corrupt) {
+        printf("%s檔案在第 %zu byte 附近格式錯誤，後面沒有重播%s\n", C_RED, pos, C_RESET);
+    }
+    if (stats.unverified) {
+        printf("%s%ld 關來自舊版紀錄檔，沒有比對 checksum%s\n", C_YELLOW, stats.unverified, C_RESET);
     }
+    if (stats.mismatches) {
+        printf("%s%ld 關的 checksum 不符%s\n", C_RED, stats.mismatches, C_RESET);
+    } else if (!corrupt && !stats.unverified) {
+        printf("%s每一關的 checksum 都相符%s\n", C_GREEN, C_RESET);
+    }
+
+    munmap((void *)data, size);
+    freeGame(&game);
+    return (corrupt || stats.mismatches) ? 1 : 0;
 }
 
-void printHand(const Card *hand) {
-    printf("你的手牌：\n");
-    for (int i = 0; i < HAND_SIZE; i++) {
-        printf("[%d] ", i);  // 顯示 index，方便玩家選牌
-        printCard(&hand[i]);
-        printf("\n");
-    }
+/* ====== 遊戲引擎 ====== */
+
+void newGame(GameState *game, unsigned long long seed, unsigned long long gameNo) {
+    resetGameState(game);
+    rngForGame(&game->rng, seed, gameNo);
+    startLevel(game, 1);
 }
 
-/*
- * 玩家出牌
- * 1. 顯示手牌
- * 2. 問玩家要出幾張牌（例如輸入 1, 2, 5...）
- * 3. 一個一個輸入 index，把那幾張牌複製到 played[]
- * 4. 回傳 playedCount
- *
- * 之後我們會在這裡加上：
- * - 判斷這手牌是不是合法牌型
- * - 如果不合法，就請玩家重選
- */
-int playerPlayHand(GameState *game, Card *played, int *playedCount) {
-    int selected[HAND_SIZE] = {0};
+int peekMagicBonus(const GameState *game) {
+    GameState copy;
+    copy.rng = game->rng;
+    return rollMagicBonus(&copy);
+}
 
-    // 只印一次手牌（不要每選一張就重印）
-    printHandBoxedSelected(game->hand, selected);
+/* 出牌回合結束後：過關 / 牌堆用完 */
+static void checkLevelEnd(GameState *game, StepResult *out) {
+    if (game->score >= game->target) {
+        out->levelEnd = 1;
+        game->phase = (game->level >= NUM_LEVELS) ? PHASE_GAME_OVER : PHASE_MAGIC;
+    } else if (game->deckIndex >= NUM_CARDS) {
+        out->levelEnd = -1;
+        game->phase = PHASE_GAME_OVER;
+    }
+    out->done = (game->phase == PHASE_GAME_OVER);
+}
 
-    int count;
-    printf("你想出幾張牌？(可出 1 / 2 / 5，輸入 0 結束回合): ");
-    if (scanf("%d", &count) != 1 || count < 0 || count > 5) {
-        return 0;
+/* 出 slots 這幾張：和互動模式出牌的規則一樣 */
+static int stepPlay(GameState *game, unsigned int slots, StepResult *out) {
+    Card played[HAND_SIZE];
+    int count = 0;
+    for (unsigned int m = slots & ((1u << HAND_SIZE) - 1); m; m &= m - 1) {
+        played[count++] = game->hand[__builtin_ctz(m)];
     }
 
-    if (count == 0) {
-        return 0;
+    {
+        TRACE_SCOPE(TRACE_SCORE);
+        HandType type = count <= 5 ? classifyHand(played, count) : HAND_INVALID;
+        if (type == HAND_INVALID) {
+            game->comboCount = 0;   // 不合法的牌型 → 這回合作廢，連擊中斷
+            return 0;
+        }
+        scoreClassifiedHand(game, type, played, count, &out->play);
     }
+    out->reward = scoreValue(out->play.gain);
+    game->handsUsed++;
+    TRACE_COUNT(TRACE_HANDS, 1);
 
-    int used[HAND_SIZE] = {0};
+    TRACE_SCOPE(TRACE_REFILL);
+    out->refillFailed = !updateHandAfterPlay(game, played, count);
+    return 1;
+}
 
-    for (int i = 0; i < count; i++) {
-        int idx;
-        printf("請輸入第 %d 張要出的牌 index：", i + 1);
-        if (scanf("%d", &idx) != 1) return 0;
+int gameStep(GameState *game, GameAction action, StepResult *out) {
+    memset(out, 0, sizeof(*out));
+    out->ok = 1;
 
-        if (idx < 0 || idx >= HAND_SIZE) {
-            printf("%s輸入超出範圍，回合作廢。%s\n", C_RED, C_RESET);
-            return 0;
+    switch (game->phase) {
+    case PHASE_SUIT_CHANGE:
+        if (action.type == ACT_SUIT_CHANGE && (action.arg >> 2) < HAND_SIZE) {
+            applySuitChange(game, action.arg >> 2, action.arg & 3);
+        } else if (action.type == ACT_SKIP) {
+            game->hasSuitChange = 0;   // 魔法作廢
+        } else {
+            return out->ok = 0;
         }
-        if (used[idx]) {
-            printf("%s這張牌你已經選過了，回合作廢。%s\n", C_RED, C_RESET);
-            return 0;
+        game->phase = PHASE_TURN;
+        return 1;
+
+    case PHASE_TURN:
+        if (action.type == ACT_PLAY) {
+            out->ok = stepPlay(game, action.arg, out);
+        } else if (action.type == ACT_PASS) {
+            game->comboCount = 0;
+        } else if (action.type == ACT_REDRAW) {
+            if (!game->hasRedraw || game->redrawUsedThisLevel || !useRedraw(game)) return out->ok = 0;
+        } else if (action.type == ACT_DRAW_BOOST) {
+            Card revealed[3];   // 之後從 boostCards() 讀，就是牌堆剛抽掉的 3 張
+            if (!game->hasDrawBoost || game->drawBoostUsed || !drawBoostReveal(game, revealed)) {
+                return out->ok = 0;
+            }
+            game->phase = PHASE_BOOST_PICK;
+            return 1;   // 同一回合接著出牌，還不用檢查過關
+        } else {
+            return out->ok = 0;
+        }
+        checkLevelEnd(game, out);
+        return out->ok;
+
+    case PHASE_BOOST_PICK: {
+        int pick = action.arg >> 3, replaceIndex = action.arg & 7;
+        if (action.type == ACT_BOOST_PICK && pick < 3 && replaceIndex < HAND_SIZE) {
+            drawBoostApply(game, &boostCards(game)[pick], replaceIndex);
+        } else if (action.type != ACT_SKIP) {
+            return out->ok = 0;
+        }
+        // 取消的話翻出來的 3 張直接丟掉
+        game->phase = PHASE_TURN;
+        return 1;
+    }
+
+    case PHASE_MAGIC:
+        if (action.type != ACT_MAGIC || (action.arg != 1 && action.arg != 2)) return out->ok = 0;
+        applyMagicChoice(game, action.arg, rollMagicBonus(game));
+        game->phase = PHASE_SHOP;
+        return 1;
+
+    case PHASE_SHOP:
+        if (action.type == ACT_SHOP) {
+            out->shop = shopBuy(game, action.arg, &out->shopRank);
+            if (out->shop != SHOP_OK) return out->ok = 0;
+        } else if (action.type != ACT_SKIP) {
+            return out->ok = 0;
         }
+        // 買成功一次或選擇離開 → 下一關
+        startLevel(game, game->level + 1);
+        return 1;
 
-        used[idx] = 1;
-        selected[idx] = 1;
-        played[i] = game->hand[idx];
+    default:
+        out->done = 1;
+        return out->ok = 0;
+    }
+}
 
-        // 不重印整副牌，只給 feedback
-        printf("已選：[%d] ", idx);
-        printCard(&game->hand[idx]);
-        printf("\n");
+/* ---- 多環境 ---- */
 
-        printf("目前已選 index：");
-        for (int k = 0; k < HAND_SIZE; k++) {
-            if (selected[k]) printf("[%d] ", k);
-        }
-        printf("\n");
+static void envObserve(EnvBatch *b, int i) {
+    const GameState *g = &b->games[i];
+    b->phase[i] = (unsigned char)g->phase;
+    for (int k = 0; k < HAND_SIZE; k++) {
+        b->hand[i][k] = (unsigned char)cardIndex(&g->hand[k]);
     }
+    b->score[i] = (float)scoreValue(g->score);
+    b->target[i] = (float)scoreValue(g->target);
+    b->gold[i] = g->gold;
+    b->combo[i] = (unsigned char)g->comboCount;
+    b->deckLeft[i] = (unsigned char)(NUM_CARDS - g->deckIndex);
+    b->multMask[i] = g->multMask;
+}
 
-    // 最後一次再印高亮確認（印一次就好）
-    printf("\n%s你本回合選到的牌（高亮確認）：%s\n", C_BOLD, C_RESET);
-    printHandBoxedSelected(game->hand, selected);
+/* 把輸出陣列依序排在 base 之後（64 bytes 對齊），回傳總大小；base = NULL 只算大小 */
+static size_t layoutEnvObs(EnvBatch *b, int n, unsigned char *base) {
+    size_t off = 0;
+#define PLACE_OBS(field) \
+    off = (off + 63) & ~(size_t)63; \
+    if (base) b->field = (void *)(base + off); \
+    off += (size_t)n * sizeof(*b->field);
+
+    PLACE_OBS(reward)
+    PLACE_OBS(done)
+    PLACE_OBS(phase)
+    PLACE_OBS(hand)
+    PLACE_OBS(score)
+    PLACE_OBS(target)
+    PLACE_OBS(gold)
+    PLACE_OBS(combo)
+    PLACE_OBS(deckLeft)
+    PLACE_OBS(multMask)
+#undef PLACE_OBS
+    return (off + 63) & ~(size_t)63;
+}
+
+size_t envBatchObsSize(int n) {
+    EnvBatch dummy;
+    return layoutEnvObs(&dummy, n, NULL);
+}
+
+int envBatchInit(EnvBatch *b, int n, unsigned long long seed, void *obsArea) {
+    memset(b, 0, sizeof(*b));
+    b->n = n;
+    b->seed = seed;
+    b->games   = aligned_alloc(64, ((size_t)n * sizeof(*b->games) + 63) & ~(size_t)63);
+    b->episode = calloc((size_t)n, sizeof(*b->episode));
 
-    // 牌型合法性檢查
-    HandType type = classifyHand(played, count);
-    if (type == HAND_INVALID) {
-        printf("%s這不是合法的牌型，這一回合作廢。%s\n", C_RED, C_RESET);
+    b->ownsObs = (obsArea == NULL);
+    b->obsArea = obsArea ? obsArea : calloc(1, envBatchObsSize(n));
+
+    if (!b->games || !b->episode || !b->obsArea) {
+        envBatchFree(b);
         return 0;
     }
-
-    *playedCount = count;
+    layoutEnvObs(b, n, b->obsArea);
+
+    for (int i = 0; i < n; i++) {
+        b->episode[i] = (unsigned long long)i;   // 第 i 個環境從第 i 局開始，之後每次 +n
+        newGame(&b->games[i], seed, b->episode[i]);
+        b->reward[i] = 0.0f;
+        b->done[i] = 0;
+        envObserve(b, i);
+    }
     return 1;
 }
 
-/* 用 rank 對牌做由小到大的排序（非常單純的 bubble sort） */
-void sortByRank(Card *cards, int n) {
-    for (int i = 0; i < n - 1; i++) {
-        for (int j = 0; j < n - 1 - i; j++) {
-            if (cards[j].rank > cards[j + 1].rank) {
-                Card temp = cards[j];
-                cards[j] = cards[j + 1];
-                cards[j + 1] = temp;
-            }
+void envBatchStep(EnvBatch *b, const GameAction *actions) {
+    for (int i = 0; i < b->n; i++) {
+        StepResult r;
+        gameStep(&b->games[i], actions[i], &r);
+        b->reward[i] = (float)r.reward;
+        b->done[i] = (unsigned char)r.done;
+        if (r.done) {
+            b->episode[i] += (unsigned long long)b->n;
+            newGame(&b->games[i], b->seed, b->episode[i]);
         }
+        envObserve(b, i);
     }
 }
 
-/* 檢查是不是同花（花色全部一樣） */
-int isFlush(Card *cards, int n) {
-    for (int i = 1; i < n; i++) {
-        if (cards[i].suit != cards[0].suit) {
-            return 0;   // 有一張花色不同 → 不是同花
+void envBatchFree(EnvBatch *b) {
+    free(b->games);
+    free(b->episode);
+    if (b->ownsObs) free(b->obsArea);
+    memset(b, 0, sizeof(*b));
+}
+
+/* 量速度用的便宜策略：有 Pair 出 Pair，沒有就出第 0 張；其他階段一律略過 / 選 1 */
+static GameAction benchAction(const EnvBatch *b, int i) {
+    GameAction a = { ACT_SKIP, 0 };
+    if (b->phase[i] == PHASE_TURN) {
+        unsigned int seen[14] = {0};
+        a.type = ACT_PLAY;
+        a.arg = 1;
+        for (int k = 0; k < HAND_SIZE; k++) {
+            int r = b->hand[i][k] % 13;
+            if (seen[r]) {
+                a.arg = (unsigned char)(seen[r] | 1u << k);
+                break;
+            }
+            seen[r] = 1u << k;
         }
+    } else if (b->phase[i] == PHASE_MAGIC) {
+        a.type = ACT_MAGIC;
+        a.arg = 1;
     }
-    return 1;
+    return a;
 }
 
-/* 檢查是不是順子（點數連續） */
-int isStraight(Card *cards, int n) {
-    for (int i = 1; i < n; i++) {
-        if (cards[i].rank == cards[i - 1].rank) {
-            return 0;   // 有重複點數就一定不是順子
-        }
-        if (cards[i].rank != cards[i - 1].rank + 1) {
-            return 0;   // 不是「上一張+1」就不是連號
+/* 量速度的迴圈：看觀察值決定動作 → 寫進 actions → step()（回傳 0 = 環境不能用了，提早結束） */
+static double benchRounds(const EnvBatch *obs, GameAction *actions, long rounds,
+                          int (*step)(void *ctx, const GameAction *actions), void *ctx,
+                          long *episodes, double *totalReward) {
+    double start = nowSeconds();
+    for (long t = 0; t < rounds; t++) {
+        for (int i = 0; i < obs->n; i++) actions[i] = benchAction(obs, i);
+        if (!step(ctx, actions)) break;
+        for (int i = 0; i < obs->n; i++) {
+            *episodes += obs->done[i];
+            *totalReward += obs->reward[i];
         }
     }
+    return nowSeconds() - start;
+}
+
+static int stepInProcess(void *ctx, const GameAction *actions) {
+    envBatchStep(ctx, actions);
     return 1;
 }
 
-HandType classifyHand(Card *played, int playedCount) {
-    if (playedCount <= 0) return HAND_INVALID;
+int runStepBench(long steps, int n, unsigned long long seed) {
+    EnvBatch batch;
+    GameAction *actions = malloc((size_t)n * sizeof(GameAction));
+    if (n <= 0 || !actions || !envBatchInit(&batch, n, seed, NULL)) {
+        fprintf(stderr, "記憶體配置失敗！\n");
+        free(actions);
+        return 1;
+    }
 
-    if (playedCount == 1) return HAND_SINGLE;
+    long rounds = (steps + n - 1) / n;
+    long episodes = 0;
+    double totalReward = 0.0;
 
-    // 只支援最多 5 張組成牌型
-    if (playedCount > 5) return HAND_INVALID;
+    double elapsed = benchRounds(&batch, actions, rounds, stepInProcess, &batch, &episodes, &totalReward);
+    long total = rounds * n;
 
-    // 建一份 copy 來操作（避免改到原本的 played[]）
-    Card tmp[5];
-    for (int i = 0; i < playedCount; i++) {
-        tmp[i] = played[i];
-    }
+    printf("=== step 引擎（%d 個環境，種子 %llu）===\n", n, seed);
+    printf("總步數：%ld  |  耗時：%.3f 秒  |  %.2f M steps/sec\n",
+           total, elapsed, elapsed > 0 ? total / elapsed / 1e6 : 0.0);
+    printf("結束的局數：%ld  |  平均每步獎勵：%.3f\n", episodes, total ? totalReward / total : 0.0);
 
-    // 先依照 rank 排序，方便判斷順子與計算
-    sortByRank(tmp, playedCount);
+    free(actions);
+    envBatchFree(&batch);
+    return 0;
+}
 
-    // 統計每個點數出現幾次（rank 1~13）
-    int rankCount[14] = {0};  // 全部先設成 0
+/* ====== 共享記憶體環境 ====== */
 
-    for (int i = 0; i < playedCount; i++) {
-        int r = tmp[i].rank;
-        if (r >= 1 && r <= 13) {
-            rankCount[r]++;
-        }
+#ifdef __linux__
+
+static size_t alignUp64(size_t x) {
+    return (x + 63) & ~(size_t)63;
+}
+
+/* segment 裡各部分的位置 */
+static size_t shmActionsOffset(void) {
+    return alignUp64(sizeof(ShmEnvHeader));
+}
+
+static size_t shmObsOffset(int n) {
+    return alignUp64(shmActionsOffset() + (size_t)n * sizeof(GameAction));
+}
+
+#define SHM_WAIT_CHECK_MS 100    // 等太久時多久看一次對方還在不在
+#define SHM_YIELD_TRIES   64     // 睡進 futex 前最多讓出 CPU 幾次
+#define SHM_ATTACH_TRIES  2000   // 接上時最多等幾個 1 ms（segment 出現、長到夠大、magic 寫好）
+
+/* 另一端的 process 還在嗎（pid <= 0 = 沒登記，只能當它還在） */
+static int shmPeerAlive(int pid) {
+    if (pid <= 0) return 1;
+    if (kill((pid_t)pid, 0) != 0 && errno == ESRCH) return 0;
+
+    // 自己 fork 出來的另一端結束了但還沒被 waitpid：kill 照樣成功，要另外看（WNOWAIT 不會收掉它）
+    siginfo_t info;
+    memset(&info, 0, sizeof(info));
+    if (waitid(P_PID, (id_t)pid, &info, WEXITED | WNOHANG | WNOWAIT) == 0 && info.si_pid == pid) return 0;
+    return 1;
+}
+
+/*
+ * 多核心時先轉一小段（兩邊都醒著的時候不用進 kernel）；再讓出 CPU 幾次：
+ * 單核心時對方就是等著跑的那個 process，讓出去它做完就換回來，省掉一組 futex 的睡 / 叫醒
+ * 都等不到才設 *sleeping 睡進 futex；回傳新的值，*peerPid 那個 process 不在了就回傳 old
+ */
+static unsigned int waitSeqChange(_Atomic unsigned int *seq, _Atomic unsigned int *sleeping,
+                                  unsigned int old, _Atomic int *peerPid) {
+    static int spinLimit = -1;
+    if (spinLimit < 0) spinLimit = (cpuCount() > 1) ? 2000 : 0;
+
+    unsigned int v;
+    for (int spin = 0; spin < spinLimit; spin++) {
+        v = atomic_load_explicit(seq, memory_order_acquire);
+        if (v != old) return v;
+    }
+    for (int tries = 0; tries < SHM_YIELD_TRIES; tries++) {
+        v = atomic_load_explicit(seq, memory_order_acquire);
+        if (v != old) return v;
+        sched_yield();
     }
 
-    int pairs = 0;   // 有幾組「二張」
-    int three = 0;   // 有幾組「三張」
-    int four  = 0;   // 有幾組「四張」
+    // sleeping 和 seq 都用 seq_cst：bumpSeq 不是看到 1 去叫醒，就是 futex 會看到新的 seq 不睡
+    struct timespec timeout = { 0, SHM_WAIT_CHECK_MS * 1000000L };
+    atomic_store(sleeping, 1);
+    while ((v = atomic_load(seq)) == old) {
+        if (syscall(SYS_futex, (unsigned int *)seq, FUTEX_WAIT, old, &timeout, NULL, 0) != 0 &&
+            errno == ETIMEDOUT && !shmPeerAlive(atomic_load(peerPid))) {
+            break;
+        }
+    }
+    atomic_store_explicit(sleeping, 0, memory_order_relaxed);
+    return v;
+}
 
-    for (int r = 1; r <= 13; r++) {
-        if (rankCount[r] == 2) pairs++;
-        else if (rankCount[r] == 3) three++;
-        else if (rankCount[r] == 4) four++;
+static void bumpSeq(_Atomic unsigned int *seq, _Atomic unsigned int *sleeping) {
+    atomic_fetch_add(seq, 1);
+    if (atomic_load(sleeping)) {
+        syscall(SYS_futex, (unsigned int *)seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
     }
+}
 
-    int flush = isFlush(tmp, playedCount);
-    int straight = isStraight(tmp, playedCount);
+/* 被 Ctrl-C / kill 結束時先刪掉 segment（否則會一直留在 /dev/shm），再用原本的處理方式結束 */
+static char shmEnvName[256];
+static struct sigaction shmOldInt, shmOldTerm, shmOldHup;
 
-    /* 根據張數來判斷 */
-    if (playedCount == 2) {
-        if (pairs == 1) return HAND_PAIR;
-        return HAND_INVALID;
+static void shmOnSignal(int sig) {
+    shm_unlink(shmEnvName);
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void shmCatchSignals(const char *name) {
+    snprintf(shmEnvName, sizeof(shmEnvName), "%s", name);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = shmOnSignal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &shmOldInt);
+    sigaction(SIGTERM, &sa, &shmOldTerm);
+    sigaction(SIGHUP, &sa, &shmOldHup);
+}
+
+static void shmRestoreSignals(void) {
+    sigaction(SIGINT, &shmOldInt, NULL);
+    sigaction(SIGTERM, &shmOldTerm, NULL);
+    sigaction(SIGHUP, &shmOldHup, NULL);
+}
+
+int runShmEnv(const char *name, int n, unsigned long long seed) {
+    if (n <= 0) {
+        fprintf(stderr, "環境數量必須大於 0\n");
+        return 1;
+    }
+    if (strlen(name) >= sizeof(shmEnvName)) {
+        fprintf(stderr, "共享記憶體名稱太長：%s\n", name);
+        return 1;
     }
 
-    if (playedCount == 3) {
-        return HAND_INVALID;
+    size_t total = shmObsOffset(n) + envBatchObsSize(n);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "無法建立共享記憶體：%s\n", name);
+        return 1;
+    }
+    shmCatchSignals(name);
+    if (ftruncate(fd, (off_t)total) != 0) {
+        fprintf(stderr, "無法建立共享記憶體：%s\n", name);
+        close(fd);
+        shm_unlink(name);
+        shmRestoreSignals();
+        return 1;
     }
 
-     if (playedCount == 4) {
-        return HAND_INVALID;
+    unsigned char *base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(name);
+        shmRestoreSignals();
+        return 1;
     }
 
-    if (playedCount == 5) {
-        if (straight && flush) return HAND_STRAIGHT_FLUSH;
-        if (four == 1)         return HAND_FOUR_KIND;
-        if (three == 1 && pairs == 1) return HAND_FULL_HOUSE;
-        if (flush)             return HAND_FLUSH;
-        if (straight)          return HAND_STRAIGHT;
-        return HAND_INVALID;
+    ShmEnvHeader *hdr = (ShmEnvHeader *)base;
+    GameAction *actions = (GameAction *)(base + shmActionsOffset());
+
+    EnvBatch batch;
+    if (!envBatchInit(&batch, n, seed, base + shmObsOffset(n))) {
+        munmap(base, total);
+        shm_unlink(name);
+        shmRestoreSignals();
+        return 1;
     }
-    return HAND_INVALID; // C語言規定一定要有回傳值
-}
 
-double handTypeBaseScore(HandType type) {
-    switch (type) {
-        case HAND_STRAIGHT:        return 5.0;
-        case HAND_FLUSH:           return 6.0;
-        case HAND_FULL_HOUSE:      return 8.0;
-        case HAND_FOUR_KIND:       return 10.0;
-        case HAND_STRAIGHT_FLUSH:  return 12.0;
-        default:                   return 0.0;
+    hdr->version = SHM_ENV_VERSION;
+    atomic_store(&hdr->gamePid, (int)getpid());
+    hdr->numEnvs = (unsigned int)n;
+    hdr->totalSize = (unsigned int)total;
+    hdr->actionsOffset  = (unsigned int)shmActionsOffset();
+    hdr->rewardOffset   = (unsigned int)((unsigned char *)batch.reward - base);
+    hdr->doneOffset     = (unsigned int)((unsigned char *)batch.done - base);
+    hdr->phaseOffset    = (unsigned int)((unsigned char *)batch.phase - base);
+    hdr->handOffset     = (unsigned int)((unsigned char *)batch.hand - base);
+    hdr->scoreOffset    = (unsigned int)((unsigned char *)batch.score - base);
+    hdr->targetOffset   = (unsigned int)((unsigned char *)batch.target - base);
+    hdr->goldOffset     = (unsigned int)((unsigned char *)batch.gold - base);
+    hdr->comboOffset    = (unsigned int)((unsigned char *)batch.combo - base);
+    hdr->deckLeftOffset = (unsigned int)((unsigned char *)batch.deckLeft - base);
+    hdr->multMaskOffset = (unsigned int)((unsigned char *)batch.multMask - base);
+    atomic_store_explicit(&hdr->magic, SHM_ENV_MAGIC, memory_order_release);
+
+    // 第一個觀察值已經在 envBatchInit 寫好了
+    unsigned int actionSeq = atomic_load(&hdr->actionSeq);
+    bumpSeq(&hdr->obsSeq, &hdr->obsSleeping);
+
+    int status = 0;
+    while (1) {
+        unsigned int seq = waitSeqChange(&hdr->actionSeq, &hdr->actionSleeping, actionSeq, &hdr->trainerPid);
+        if (seq == actionSeq) {
+            fprintf(stderr, "訓練端（pid %d）已經結束，遊戲端跟著結束\n", atomic_load(&hdr->trainerPid));
+            status = 1;
+            break;
+        }
+        actionSeq = seq;
+        if (atomic_load_explicit(&hdr->quit, memory_order_acquire)) break;
+
+        envBatchStep(&batch, actions);   // 觀察值直接寫進共享記憶體
+        bumpSeq(&hdr->obsSeq, &hdr->obsSleeping);
     }
+
+    envBatchFree(&batch);
+    munmap(base, total);
+    shm_unlink(name);
+    shmRestoreSignals();
+    return status;
 }
 
-const char *handTypeName(HandType type) {
-    switch (type) {
-        case HAND_SINGLE:          return "Single";
-        case HAND_PAIR:            return "Pair";
-        case HAND_STRAIGHT:        return "Straight";
-        case HAND_FLUSH:           return "Flush";
-        case HAND_FULL_HOUSE:      return "Full House";
-        case HAND_FOUR_KIND:       return "Four of a Kind";
-        case HAND_STRAIGHT_FLUSH:  return "Straight Flush";
-        case HAND_INVALID:
-        default:                   return "Invalid";
+/* 訓練端：接上遊戲端建立的共享記憶體 */
+typedef struct {
+    unsigned char *base;
+    size_t size;
+    ShmEnvHeader *hdr;
+    GameAction *actions;
+    unsigned int obsSeq;
+    int gameGone;    // 遊戲端已經不在了
+    EnvBatch view;   // 只用到輸出陣列的指標
+} ShmEnvClient;
+
+static int shmClientAttach(ShmEnvClient *c, const char *name) {
+    int fd = -1;
+    // 遊戲端可能還在建立中：等它出現
+    for (int tries = 0; tries < 2000 && fd < 0; tries++) {
+        fd = shm_open(name, O_RDWR, 0);
+        if (fd < 0) usleep(1000);
+    }
+    if (fd < 0) return 0;
+
+    // 建立到一半的遊戲端可能已經死掉：大小和 magic 都只等一段時間
+    struct stat st;
+    int tries = 0;
+    while (fstat(fd, &st) == 0 && st.st_size < (off_t)sizeof(ShmEnvHeader) && tries++ < SHM_ATTACH_TRIES) {
+        usleep(1000);
+    }
+    if (st.st_size < (off_t)sizeof(ShmEnvHeader)) { close(fd); return 0; }
+
+    ShmEnvHeader *hdr = mmap(NULL, sizeof(ShmEnvHeader), PROT_READ, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) { close(fd); return 0; }
+    while (atomic_load_explicit(&hdr->magic, memory_order_acquire) != SHM_ENV_MAGIC && tries++ < SHM_ATTACH_TRIES) {
+        usleep(1000);
+    }
+    if (atomic_load_explicit(&hdr->magic, memory_order_acquire) != SHM_ENV_MAGIC ||
+        hdr->version != SHM_ENV_VERSION) {
+        munmap(hdr, sizeof(ShmEnvHeader));
+        close(fd);
+        return 0;
+    }
+    c->size = hdr->totalSize;
+    int n = (int)hdr->numEnvs;
+    munmap(hdr, sizeof(ShmEnvHeader));
+
+    c->base = mmap(NULL, c->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (c->base == MAP_FAILED) return 0;
+
+    c->hdr = (ShmEnvHeader *)c->base;
+    c->actions = (GameAction *)(c->base + c->hdr->actionsOffset);
+    memset(&c->view, 0, sizeof(c->view));
+    c->view.n = n;
+    layoutEnvObs(&c->view, n, c->base + shmObsOffset(n));
+    c->gameGone = 0;
+    atomic_store(&c->hdr->trainerPid, (int)getpid());
+
+    c->obsSeq = waitSeqChange(&c->hdr->obsSeq, &c->hdr->obsSleeping, 0, &c->hdr->gamePid);   // 等第一個觀察值
+    if (c->obsSeq == 0) {
+        munmap(c->base, c->size);
+        return 0;
     }
+    return 1;
 }
 
-const char *suitSymbol(int s) {
-    switch (s) {
-        case 0: return "♠";
-        case 1: return "♥";
-        case 2: return "♣";
-        case 3: return "♦";
-        default: return "?";
+/* actions 已經寫在 c->actions 裡：通知遊戲端並等結果（遊戲端不在了回傳 0） */
+static int shmClientStep(void *ctx, const GameAction *actions) {
+    ShmEnvClient *c = ctx;
+    (void)actions;
+    bumpSeq(&c->hdr->actionSeq, &c->hdr->actionSleeping);
+    unsigned int seq = waitSeqChange(&c->hdr->obsSeq, &c->hdr->obsSleeping, c->obsSeq, &c->hdr->gamePid);
+    if (seq == c->obsSeq) {
+        c->gameGone = 1;
+        return 0;
     }
+    c->obsSeq = seq;
+    return 1;
 }
 
-double evaluateHand(Card *played, int playedCount, const GameState *game, int *outHasBoost) {
-    if (outHasBoost) *outHasBoost = 0;
+static void shmClientClose(ShmEnvClient *c) {
+    atomic_store_explicit(&c->hdr->quit, 1, memory_order_release);
+    bumpSeq(&c->hdr->actionSeq, &c->hdr->actionSleeping);
+    munmap(c->base, c->size);
+}
 
-    if (playedCount <= 0) return 0.0;
-    if (playedCount > 5)  return 0.0;
+int runShmBench(long steps, int n, unsigned long long seed) {
+    char name[64];
+    snprintf(name, sizeof(name), "/cardgame-bench-%d", (int)getpid());
+    if (n <= 0) return 1;
+    long rounds = (steps + n - 1) / n;
+    long total = rounds * n;
+
+    pid_t pid = fork();
+    if (pid < 0) return 1;
+    if (pid == 0) {
+        _exit(runShmEnv(name, n, seed));
+    }
 
-    HandType type = classifyHand(played, playedCount);
-    if (type == HAND_INVALID) return 0.0;
+    ShmEnvClient client;
+    if (!shmClientAttach(&client, name)) {
+        fprintf(stderr, "無法連上共享記憶體：%s\n", name);
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        shm_unlink(name);   // 遊戲端被 SIGKILL 之類的結束時自己刪不掉
+        return 1;
+    }
 
-    double finalScore = 0.0;
+    long shmEpisodes = 0;
+    double shmReward = 0.0;
+    double shmTime = benchRounds(&client.view, client.actions, rounds, shmClientStep, &client,
+                                 &shmEpisodes, &shmReward);
+    int gameGone = client.gameGone;
+    shmClientClose(&client);
+    waitpid(pid, NULL, 0);
+    if (gameGone) {
+        fprintf(stderr, "遊戲端（pid %d）中途結束了\n", (int)pid);
+        shm_unlink(name);
+        return 1;
+    }
 
-    if (type == HAND_SINGLE) {
-        finalScore = game->singleScore;
-    } else if (type == HAND_PAIR) {
-        finalScore = game->pairScore;
-    } else {
-        finalScore = handTypeBaseScore(type);
+    // 同樣的種子、同樣的策略，在同一個 process 裡再跑一次
+    EnvBatch batch;
+    GameAction *actions = malloc((size_t)n * sizeof(GameAction));
+    long localEpisodes = 0;
+    double localReward = 0.0;
+    if (!actions || !envBatchInit(&batch, n, seed, NULL)) {
+        free(actions);
+        return 1;
     }
+    double localTime = benchRounds(&batch, actions, rounds, stepInProcess, &batch,
+                                   &localEpisodes, &localReward);
+    envBatchFree(&batch);
+    free(actions);
+
+    printf("=== 共享記憶體環境（%d 個環境，%ld 步，種子 %llu）===\n", n, total, seed);
+    printf("跨 process：%.3f 秒  |  %.2f M steps/sec\n", shmTime, total / shmTime / 1e6);
+    printf("同 process：%.3f 秒  |  %.2f M steps/sec\n", localTime, total / localTime / 1e6);
+    printf("跨 process / 同 process：%.1f%%\n", 100.0 * localTime / shmTime);
+    if (shmEpisodes != localEpisodes || shmReward != localReward) {
+        printf("%s兩邊的結果不一樣！%s\n", C_RED, C_RESET);
+        return 1;
+    }
+    printf("兩邊的結果完全相同（%ld 局結束）\n", shmEpisodes);
+    return 0;
+}
+
+#else
+
+int runShmEnv(const char *name, int n, unsigned long long seed) {
+    (void)name; (void)n; (void)seed;
+    fprintf(stderr, "共享記憶體環境只支援 Linux\n");
+    return 1;
+}
+
+int runShmBench(long steps, int n, unsigned long long seed) {
+    (void)steps; (void)n; (void)seed;
+    fprintf(stderr, "共享記憶體環境只支援 Linux\n");
+    return 1;
+}
+
+#endif
+
+/* ====== Benchmark ====== */
+
+#define BENCH_INPUTS 4096   // 預先產生的隨機手牌數（classifyHand 等項目輪流用，全部放得進 L2）
+
+typedef struct {
+    unsigned long long seed;
+    Card hands[BENCH_INPUTS][HAND_SIZE];      // 隨機 7 張（前 5 張給 classifyHand / evaluateHand）
+    unsigned char plays[BENCH_INPUTS];        // updateHandAfterPlay 要出的手牌 index bitmask
+    GameState rules;                          // evaluateHand 用的規則（有 Combo、有強化）
+    GameState start;                          // updateHandAfterPlay 的起點（第 1 關剛發完牌）
+    unsigned long long checksum;              // 這個樣本的結果摘要
+} BenchState;
+
+typedef struct {
+    const char *name;
+    const char *unit;                         // 一次 op 是什麼
+    long ops;                                 // 每個樣本做幾次
+    void (*run)(BenchState *st, long ops);
+} BenchCase;
+
+typedef struct {
+    double min, p50, p90, p99, max, mean;     // ns / op
+    double bytesPerOp;                        // 畫面輸出的 bytes / op（沒有輸出的項目是 0）
+    unsigned long long checksum;
+} BenchResult;
+
+void benchDefaultConfig(BenchConfig *cfg) {
+    cfg->seed = 1;
+    cfg->warmup = 3;
+    cfg->samples = 25;
+    cfg->filter = NULL;
+    cfg->jsonPath = NULL;
+}
 
-    // Card Multiplier：檢查是否有被強化的 rank
-    int hasBoostRank = 0;
-    for (int i = 0; i < playedCount; i++) {
-        int r = played[i].rank;
-        if (r >= 1 && r <= 13 && game->rankMultiplier[r]) {
-            hasBoostRank = 1;
-            break;
-        }
+static void benchShuffleDeck(BenchState *st, long ops) {
+    Card deck[NUM_CARDS];
+    Rng rng;
+    rngSeed(&rng, st->seed);
+    initDeck(deck);
+    for (long i = 0; i < ops; i++) {
+        shuffleDeck(deck, &rng);
+        st->checksum = st->checksum * 31 + (unsigned long long)cardIndex(&deck[0]);
     }
+}
 
-    if (hasBoostRank) {
-        finalScore *= 1.5;
-        if (outHasBoost) *outHasBoost = 1;
+static void benchClassifyHand(BenchState *st, long ops) {
+    for (long i = 0; i < ops; i++) {
+        st->checksum += classifyHand(st->hands[i % BENCH_INPUTS], 5);
     }
-
-    return finalScore; // 回傳：尚未套用 Combo 的分數
 }
 
-void applySuitChangeMagic(GameState *game) {
-    printf("\n=== Suit Change Magic Card ===\n");
-    printf("你可以把手牌中「一張牌」的花色改成你指定的花色。\n");
-
-    /* --- A) 選要改的那張牌（用手牌框框 + 黃框） --- */
-    int selected[HAND_SIZE] = {0};
-    printf("目前你的起手牌是：\n");
-    printHandBoxedSelected(game->hand, selected);
+static void benchEvaluateHand(BenchState *st, long ops) {
+    for (long i = 0; i < ops; i++) {
+        st->checksum += (unsigned long long)evaluateHand(st->hands[i % BENCH_INPUTS], 5, &st->rules, NULL);
+    }
+}
 
-    int idx;
-    printf("請輸入要改花色的牌的 index（0 ~ %d）：", HAND_SIZE - 1);
-    if (scanf("%d", &idx) != 1 || idx < 0 || idx >= HAND_SIZE) {
-        printf("輸入錯誤，Suit Change 魔法作廢。\n");
-        game->hasSuitChange = 0;
-        return;
+/* 一直出牌補牌，牌堆不夠補就從同一個開局重來 */
+static void benchUpdateHand(BenchState *st, long ops) {
+    GameState game = st->start;
+    for (long i = 0; i < ops; i++) {
+        Card played[HAND_SIZE];
+        int n = 0;
+        for (int k = 0; k < HAND_SIZE; k++) {
+            if (st->plays[i % BENCH_INPUTS] & (1u << k)) played[n++] = game.hand[k];
+        }
+        if (!updateHandAfterPlay(&game, played, n)) game = st->start;
+        st->checksum = st->checksum * 31 + (unsigned long long)cardIndex(&game.hand[0]);
     }
+}
 
-    // 亮黃框顯示你選到的那張
-    for(int i=0;i<HAND_SIZE;i++) selected[i]=0;
-    selected[idx] = 1;
-    printf("\n你選擇要改的牌是：\n");
-    printHandBoxedSelected(game->hand, selected);
+static void benchSimLevel(BenchState *st, long ops) {
+    GameState game;
+    for (long i = 0; i < ops; i++) {
+        newGame(&game, st->seed, (unsigned long long)i);
+        st->checksum += (unsigned long long)simPlayLevel(&game, &greedyPolicy, NULL) * 1000003u
+                      + (unsigned long long)game.score;
+    }
+}
 
-    /* --- B) 選新花色（4 個花色框框 + 黃框） --- */
-    printf("\n請選擇新的花色（輸入 0~3）：\n");
-    printSuitOptionsBoxed(-1);
+static void benchSimRun(BenchState *st, long ops) {
+    GameState game;
+    for (long i = 0; i < ops; i++) {
+        newGame(&game, st->seed, (unsigned long long)i);
+        st->checksum += (unsigned long long)simRunGame(&game, &greedyPolicy, NULL) * 1000003u
+                      + (unsigned long long)game.gold;
+    }
+}
 
-    int newSuit;
-    printf("輸入花色編號：");
-    if (scanf("%d", &newSuit) != 1 || newSuit < 0 || newSuit > 3) {
-        printf("輸入錯誤，Suit Change 魔法作廢。\n");
-        game->hasSuitChange = 0;
-        return;
+/* 畫面輸出已經接到 /dev/null（runBenchSuite 設定） */
+static void benchRenderHand(BenchState *st, long ops) {
+    for (long i = 0; i < ops; i++) {
+        int selected[HAND_SIZE];
+        for (int k = 0; k < HAND_SIZE; k++) selected[k] = (st->plays[i % BENCH_INPUTS] >> k) & 1;
+        long before = frameBytesWritten();
+        printHandBoxedSelected(st->hands[i % BENCH_INPUTS], selected);
+        st->checksum = st->checksum * 31 + (unsigned long long)(frameBytesWritten() - before);
     }
+}
 
-    // 亮黃框顯示你選到的花色
-    printf("\n你選擇的新花色是：\n");
-    printSuitOptionsBoxed(newSuit);
+static const BenchCase benchCases[] = {
+    { "shuffleDeck",         "deck",  16384, benchShuffleDeck },
+    { "classifyHand",        "hand",  65536, benchClassifyHand },
+    { "evaluateHand",        "hand",  65536, benchEvaluateHand },
+    { "updateHandAfterPlay", "play",  65536, benchUpdateHand },
+    { "simPlayLevel",        "level",   256, benchSimLevel },
+    { "simRunGame",          "run",     128, benchSimRun },
+    { "renderHand",          "frame",   512, benchRenderHand },
+};
+
+/* 輸入全部由種子決定，和跑哪幾項、跑幾個樣本無關 */
+static void benchPrepare(BenchState *st, unsigned long long seed) {
+    memset(st, 0, sizeof(*st));
+    st->seed = seed;
+
+    Card deck[NUM_CARDS];
+    Rng rng;
+    rngSeed(&rng, seed ^ 0x5EEDBE4C4ULL);
+    initDeck(deck);
+    for (int h = 0; h < BENCH_INPUTS; h++) {
+        shuffleDeck(deck, &rng);
+        memcpy(st->hands[h], deck, sizeof(st->hands[h]));
+        // 出 1 / 2 / 5 張，和實際遊戲差不多的比例
+        static const unsigned char counts[4] = { 1, 2, 2, 5 };
+        int want = counts[rngBelow(&rng, 4)];
+        unsigned char mask = 0;
+        while (__builtin_popcount(mask) < want) mask |= (unsigned char)(1u << rngBelow(&rng, HAND_SIZE));
+        st->plays[h] = mask;
+    }
 
-    int oldSuit = game->hand[idx].suit;
-    game->hand[idx].suit = newSuit;
+    st->rules.multMask = (1u << 1) | (1u << 7) | (1u << 12);
+    st->rules.comboCount = 2;
+    st->rules.singleScore = SCORE_SCALE;
+    st->rules.pairScore = 2 * SCORE_SCALE;
 
-    printf("\n已將第 %d 張牌的花色從 ", idx);
-    printf("%s%s%s", suitColor(oldSuit), suitSymbol(oldSuit), C_RESET);
-    printf(" 改成 ");
-    printf("%s%s%s。\n", suitColor(newSuit), suitSymbol(newSuit), C_RESET);
+    newGame(&st->start, seed, 0);
+}
 
-    printf("修改後的手牌：\n");
-    printHandBoxed(game->hand);
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
 
-    game->hasSuitChange = 0;  // 用掉
+/* 排好序的 v[0..n-1] 的第 p 百分位數（nearest rank） */
+static double percentile(const double *v, int n, double p) {
+    int k = (int)ceil(p / 100.0 * n) - 1;
+    if (k < 0) k = 0;
+    if (k >= n) k = n - 1;
+    return v[k];
 }
 
-void tryUseDrawBoost(GameState *game) {
-    // 檢查是否真的有這張牌 & 還沒用過
-    if (!game->hasDrawBoost || game->drawBoostUsed) {
-        printf("目前無法使用 Draw Boost。\n");
-        return;
+static void runBenchCase(const BenchCase *bc, BenchState *st, const BenchConfig *cfg,
+                         double *ns, BenchResult *out) {
+    long bytesBefore = 0;
+    for (int s = -cfg->warmup; s < cfg->samples; s++) {
+        st->checksum = 0;
+        bytesBefore = frameBytesWritten();
+        double start = nowSeconds();
+        bc->run(st, bc->ops);
+        double elapsed = nowSeconds() - start;
+        if (s >= 0) ns[s] = elapsed * 1e9 / bc->ops;
     }
 
-    // 檢查牌堆是否還夠抽 3 張
-    if (game->deckIndex + 3 > NUM_CARDS) {
-        printf("牌堆剩餘牌數不足，無法使用 Draw Boost。\n");
-        return;
-    }
+    // 每個樣本做的事都一樣，checksum / 輸出量看最後一個就好
+    out->checksum = st->checksum;
+    out->bytesPerOp = (double)(frameBytesWritten() - bytesBefore) / bc->ops;
+
+    double sum = 0.0;
+    for (int s = 0; s < cfg->samples; s++) sum += ns[s];
+    qsort(ns, (size_t)cfg->samples, sizeof(double), compareDoubles);
+    out->min  = ns[0];
+    out->p50  = percentile(ns, cfg->samples, 50);
+    out->p90  = percentile(ns, cfg->samples, 90);
+    out->p99  = percentile(ns, cfg->samples, 99);
+    out->max  = ns[cfg->samples - 1];
+    out->mean = sum / cfg->samples;
+}
 
-    Card candidates[3];
-    for (int i = 0; i < 3; i++) {
-        candidates[i] = game->deck[game->deckIndex];
-        game->deckIndex++;
+static void writeBenchJson(FILE *fp, const BenchConfig *cfg, const int *ran, const BenchResult *results) {
+    fprintf(fp, "{\n  \"seed\": %llu,\n  \"warmup\": %d,\n  \"samples\": %d,\n  \"playBatchKernel\": \"%s\",\n",
+            cfg->seed, cfg->warmup, cfg->samples, playBatchKernelName());
+    fprintf(fp, "  \"results\": [");
+    int first = 1;
+    for (size_t c = 0; c < sizeof(benchCases) / sizeof(benchCases[0]); c++) {
+        if (!ran[c]) continue;
+        const BenchCase *bc = &benchCases[c];
+        const BenchResult *r = &results[c];
+        fprintf(fp, "%s\n    {\"name\": \"%s\", \"unit\": \"%s\", \"opsPerSample\": %ld,\n"
+                    "     \"nsPerOp\": {\"min\": %.2f, \"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"max\": %.2f, \"mean\": %.2f},\n"
+                    "     \"opsPerSec\": %.1f, \"bytesPerOp\": %.1f, \"checksum\": \"%016llx\"}",
+                first ? "" : ",", bc->name, bc->unit, bc->ops,
+                r->min, r->p50, r->p90, r->p99, r->max, r->mean,
+                r->p50 > 0 ? 1e9 / r->p50 : 0.0, r->bytesPerOp, r->checksum);
+        first = 0;
     }
+    fprintf(fp, "\n  ]\n}\n");
+}
 
-    printf("\n=== Draw Boost 發動！===\n");
-    printf("從牌堆抽出 3 張牌：\n");
-    print3CardsBoxed(candidates);
+int runBenchSuite(const BenchConfig *cfg) {
+    enum { NUM_BENCH_CASES = sizeof(benchCases) / sizeof(benchCases[0]) };
+    if (cfg->samples <= 0 || cfg->warmup < 0) {
+        fprintf(stderr, "樣本數要大於 0\n");
+        return 1;
+    }
 
-    int pick;
-    printf("請選擇你要留下的牌（輸入 0~2）：");
-    if (scanf("%d", &pick) != 1 || pick < 0 || pick >= 3) {
-        printf("輸入錯誤，Draw Boost 取消。\n");
-        return;
+    BenchState *st = aligned_alloc(64, (sizeof(BenchState) + 63) & ~(size_t)63);
+    double *ns = malloc(sizeof(double) * (size_t)cfg->samples);
+    int nullFd = open("/dev/null", O_WRONLY);
+    if (st == NULL || ns == NULL || nullFd < 0) {
+        fprintf(stderr, "記憶體配置失敗！\n");
+        free(st);
+        free(ns);
+        if (nullFd >= 0) close(nullFd);
+        return 1;
+    }
+    benchPrepare(st, cfg->seed);
+
+    // JSON 寫到 stdout 時，給人看的表格改印到 stderr
+    int jsonToStdout = cfg->jsonPath && strcmp(cfg->jsonPath, "-") == 0;
+    FILE *log = jsonToStdout ? stderr : stdout;
+
+    fprintf(log, "=== 規則引擎 benchmark（種子 %llu，warm-up %d、計時 %d 個樣本，PlayBatch：%s）===\n",
+            cfg->seed, cfg->warmup, cfg->samples, playBatchKernelName());
+    fprintf(log, "%-20s %-6s %10s %10s %10s %10s %10s %14s  %s\n",
+            "name", "unit", "min", "p50", "p90", "p99", "max", "ops/sec(p50)", "checksum");
+
+    BenchResult results[NUM_BENCH_CASES];
+    int ran[NUM_BENCH_CASES] = {0};
+    frameSetOutput(nullFd);
+    for (int c = 0; c < NUM_BENCH_CASES; c++) {
+        const BenchCase *bc = &benchCases[c];
+        if (cfg->filter && strstr(bc->name, cfg->filter) == NULL) continue;
+
+        runBenchCase(bc, st, cfg, ns, &results[c]);
+        ran[c] = 1;
+
+        const BenchResult *r = &results[c];
+        fprintf(log, "%-20s %-6s %10.1f %10.1f %10.1f %10.1f %10.1f %14.0f  %016llx",
+                bc->name, bc->unit, r->min, r->p50, r->p90, r->p99, r->max,
+                r->p50 > 0 ? 1e9 / r->p50 : 0.0, r->checksum);
+        if (r->bytesPerOp > 0) fprintf(log, "  (%.0f bytes/op)", r->bytesPerOp);
+        fprintf(log, "\n");
     }
+    frameSetOutput(STDOUT_FILENO);
+    close(nullFd);
+    fprintf(log, "（單位：ns / op）\n");
+
+    int status = 0;
+    if (cfg->jsonPath) {
+        FILE *fp = jsonToStdout ? stdout : fopen(cfg->jsonPath, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "無法開啟 JSON 檔：%s\n", cfg->jsonPath);
+            status = 1;
+        } else {
+            writeBenchJson(fp, cfg, ran, results);
+            if (fp != stdout) fclose(fp);
+        }
+    }
+
+    free(ns);
+    free(st);
+    return status;
+}
 
-    printf("\n你目前的手牌為：\n");
-    printHandBoxed(game->hand);
+/* ====== 多人伺服器 ====== */
 
-    int replaceIndex;
-    printf("請選擇要被替換掉的手牌 index（0 ~ %d）：", HAND_SIZE - 1);
-    if (scanf("%d", &replaceIndex) != 1 ||
-        replaceIndex < 0 || replaceIndex >= HAND_SIZE) {
-        printf("輸入錯誤，Draw Boost 取消。\n");
-        return;
-    }
+void serverDefaultConfig(ServerConfig *cfg) {
+    cfg->listen = NULL;
+    cfg->threads = 1;
+    cfg->maxSessions = 100000;
+    cfg->seed = 1;
+}
 
-    printf("你將手牌第 %d 張換成 ", replaceIndex);
-    printCard(&candidates[pick]);
-    printf("。\n");
+void loadGenDefaultConfig(LoadGenConfig *cfg) {
+    cfg->connect = NULL;
+    cfg->sessions = 1000;
+    cfg->active = 100;
+    cfg->seconds = 5.0;
+    cfg->seed = 1;
+}
 
-    game->hand[replaceIndex] = candidates[pick];
+#ifdef __linux__
 
-    // 其餘 2 張直接丟棄（不放回牌堆）
+#define SESSION_LINE_MAX   64              // 一行指令最長（超過的整行丟掉）
+#define SESSION_OUT_LIMIT  (256 * 1024)    // 客戶端一直不讀回應：積到這麼多就斷線
+#define SESSION_SLAB       256             // slab 一次配幾個 session
+#define SERVER_MAX_EVENTS  256
+#define SERVER_CLEAR       "\033[H\033[2J"
+#define SERVER_PROMPT      "> "
 
-    game->hasDrawBoost  = 0;  // 這張 Magic Card 用掉了
-    game->drawBoostUsed = 1;  // 這一輪遊戲已經發動過 Draw Boost
+/*
+ * 一個 session = 一條連線 + 一局遊戲，整個放在 slab 裡（256 bytes，4 條 cache line）
+ * 輸出緩衝區只有在 socket 寫不下的時候才配置，閒置的 session 不佔額外記憶體
+ */
+typedef struct Session {
+    GameState game;
+    unsigned long long gameNo;
+    struct Session *nextFree;
+    char *out;                     // 還沒寫出去的輸出（NULL = 沒有積著的）
+    unsigned int outLen, outPos, outCap;
+    int fd;                        // -1 = 這一格沒在用
+    unsigned char inLen;
+    unsigned char discarding;      // 這一行太長：丟到換行為止
+    char in[SESSION_LINE_MAX];
+} Session;
+
+_Static_assert(sizeof(Session) <= 256, "Session 應該塞得進 4 條 cache line");
+
+/* 每條 worker 自己一個 pool（session 只在接受它的 worker 上配置 / 釋放，不用鎖） */
+typedef struct {
+    Session *freeList;
+    Session **slabs;
+    int numSlabs, capSlabs;
+} SessionPool;
+
+static Session *sessionAlloc(SessionPool *pool) {
+    if (!pool->freeList) {
+        if (pool->numSlabs == pool->capSlabs) {
+            int cap = pool->capSlabs ? pool->capSlabs * 2 : 16;
+            Session **slabs = realloc(pool->slabs, sizeof(*slabs) * (size_t)cap);
+            if (!slabs) return NULL;
+            pool->slabs = slabs;
+            pool->capSlabs = cap;
+        }
+        Session *slab = aligned_alloc(64, sizeof(Session) * SESSION_SLAB);
+        if (!slab) return NULL;
+        pool->slabs[pool->numSlabs++] = slab;
+        for (int i = SESSION_SLAB - 1; i >= 0; i--) {
+            slab[i].fd = -1;
+            slab[i].nextFree = pool->freeList;
+            pool->freeList = &slab[i];
+        }
+    }
+    Session *s = pool->freeList;
+    pool->freeList = s->nextFree;
+    memset(s, 0, sizeof(*s));
+    return s;
 }
 
-void chooseMagicCard(GameState *game) {
-    printf("\n=== ChooseMagicCard（免費二選一）===\n");
+static void sessionRelease(SessionPool *pool, Session *s) {
+    free(s->out);
+    s->out = NULL;
+    s->fd = -1;
+    s->nextFree = pool->freeList;
+    pool->freeList = s;
+}
 
-    // 你可以固定 +1 或隨機 1~3（我先保留你原本的隨機）
-    int bonus = (rand() % 3) + 1;
+typedef struct {
+    int id;
+    int epfd;
+    int listenFd;
+    int isTcp;
+    const ServerConfig *cfg;
+    pthread_t thread;
+    SessionPool pool;
+    char msg[FRAME_MAX_ROWS * FRAME_MAX_COLS * 16 + 64];   // 清畫面 + 一個畫面 + 提示字元
+
+    /* 統計（這條 worker 自己的，結束時才加總） */
+    long accepted, rejected, commands;
+    long long bytesOut;
+} ServerWorker;
+
+static char serverListenTag, serverStopTag;   // epoll 的 data.ptr：不是 session 的兩個 fd
+static _Atomic int serverLive = 0;
+static _Atomic int serverPeak = 0;
+static _Atomic unsigned long long serverNextGame = 0;
+
+static void sessionWatch(ServerWorker *w, Session *s, int wantWrite) {
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP | (wantWrite ? EPOLLOUT : 0);
+    ev.data.ptr = s;
+    epoll_ctl(w->epfd, EPOLL_CTL_MOD, s->fd, &ev);
+}
 
-    printf("請從以下兩張 Basic Magic Card 選一張（免費）：\n");
-    printf(" [1] Hand Score Upgrade\n");
-    printf("     效果：之後所有關卡 Pair 額外 +%d 分（永久累積）\n\n", bonus);
+/* 先直接寫；socket 寫不下的部分才存起來等 EPOLLOUT。回傳 0 = 這條連線該關了 */
+static int sessionSend(ServerWorker *w, Session *s, const char *data, size_t len) {
+    if (s->outPos == s->outLen) {
+        while (len > 0) {
+            ssize_t n = send(s->fd, data, len, MSG_NOSIGNAL);
+            if (n > 0) {
+                data += n;
+                len -= (size_t)n;
+                w->bytesOut += n;
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                return 0;
+            }
+        }
+        if (len == 0) return 1;
+        s->outLen = s->outPos = 0;
+        sessionWatch(w, s, 1);
+    }
 
-    printf(" [2] Suit Change\n");
-    printf("     效果：下一關開始時，可把起手牌其中一張改花色一次\n\n");
+    size_t pending = s->outLen - s->outPos;
+    if (pending + len > SESSION_OUT_LIMIT) return 0;
+    if (s->outPos > 0) {   // 前面已經寫掉的部分讓出來
+        memmove(s->out, s->out + s->outPos, pending);
+        s->outLen = (unsigned int)pending;
+        s->outPos = 0;
+    }
+    if (s->outLen + len > s->outCap) {
+        unsigned int cap = s->outCap ? s->outCap : 4096;
+        while (cap < s->outLen + len) cap *= 2;
+        char *out = realloc(s->out, cap);
+        if (!out) return 0;
+        s->out = out;
+        s->outCap = cap;
+    }
+    memcpy(s->out + s->outLen, data, len);
+    s->outLen += (unsigned int)len;
+    return 1;
+}
 
-    int choice;
-    while (1) {
-        printf("請輸入 1 或 2：");
-        if (scanf("%d", &choice) != 1) {
-            printf("輸入錯誤，請重試。\n");
+/* EPOLLOUT：把積著的輸出寫出去，寫完就把緩衝區還回去 */
+static int sessionFlushPending(ServerWorker *w, Session *s) {
+    while (s->outPos < s->outLen) {
+        ssize_t n = send(s->fd, s->out + s->outPos, s->outLen - s->outPos, MSG_NOSIGNAL);
+        if (n > 0) {
+            s->outPos += (unsigned int)n;
+            w->bytesOut += n;
+        } else if (n < 0 && errno == EINTR) {
             continue;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        } else {
+            return 0;
         }
-        if (choice == 1 || choice == 2) break;
-        printf("只能選 1 或 2。\n");
     }
+    free(s->out);
+    s->out = NULL;
+    s->outLen = s->outPos = s->outCap = 0;
+    sessionWatch(w, s, 0);
+    return 1;
+}
 
-    if (choice == 1) {
-        game->pairBonus += bonus;
-        printf("\n你選擇了 Hand Score Upgrade！\n");
-        printf("目前累積的 Pair 額外加分總共：+%.1f 分。\n", game->pairBonus);
-    } else {
-        game->hasSuitChange = 1;
-        printf("\n你選擇了 Suit Change！\n");
-        printf("將在【下一關開始時】對起手牌使用一次。\n");
+/* 畫面最後一行：這個階段能用的指令（"[階段]" 開頭，壓力測試的客戶端靠它決定下一個指令） */
+static void sessionPromptLine(const GameState *g, char *buf, size_t size) {
+    switch (g->phase) {
+    case PHASE_SUIT_CHANGE:
+        snprintf(buf, size, "[Suit Change] s 牌 花色 = 改花色（0♠ 1♥ 2♣ 3♦）  skip = 不用");
+        break;
+    case PHASE_TURN:
+        snprintf(buf, size, "[出牌] p 0 2 5 = 出這幾張  pass = 放棄這回合%s%s",
+                 (g->hasRedraw && !g->redrawUsedThisLevel) ? "  redraw = 重抽整手" : "",
+                 (g->hasDrawBoost && !g->drawBoostUsed) ? "  boost = 翻 3 張換 1 張" : "");
+        break;
+    case PHASE_BOOST_PICK:
+        snprintf(buf, size, "[Draw Boost] k 翻出的牌(0~2) 手牌(0~%d) = 換掉  skip = 取消", HAND_SIZE - 1);
+        break;
+    case PHASE_MAGIC:
+        snprintf(buf, size, "[Magic] 1 = Hand Score Upgrade（Pair +%d 分）  2 = Suit Change（下一關開始時用）",
+                 peekMagicBonus(g));
+        break;
+    case PHASE_SHOP:
+        snprintf(buf, size, "[商店] 1 = Draw Boost(%d)  2 = Card Multiplier(%d)  3 = Redraw(%d)  skip = 離開",
+                 COST_DRAW, COST_MULTI, COST_REDRAW);
+        break;
+    default:
+        snprintf(buf, size, "[結束] new = 再玩一局  quit = 離開");
+        break;
     }
 }
 
-void shopSystem(GameState *game) {
-    printf("\n=== Shop（花 Gold 購買）===\n");
-
-    const int COST_DRAW  = 25;
-    const int COST_MULTI = 30;
-    const int COST_REDRAW = 20;
+/* 畫這個 session 的整個畫面（在 worker 自己的畫面緩衝區上畫），送出去 */
+static int sessionRender(ServerWorker *w, Session *s, const char *notice, int noticeAttr) {
+    TRACE_SCOPE(TRACE_RENDER);
+    const GameState *g = &s->game;
+    char prompt[192];
 
-    while (1) {
-        printf("\n你目前 %sGold：%d%s\n", C_YELLOW, game->gold, C_RESET);
-        printf("你可以選擇購買：\n");
-        printf(" [1] Draw Boost（%d Gold）\n", COST_DRAW);
-        printf("     效果：下一次回合可抽 3 選 1，替換手牌一次（每關最多一次、不能囤多張）\n\n");
+    frameBegin(9);
+    int x = framePrintf(0, 0, ATTR_BOLD, "第 %d 關", g->level);
+    x = framePrintf(0, x, FG_DEFAULT, "  分數 %.1f / %.1f  ", scoreValue(g->score), scoreValue(g->target));
+    x = framePrintf(0, x, FG_YELLOW, "Gold %d", g->gold);
+    framePrintf(0, x, FG_DEFAULT, "  Combo %d  牌堆剩 %d 張", g->comboCount, NUM_CARDS - g->deckIndex);
 
-        printf(" [2] Card Multiplier（%d Gold）\n", COST_MULTI);
-        printf("     效果：隨機強化一個 rank，之後出牌含該 rank → 該手分數 x1.5（永久）\n\n");
+    framePutText(1, 0, FG_DEFAULT, "你的手牌：");
+    for (int i = 0; i < HAND_SIZE; i++) {
+        frameDrawCard(2, i * 8, &g->hand[i], i, 0);
+    }
+    if (g->phase == PHASE_BOOST_PICK) {
+        framePutText(1, 60, FG_CYAN, "翻出來的牌：");
+        for (int i = 0; i < 3; i++) {
+            frameDrawCard(2, 60 + i * 8, &boostCards(g)[i], i, 1);
+        }
+    }
+    if (notice) framePutText(7, 0, noticeAttr, notice);
+    sessionPromptLine(g, prompt, sizeof(prompt));
+    framePutText(8, 0, FG_DEFAULT, prompt);
+    frameFlush(0);
+
+    size_t len;
+    const char *frame = frameOutput(&len);
+    size_t clearLen = strlen(SERVER_CLEAR), promptLen = strlen(SERVER_PROMPT);
+    memcpy(w->msg, SERVER_CLEAR, clearLen);
+    memcpy(w->msg + clearLen, frame, len);
+    memcpy(w->msg + clearLen + len, SERVER_PROMPT, promptLen);
+    return sessionSend(w, s, w->msg, clearLen + len + promptLen);
+}
 
-        printf(" [3] Redraw（%d Gold）\n", COST_REDRAW);
-        printf("     效果：本關可重抽整手牌一次（每關最多一次、不能囤多張）\n\n");
+/* 一行指令 → GameAction；回傳 0 = 不認得 */
+static int parseSessionCommand(const GameState *g, const char *line, GameAction *act) {
+    char word[16] = "";
+    int n = 0;
+    if (sscanf(line, "%15s%n", word, &n) != 1) return 0;
+    const char *rest = line + n;
+    int a, b;
+
+    if (strcmp(word, "p") == 0) {
+        unsigned int slots = 0;
+        char *end;
+        while (1) {
+            long idx = strtol(rest, &end, 10);
+            if (end == rest) break;
+            if (idx < 0 || idx >= HAND_SIZE) return 0;
+            slots |= 1u << idx;
+            rest = end;
+        }
+        *act = (GameAction){ ACT_PLAY, (unsigned char)slots };
+    } else if (strcmp(word, "pass") == 0) {
+        *act = (GameAction){ ACT_PASS, 0 };
+    } else if (strcmp(word, "redraw") == 0) {
+        *act = (GameAction){ ACT_REDRAW, 0 };
+    } else if (strcmp(word, "boost") == 0) {
+        *act = (GameAction){ ACT_DRAW_BOOST, 0 };
+    } else if (strcmp(word, "k") == 0) {
+        if (sscanf(rest, "%d %d", &a, &b) != 2 || a < 0 || a >= 3 || b < 0 || b >= HAND_SIZE) return 0;
+        *act = (GameAction){ ACT_BOOST_PICK, (unsigned char)(a << 3 | b) };
+    } else if (strcmp(word, "s") == 0) {
+        if (sscanf(rest, "%d %d", &a, &b) != 2 || a < 0 || a >= HAND_SIZE || b < 0 || b > 3) return 0;
+        *act = (GameAction){ ACT_SUIT_CHANGE, (unsigned char)(a << 2 | b) };
+    } else if (strcmp(word, "skip") == 0 || strcmp(word, "0") == 0) {
+        *act = (GameAction){ ACT_SKIP, 0 };
+    } else if (strcmp(word, "1") == 0 || strcmp(word, "2") == 0 || strcmp(word, "3") == 0) {
+        unsigned char choice = (unsigned char)(word[0] - '0');
+        if (g->phase == PHASE_MAGIC) *act = (GameAction){ ACT_MAGIC, choice };
+        else *act = (GameAction){ ACT_SHOP, choice };
+    } else {
+        return 0;
+    }
+    return 1;
+}
 
-        printf(" [0] 離開商店\n\n");
+/* 處理一行指令並回一個畫面；回傳 0 = 這條連線該關了 */
+static int sessionCommand(ServerWorker *w, Session *s, const char *line) {
+    GameState *g = &s->game;
+    char notice[160];
+    int attr = FG_DEFAULT;
+    w->commands++;
 
-        int choice;
-        printf("請輸入 0 / 1 / 2 / 3：");
-        if (scanf("%d", &choice) != 1) {
-            printf("輸入錯誤，請重試。\n");
-            continue;
+    GameAction act;
+    if (strcmp(line, "quit") == 0) {
+        sessionSend(w, s, "再見！\n", strlen("再見！\n"));
+        return 0;
+    }
+    if (strcmp(line, "new") == 0) {
+        if (g->phase != PHASE_GAME_OVER) {
+            return sessionRender(w, s, "這一局還沒結束", FG_YELLOW);
         }
+        s->gameNo = atomic_fetch_add(&serverNextGame, 1);
+        newGame(g, w->cfg->seed, s->gameNo);
+        snprintf(notice, sizeof(notice), "第 %llu 局開始（種子 %llu）", s->gameNo, w->cfg->seed);
+        return sessionRender(w, s, notice, FG_CYAN);
+    }
+    if (!parseSessionCommand(g, line, &act)) {
+        return sessionRender(w, s, "看不懂這個指令（照最後一行的說明輸入）", FG_YELLOW);
+    }
 
-        if (choice == 0) {
-            printf("離開商店。\n");
-            return;
-        }
+    int phase = g->phase;
+    StepResult r;
+    int ok = gameStep(g, act, &r);
 
-        if (choice == 1) {
-            if (game->hasDrawBoost) {
-                printf("\n⚠ 你已經持有尚未使用的 Draw Boost，不能再買一張。\n");
-                continue;
-            }
-            if (game->gold < COST_DRAW) {
-                printf("%s%s\nGold 不足！需要 %d，但你只有 %d。%s\n", C_RED, C_BOLD, COST_DRAW, game->gold, C_RESET);
-                continue;
-            }
-            game->gold -= COST_DRAW;
-            game->hasDrawBoost = 1;
-            printf("\n購買成功：Draw Boost！剩餘 Gold：%d\n", game->gold);
-            return;
+    if (act.type == ACT_PLAY && phase == PHASE_TURN) {
+        if (!ok) {
+            snprintf(notice, sizeof(notice), "這不是合法的牌型，這一回合作廢");
+            attr = FG_RED;
+        } else {
+            snprintf(notice, sizeof(notice), "%s +%.1f 分%s  Gold +%d%s", handTypeName(r.play.type),
+                     scoreValue(r.play.gain), r.play.hasBoost ? "（含 x1.5）" : "", r.play.earnGold,
+                     r.refillFailed ? "  牌堆不夠補新的手牌了" : "");
+            attr = FG_GREEN;
+        }
+    } else if (!ok && act.type == ACT_SHOP && phase == PHASE_SHOP) {
+        static const char *const why[] = { "", "已經持有，不能再買", "Gold 不足", "1~13 全都已被強化", "沒有這個選項" };
+        snprintf(notice, sizeof(notice), "買不了：%s", why[r.shop]);
+        attr = FG_RED;
+    } else if (!ok) {
+        snprintf(notice, sizeof(notice), "現在不能這樣做");
+        attr = FG_YELLOW;
+    } else if (act.type == ACT_SHOP) {
+        snprintf(notice, sizeof(notice), "購買成功！進入第 %d 關", g->level);
+        attr = FG_GREEN;
+    } else if (act.type == ACT_SKIP && phase == PHASE_SHOP) {
+        snprintf(notice, sizeof(notice), "離開商店，進入第 %d 關", g->level);
+    } else if (act.type == ACT_MAGIC) {
+        if (act.arg == 1) {
+            snprintf(notice, sizeof(notice), "Pair 額外加分累積到 +%.1f 分", scoreValue(g->pairBonus));
+        } else {
+            snprintf(notice, sizeof(notice), "下一關開始時可以改一張牌的花色");
         }
+    } else {
+        notice[0] = '\0';
+    }
 
-        if (choice == 2) {
-            if (game->gold < COST_MULTI) {
-                printf("%s%s\nGold 不足！需要 %d，但你只有 %d。%s\n", C_RED, C_BOLD, COST_MULTI, game->gold, C_RESET);
-                continue;
-            }
+    if (r.levelEnd > 0) {
+        snprintf(notice + strlen(notice), sizeof(notice) - strlen(notice), "  %s",
+                 g->phase == PHASE_GAME_OVER ? "恭喜通過所有關卡！" : "過關！");
+    } else if (r.levelEnd < 0) {
+        snprintf(notice + strlen(notice), sizeof(notice) - strlen(notice), "  牌堆用完了，遊戲結束");
+    }
+    return sessionRender(w, s, notice[0] ? notice : NULL, attr);
+}
 
-            int available[13], cnt = 0;
-            for (int r = 1; r <= 13; r++) {
-                if (game->rankMultiplier[r] == 0) {
-                    available[cnt++] = r;
-                }
-            }
-            if (cnt == 0) {
-                printf("\n⚠ 1~13 全都已被強化，無法再買 Card Multiplier。\n");
-                continue;
-            }
+/* 讀一次（level-triggered：還有資料 epoll 會再叫，一條連線不會霸占 worker） */
+static int sessionRead(ServerWorker *w, Session *s) {
+    char buf[1024];
+    ssize_t n;
+    while ((n = recv(s->fd, buf, sizeof(buf), 0)) < 0 && errno == EINTR) {}
+    if (n == 0) return 0;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+
+    for (ssize_t i = 0; i < n; i++) {
+        char c = buf[i];
+        if (c == '\n') {
+            s->in[s->inLen] = '\0';
+            if (!s->discarding && !sessionCommand(w, s, s->in)) return 0;
+            s->inLen = 0;
+            s->discarding = 0;
+        } else if (c != '\r') {
+            if (s->inLen + 1 < SESSION_LINE_MAX) s->in[s->inLen++] = c;
+            else s->discarding = 1;
+        }
+    }
+    return 1;
+}
 
-            game->gold -= COST_MULTI;
+static void sessionClose(ServerWorker *w, Session *s) {
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    sessionRelease(&w->pool, s);
+    atomic_fetch_sub(&serverLive, 1);
+}
 
-            int chosenRank = available[rand() % cnt];
-            game->rankMultiplier[chosenRank] = 1;
+static void serverAccept(ServerWorker *w) {
+    while (1) {
+        int fd = accept4(w->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;   // EAGAIN：別的 worker 接走了；EMFILE 之類：等下一次
+        }
 
-            printf("\n購買成功：Card Multiplier！剩餘 Gold：%d\n", game->gold);
-            printf("已隨機強化點數：%d（之後出牌含 %d → 該手分數 x1.5）\n", chosenRank, chosenRank);
-            return;
+        int live = atomic_fetch_add(&serverLive, 1) + 1;
+        Session *s = (live <= w->cfg->maxSessions) ? sessionAlloc(&w->pool) : NULL;
+        if (!s) {
+            atomic_fetch_sub(&serverLive, 1);
+            close(fd);
+            w->rejected++;
+            continue;
         }
+        int peak = atomic_load(&serverPeak);
+        while (live > peak && !atomic_compare_exchange_weak(&serverPeak, &peak, live)) {}
 
-        if (choice == 3) {
-            if (game->hasRedraw) {
-                printf("\n⚠ 你已經持有一張 Redraw，不能再買。\n");
-                continue;
-            }
-            if (game->gold < COST_REDRAW) {
-                printf("%s%s\nGold 不足！需要 %d，但你只有 %d。%s\n", C_RED, C_BOLD, COST_REDRAW, game->gold, C_RESET);
-                continue;
-            }
-            game->gold -= COST_REDRAW;
-            game->hasRedraw = 1;
-            printf("\n購買成功：Redraw！剩餘 Gold：%d\n", game->gold);
-            return;
+        if (w->isTcp) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        s->fd = fd;
+        s->gameNo = atomic_fetch_add(&serverNextGame, 1);
+        newGame(&s->game, w->cfg->seed, s->gameNo);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = s;
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            sessionRelease(&w->pool, s);
+            atomic_fetch_sub(&serverLive, 1);
+            continue;
         }
+        w->accepted++;
 
-        printf("只能輸入 0 / 1 / 2 / 3。\n");
+        char notice[96];
+        snprintf(notice, sizeof(notice), "歡迎！這是種子 %llu 的第 %llu 局", w->cfg->seed, s->gameNo);
+        if (!sessionRender(w, s, notice, FG_CYAN)) sessionClose(w, s);
     }
 }
 
-void updateHandAfterPlay(GameState *game, Card *played, int playedCount) {
-    // 1. 建立一個暫存的新手牌陣列
-    Card newHand[HAND_SIZE];
-    int newIndex = 0;
-
-    // 2. 把沒有被出的牌搬進 newHand
-    for (int i = 0; i < HAND_SIZE; i++) {
-        int isPlayed = 0;
-
-        // 檢查 hand[i] 是否在 played[] 裡
-        for (int j = 0; j < playedCount; j++) {
-            if (game->hand[i].suit == played[j].suit &&
-                game->hand[i].rank == played[j].rank) {
-                isPlayed = 1;
-                break;
+static void *serverWorkerMain(void *arg) {
+    ServerWorker *w = arg;
+    TRACE_THREAD_NAME("server worker");
+    if (!frameUseThreadBuffer()) return NULL;
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int running = 1;
+    while (running) {
+        int n = epoll_wait(w->epfd, events, SERVER_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            void *tag = events[i].data.ptr;
+            if (tag == &serverStopTag) {
+                running = 0;
+            } else if (tag == &serverListenTag) {
+                serverAccept(w);
+            } else {
+                Session *s = tag;
+                unsigned int ev = events[i].events;
+                int alive = 1;
+                if (ev & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) alive = sessionRead(w, s);
+                if (alive && (ev & EPOLLOUT)) alive = sessionFlushPending(w, s);
+                if (!alive) sessionClose(w, s);
             }
         }
+    }
 
-        // 如果 hand[i] 沒有被出 → 放進 newHand
-        if (isPlayed==0) {
-            newHand[newIndex] = game->hand[i];
-            newIndex++;
+    // 還連著的 session 直接關掉
+    for (int k = 0; k < w->pool.numSlabs; k++) {
+        for (int i = 0; i < SESSION_SLAB; i++) {
+            Session *s = &w->pool.slabs[k][i];
+            if (s->fd >= 0) sessionClose(w, s);
         }
     }
+    frameReleaseThreadBuffer();
+    return NULL;
+}
 
-    // 3. 補牌：補 (7 - newIndex) 張
-    int need = HAND_SIZE - newIndex;
+/* "unix:路徑" / "tcp:埠號" → 位址；回傳 0 = 格式不對 */
+static int parseServerAddress(const char *spec, struct sockaddr_storage *addr, socklen_t *len, int *isTcp) {
+    memset(addr, 0, sizeof(*addr));
+    if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un *un = (struct sockaddr_un *)addr;
+        if (strlen(spec + 5) == 0 || strlen(spec + 5) >= sizeof(un->sun_path)) return 0;
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, spec + 5);
+        *len = sizeof(*un);
+        *isTcp = 0;
+        return 1;
+    }
+    if (strncmp(spec, "tcp:", 4) == 0) {
+        int port = atoi(spec + 4);
+        if (port <= 0 || port > 65535) return 0;
+        struct sockaddr_in *in = (struct sockaddr_in *)addr;
+        in->sin_family = AF_INET;
+        in->sin_port = htons((unsigned short)port);
+        in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        *len = sizeof(*in);
+        *isTcp = 1;
+        return 1;
+    }
+    return 0;
+}
 
-    if (game->deckIndex + need > NUM_CARDS) {
-        printf("牌堆不夠補新的手牌了！\n");
-        return;
+/* 一萬多條連線會超過預設的檔案數上限：調到 hard limit */
+static void raiseFileLimit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
     }
+}
 
-    for (int i = 0; i < need; i++) {
-        newHand[newIndex] = game->deck[game->deckIndex];
-        newIndex++;
-        game->deckIndex++;
+/*
+ * bind 前清掉上次留下的 socket 檔：路徑上是別的東西（一般檔案、目錄……）或是
+ * 還有伺服器在聽的 socket 就不動它，回傳 0
+ */
+static int removeStaleSocket(const char *path) {
+    struct stat st;
+    if (lstat(path, &st) != 0) return errno == ENOENT;
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s 已經存在而且不是 socket，不會刪掉它\n", path);
+        return 0;
     }
 
-    // 4. 把 newHand 複製回玩家的手牌
-    for (int i = 0; i < HAND_SIZE; i++) {
-        game->hand[i] = newHand[i];
+    struct sockaddr_un un;
+    memset(&un, 0, sizeof(un));
+    un.sun_family = AF_UNIX;
+    snprintf(un.sun_path, sizeof(un.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int live = fd >= 0 && connect(fd, (struct sockaddr *)&un, sizeof(un)) == 0;
+    if (fd >= 0) close(fd);
+    if (live) {
+        fprintf(stderr, "%s 上已經有伺服器在等待連線\n", path);
+        return 0;
     }
+    return unlink(path) == 0 || errno == ENOENT;
 }
 
-int playLevel(GameState *game) { 
-    printf("=== 開始第 %d 關 ===\n", game->level);
-    printf("目標分數：%.1f\n", game->target);
-    printf("目前牌堆位置：%d / %d\n\n", game->deckIndex, NUM_CARDS);
+/* 結束時刪掉自己 bind 出來的 socket 檔（created 是 bind 完的 lstat） */
+static void removeOwnSocket(const char *path, const struct stat *created) {
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode) &&
+        st.st_dev == created->st_dev && st.st_ino == created->st_ino) {
+        unlink(path);
+    }
+}
 
-    while (1) {
-        printf("\n目前分數：%.1f  |  目前 %sGold：%d%s\n",
-        game->score, C_YELLOW, game->gold, C_RESET);
-        if (game->comboCount > 1) {
-            double comboMultiplier = 1.0 + 0.15 * (game->comboCount - 1);
-            printf("%s%s當前 Combo：%d 連擊，倍率 x%.2f%s\n", C_MAG, C_BOLD, game->comboCount, comboMultiplier, C_RESET);
-        } else if (game->comboCount == 1) {
-            printf("當前 Combo：1 連擊（尚未加成）\n");
-        } else {
-            printf("當前 Combo：無\n");
-        }
-
-        if (game->score >= game->target) {
-            printf("%s%s恭喜！你已達成目標分數，通過第 %d 關！%s\n", C_GREEN, C_BOLD, game->level, C_RESET);
-            printf("你在本關總共出了 %d 手牌。\n", game->handsUsed);
-            if (game->level == 5){
-                playSound("sounds/遊戲最後一關成功.mp3");
-                usleep(1200000);
-            }else {
-                playSound("sounds/遊戲成功.mp3");
-                usleep(900000);
-            }
-            return 1;   // 用 1 代表「這一關過關」
-        }
+int runServer(const ServerConfig *cfg) {
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    int isTcp;
+    if (!parseServerAddress(cfg->listen, &addr, &addrLen, &isTcp)) {
+        fprintf(stderr, "不認得的位址：%s（可用 unix:路徑 / tcp:埠號）\n", cfg->listen);
+        return 1;
+    }
+    int threads = cfg->threads > 0 ? cfg->threads : cpuCount();
+    raiseFileLimit();
+
+    const char *sockPath = isTcp ? NULL : cfg->listen + 5;
+    int listenFd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listenFd < 0) return 1;
+    if (isTcp) {
+        int one = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    } else if (!removeStaleSocket(sockPath)) {
+        close(listenFd);
+        return 1;
+    }
+    if (bind(listenFd, (struct sockaddr *)&addr, addrLen) != 0) {
+        fprintf(stderr, "無法在 %s 上等待連線：%s\n", cfg->listen, strerror(errno));
+        close(listenFd);
+        return 1;
+    }
 
-        if (game->deckIndex >= NUM_CARDS) {
-            printf("%s%s牌堆用完了，但分數還沒達到目標，遊戲失敗 QQ%s\n", C_RED, C_BOLD, C_RESET);
-            playSound("sounds/遊戲失敗.mp3");
-            usleep(1200000);
-            return 0;   // 用 0 代表「這一關失敗」
-        }
+    // 記下自己建立的 socket 檔；結束時路徑上還是同一個檔才刪（可能已經被別人換掉）
+    struct stat created;
+    int ownsSocket = sockPath && lstat(sockPath, &created) == 0;
+    if (listen(listenFd, SOMAXCONN) != 0) {
+        fprintf(stderr, "無法在 %s 上等待連線：%s\n", cfg->listen, strerror(errno));
+        close(listenFd);
+        if (ownsSocket) removeOwnSocket(sockPath, &created);
+        return 1;
+    }
 
-        /* 如果有 Redraw（商店買的），本關可用一次，不扣分 */
-        if (game->hasRedraw && !game->redrawUsedThisLevel) {
-            int useRedraw;
-            printf("\n你擁有一張『Redraw』Magic Card。\n");
-            printf("是否要使用？(1 = 使用, 0 = 不使用)：");
-            if (scanf("%d", &useRedraw) == 1 && useRedraw == 1) {
+    // SIGINT / SIGTERM 只由主執行緒用 sigwait 收（worker 建立前擋掉，worker 會繼承）
+    sigset_t stopSignals;
+    sigemptyset(&stopSignals);
+    sigaddset(&stopSignals, SIGINT);
+    sigaddset(&stopSignals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stopSignals, NULL);
+
+    int stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    ServerWorker *workers = calloc((size_t)threads, sizeof(ServerWorker));
+    if (stopFd < 0 || !workers) {
+        close(listenFd);
+        if (ownsSocket) removeOwnSocket(sockPath, &created);
+        return 1;
+    }
 
-                if (game->deckIndex + HAND_SIZE > NUM_CARDS) {
-                    printf("牌堆剩餘牌數不足，無法重抽整手牌。\n");
-                } else {
-                    game->hasRedraw  = 0;   // 用掉
-                    game->redrawUsedThisLevel = 1;
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        ServerWorker *w = &workers[i];
+        w->id = i;
+        w->listenFd = listenFd;
+        w->isTcp = isTcp;
+        w->cfg = cfg;
+        w->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+        // 每條 worker 都等 listen socket；EPOLLEXCLUSIVE：一條新連線只叫醒一條 worker
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev.data.ptr = &serverListenTag;
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, listenFd, &ev);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &serverStopTag;
+        epoll_ctl(w->epfd, EPOLL_CTL_ADD, stopFd, &ev);
+
+        if (pthread_create(&w->thread, NULL, serverWorkerMain, w) != 0) {
+            close(w->epfd);
+            break;
+        }
+        started++;
+    }
 
-                    for (int i = 0; i < HAND_SIZE; i++) {
-                        game->hand[i] = game->deck[game->deckIndex];
-                        game->deckIndex++;
-                    }
+    printf("伺服器在 %s 上等待連線（%d 條執行緒，最多 %d 個 session，種子 %llu）\n",
+           cfg->listen, started, cfg->maxSessions, cfg->seed);
+    printf("用 nc -U 路徑 或 nc 127.0.0.1 埠號 就能玩；Ctrl-C 結束\n");
+    fflush(stdout);
 
-                    printf("已重抽整手牌！新的手牌為：\n");
-                    printHandBoxed(game->hand);
-                    continue; // 用新手牌重新考慮
-                }
-            }
-        }
+    int sig;
+    sigwait(&stopSignals, &sig);
+    unsigned long long one = 1;
+    if (write(stopFd, &one, sizeof(one)) < 0) {}   // eventfd 保持可讀：每條 worker 都會醒來
+
+    long accepted = 0, rejected = 0, commands = 0;
+    long long bytesOut = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        accepted += workers[i].accepted;
+        rejected += workers[i].rejected;
+        commands += workers[i].commands;
+        bytesOut += workers[i].bytesOut;
+        for (int k = 0; k < workers[i].pool.numSlabs; k++) free(workers[i].pool.slabs[k]);
+        free(workers[i].pool.slabs);
+        close(workers[i].epfd);
+    }
 
-        /* 如果有 Draw Boost，問玩家這回合要不要用 */
-        if (game->hasDrawBoost && !game->drawBoostUsed) {
-            int useBoost;
-            printf("\n你擁有一張『Draw Boost』Magic Card。\n");
-            printf("是否要使用？(1 = 使用, 0 = 不使用)：");
-            if (scanf("%d", &useBoost) == 1 && useBoost == 1) {
-                tryUseDrawBoost(game);
-            }
-        }
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double cpu = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    printf("\n=== 伺服器統計 ===\n");
+    printf("連線：%ld 個（同時最多 %d 個），拒絕 %ld 個\n", accepted, atomic_load(&serverPeak), rejected);
+    printf("指令：%ld 個  |  送出 %.1f MB\n", commands, bytesOut / 1e6);
+    printf("CPU：%.2f 秒（%.1f µs / 指令）  |  最大常駐記憶體 %ld MB\n",
+           cpu, commands ? cpu * 1e6 / commands : 0.0, ru.ru_maxrss / 1024);
+
+    close(stopFd);
+    close(listenFd);
+    if (ownsSocket) removeOwnSocket(sockPath, &created);
+    free(workers);
+    return 0;
+}
 
-        // ===== 正常出牌流程 =====
-        Card played[HAND_SIZE];
-        int playedCount = 0;
-
-        int ok = playerPlayHand(game, played, &playedCount);
-        if (!ok || playedCount == 0) {
-            printf("你這回合沒有成功出牌。\n");
-            playSound("sounds/出牌失敗.mp3");
-            usleep(900000);   // 0.8 秒，和你成功音效節奏一致
-            game->comboCount = 0;   // 出牌失敗 → 連擊中斷
-            continue;
-        }
-        playSound("sounds/出牌成功.mp3");
-        usleep(900000); 
-        
-        int hasBoost = 0;
-        HandType type = classifyHand(played, playedCount);
+/* ---- 壓力測試的客戶端 ---- */
 
-        // 先算：尚未套用 Combo 的 base gain（但已包含 x1.5 multiplier）
-        double baseGain = evaluateHand(played, playedCount, game, &hasBoost);
+typedef struct {
+    int fd;
+    int active;
+    int ready;              // 收到第一個畫面了
+    double sentAt;          // 最後一個指令送出的時間（0 = 沒有在等回應）
+    char tail[256];         // 收到的最後一段（找提示字元和階段標籤）
+    int tailLen;
+} LoadConn;
+
+/* 最後收到的是不是一個完整的回應（畫面最後是 "\n> "） */
+static int loadConnResponseDone(const LoadConn *c) {
+    int n = c->tailLen, k = (int)strlen("\n" SERVER_PROMPT);
+    return n >= k && memcmp(c->tail + n - k, "\n" SERVER_PROMPT, (size_t)k) == 0;
+}
 
-        double gain = baseGain;      // 之後可能套 combo
-        double comboMult = 1.0;
-        int brokeCombo = 0;
+/* 依最後一行的 "[階段]" 決定下一個指令：出牌隨便出一張，其他一律用最便宜的選項 */
+static const char *loadConnNextCommand(const LoadConn *c, Rng *rng, char *buf, size_t size) {
+    int end = c->tailLen - (int)strlen("\n" SERVER_PROMPT);
+    int start = end;
+    while (start > 0 && c->tail[start - 1] != '\n') start--;
+    const char *line = c->tail + start;
+    int len = end - start;
+
+    if (len >= 8 && memcmp(line, "[出牌]", strlen("[出牌]")) == 0) {
+        snprintf(buf, size, "p %u\n", rngBelow(rng, HAND_SIZE));
+        return buf;
+    }
+    if (len >= 7 && memcmp(line, "[Magic]", 7) == 0) return "1\n";
+    if (len >= 8 && memcmp(line, "[結束]", strlen("[結束]")) == 0) return "new\n";
+    return "skip\n";   // Suit Change / Draw Boost / 商店
+}
 
-        // Combo 規則
-        if (type == HAND_SINGLE) {
-            game->comboCount = 0;
-            brokeCombo = 1;
-        } else {
-            game->comboCount++;
-            comboMult = 1.0 + 0.15 * (game->comboCount - 1);
-            gain *= comboMult;
-        }
+static int loadConnSend(LoadConn *c, Rng *rng) {
+    char buf[32];
+    const char *cmd = loadConnNextCommand(c, rng, buf, sizeof(buf));
+    c->tailLen = 0;
+    c->sentAt = nowSeconds();
+    return send(c->fd, cmd, strlen(cmd), MSG_NOSIGNAL) == (ssize_t)strlen(cmd);
+}
 
-        // 更新總分
-        game->score += gain;
+static int loadConnect(const struct sockaddr_storage *addr, socklen_t addrLen) {
+    for (int tries = 0; tries < 1000; tries++) {
+        int fd = socket(addr->ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        if (connect(fd, (const struct sockaddr *)addr, addrLen) == 0 || errno == EINPROGRESS) return fd;
+        int err = errno;
+        close(fd);
+        if (err != EAGAIN && err != ECONNREFUSED) return -1;
+        usleep(1000);   // backlog 滿了（unix socket 回 EAGAIN）：等伺服器接走一些
+    }
+    return -1;
+}
 
-        // Gold
-        int earnGold = (int)gain;
-        if (earnGold < 0) earnGold = 0;
-        game->gold += earnGold;
+int runLoadGen(const LoadGenConfig *cfg) {
+    struct sockaddr_storage addr;
+    socklen_t addrLen;
+    int isTcp;
+    if (!parseServerAddress(cfg->connect, &addr, &addrLen, &isTcp)) {
+        fprintf(stderr, "不認得的位址：%s（可用 unix:路徑 / tcp:埠號）\n", cfg->connect);
+        return 1;
+    }
+    int n = cfg->sessions > 0 ? cfg->sessions : 1;
+    int active = cfg->active < n ? cfg->active : n;
+    raiseFileLimit();
+
+    LoadConn *conns = calloc((size_t)n, sizeof(LoadConn));
+    long latCap = 1 << 16, latCount = 0;
+    double *lat = malloc(sizeof(double) * (size_t)latCap);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!conns || !lat || epfd < 0) return 1;
+    Rng rng;
+    rngForGame(&rng, cfg->seed, 0);
+
+    double start = nowSeconds();
+    int connected = 0;
+    for (int i = 0; i < n; i++) {
+        LoadConn *c = &conns[i];
+        c->active = i < active;
+        c->fd = loadConnect(&addr, addrLen);
+        if (c->fd < 0) {
+            fprintf(stderr, "第 %d 條連線失敗：%s\n", i, strerror(errno));
+            break;
+        }
+        if (isTcp) {
+            int one = 1;
+            setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+        connected++;
+    }
 
-        /* ===== 回合結算面板 ===== */
-        printf("\n%s───────── 回合結算 ─────────%s\n", C_BOLD, C_RESET);
-        printf("牌型：%s\n", handTypeName(type));
-        printf("本回合小計（未套 Combo)：%.1f\n", baseGain);
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    int ready = 0, dropped = 0;
+    double connectTime = 0, measureStart = 0, deadline = start + 30.0;
+    long commands = 0;
+    char buf[16384];
 
-        if (hasBoost) {
-            printf("Card Multiplier：%s已觸發(x1.5)%s\n", C_YELLOW, C_RESET);
+    while (1) {
+        double now = nowSeconds();
+        if (measureStart == 0 && (ready + dropped >= connected || now >= deadline)) {
+            // 全部都收到第一個畫面了：開始量，active 的連線送出第一個指令
+            connectTime = now - start;
+            measureStart = now;
+            deadline = now + cfg->seconds;
+            for (int i = 0; i < connected; i++) {
+                if (conns[i].active && conns[i].ready && conns[i].fd >= 0 && !loadConnSend(&conns[i], &rng)) {
+                    conns[i].active = 0;
+                }
+            }
         }
+        if (measureStart > 0 && now >= deadline) break;
+
+        int timeout = (int)ceil((deadline - now) * 1000.0);
+        int m = epoll_wait(epfd, events, SERVER_MAX_EVENTS, timeout > 0 ? timeout : 0);
+        if (m < 0 && errno != EINTR) break;
+        for (int k = 0; k < m; k++) {
+            LoadConn *c = events[k].data.ptr;
+            ssize_t got = recv(c->fd, buf, sizeof(buf), 0);
+            if (got <= 0) {
+                if (got < 0 && (errno == EAGAIN || errno == EINTR)) continue;
+                epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+                close(c->fd);
+                c->fd = -1;
+                dropped++;
+                continue;
+            }
+            // 只留最後 sizeof(tail) bytes
+            if (got >= (ssize_t)sizeof(c->tail)) {
+                memcpy(c->tail, buf + got - sizeof(c->tail), sizeof(c->tail));
+                c->tailLen = (int)sizeof(c->tail);
+            } else {
+                int keep = (int)sizeof(c->tail) - (int)got;
+                if (c->tailLen > keep) {
+                    memmove(c->tail, c->tail + c->tailLen - keep, (size_t)keep);
+                    c->tailLen = keep;
+                }
+                memcpy(c->tail + c->tailLen, buf, (size_t)got);
+                c->tailLen += (int)got;
+            }
+            if (!loadConnResponseDone(c)) continue;
 
-        if (brokeCombo) {
-            printf("Combo：中斷(Single)\n");
-        } else {
-            printf("Combo：%d 連擊，倍率 x%.2f\n", game->comboCount, comboMult);
+            if (!c->ready) {
+                c->ready = 1;
+                ready++;
+            }
+            if (c->sentAt > 0) {
+                if (latCount == latCap) {
+                    latCap *= 2;
+                    double *grown = realloc(lat, sizeof(double) * (size_t)latCap);
+                    if (!grown) break;
+                    lat = grown;
+                }
+                lat[latCount++] = (nowSeconds() - c->sentAt) * 1e6;
+                commands++;
+                c->sentAt = 0;
+            }
+            if (measureStart > 0 && c->active && !loadConnSend(c, &rng)) c->active = 0;
         }
+    }
+    double measured = nowSeconds() - measureStart;
+
+    printf("=== 壓力測試（%s，%d 條連線，其中 %d 條在玩，量 %.1f 秒）===\n",
+           cfg->connect, n, active, cfg->seconds);
+    printf("連上 %d 條、收到第一個畫面 %d 條，花了 %.3f 秒；中途斷線 %d 條\n",
+           connected, ready, connectTime, dropped);
+    printf("指令：%ld 個  |  %.0f 個 / 秒\n", commands, measured > 0 ? commands / measured : 0.0);
+    if (latCount > 0) {
+        qsort(lat, (size_t)latCount, sizeof(double), compareDoubles);
+        int cnt = latCount > INT_MAX ? INT_MAX : (int)latCount;
+        printf("回應延遲（µs）：p50 %.0f  p90 %.0f  p99 %.0f  max %.0f\n",
+               percentile(lat, cnt, 50), percentile(lat, cnt, 90), percentile(lat, cnt, 99), lat[cnt - 1]);
+    }
 
-        printf("本回合實得分：%s+%.1f%s\n", C_GREEN, gain, C_RESET);
-        printf("Gold：%s+%d%s（總額： %s%d%s）\n", C_YELLOW, earnGold, C_RESET, C_YELLOW, game->gold, C_RESET);
-        printf("%s────────────────────────────%s\n", C_BOLD, C_RESET);
+    for (int i = 0; i < connected; i++) {
+        if (conns[i].fd >= 0) close(conns[i].fd);
+    }
+    close(epfd);
+    free(conns);
+    free(lat);
+    return (ready + dropped < connected || dropped > 0) ? 1 : 0;
+}
 
-        waitEnter();
+#else
 
-        game->handsUsed++;  // 成功出了一手牌，計數 +1
+int runServer(const ServerConfig *cfg) {
+    (void)cfg;
+    fprintf(stderr, "多人伺服器只支援 Linux（epoll）\n");
+    return 1;
+}
 
-        updateHandAfterPlay(game, played, playedCount);
-    }
+int runLoadGen(const LoadGenConfig *cfg) {
+    (void)cfg;
+    fprintf(stderr, "多人伺服器只支援 Linux（epoll）\n");
+    return 1;
 }
 
-void freeGame(GameState *game) {
-    free(game->deck);
-    free(game->hand);
-    game->deck = NULL;
-    game->hand = NULL;
-}
\ No newline at end of file
+#endif